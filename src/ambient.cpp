@@ -0,0 +1,50 @@
+#include "ambient.h"
+
+// Reading where step n becomes step n + 1 (10-bit ADC)
+static const uint16_t step_bounds[AMBIENT_STEPS - 1] = { 40, 120, 300, 600 };
+// Strip brightness for each step, darkest room first
+static const uint8_t step_brightness[AMBIENT_STEPS] = { 12, 40, 96, 180, 255 };
+
+void ambient_init(struct ambient_filter *f) {
+	f->level = 0;
+	f->step = AMBIENT_STEPS - 1;
+	f->primed = false;
+}
+
+uint16_t ambient_level(const struct ambient_filter *f) {
+	return f->level >> AMBIENT_FRAC_BITS;
+}
+
+/** @brief Add a sample and update the brightness step.
+ *
+ * The first sample sets the filter directly so the step is right from boot.
+ *
+ * @return true if the step changed
+ */
+bool ambient_feed(struct ambient_filter *f, uint16_t adc) {
+	int32_t x = (int32_t)adc << AMBIENT_FRAC_BITS;
+	if (!f->primed) {
+		f->level = x;
+		f->primed = true;
+	} else {
+		f->level += (x - f->level) >> AMBIENT_IIR_SHIFT;
+	}
+
+	uint16_t level = ambient_level(f);
+	uint8_t step = f->step;
+	while ((step < AMBIENT_STEPS - 1) && (level >= step_bounds[step] + AMBIENT_HYSTERESIS)) {
+		step++;
+	}
+	while ((step > 0) && (level + AMBIENT_HYSTERESIS < step_bounds[step - 1])) {
+		step--;
+	}
+	if (step == f->step) {
+		return false;
+	}
+	f->step = step;
+	return true;
+}
+
+uint8_t ambient_brightness(const struct ambient_filter *f) {
+	return step_brightness[f->step];
+}
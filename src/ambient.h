@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Ambient light adaptive brightness.
+ *
+ * A light sensor divider on A0 (brighter room, higher reading) is sampled
+ * once every AMBIENT_SAMPLE_MS; an analogRead() takes about 100 us, so the
+ * ADC is idle almost all the time and does not upset WiFi the way frequent
+ * reads do. Samples go through an integer IIR filter and pick one of a few
+ * brightness steps. A step boundary has to be crossed by
+ * AMBIENT_HYSTERESIS counts before the step changes, so a reading sitting
+ * on a boundary (or lamp flicker) does not make the strip flicker.
+ *
+ * Enabled with -D OTW_AMBIENT; without a sensor A0 reads near 0 and would
+ * hold the strip at the dimmest step.
+ *
+ * Portable: no Arduino dependencies, so host tools can replay traces.
+ */
+
+#define AMBIENT_SAMPLE_MS 1000
+// Filter weight 1/2^AMBIENT_IIR_SHIFT: about 8 samples to settle
+#define AMBIENT_IIR_SHIFT 3
+// Fractional bits kept in the filter state
+#define AMBIENT_FRAC_BITS 4
+#define AMBIENT_HYSTERESIS 12
+#define AMBIENT_STEPS 5
+
+struct ambient_filter {
+	int32_t level;      // filtered reading << AMBIENT_FRAC_BITS
+	uint8_t step;
+	bool primed;
+};
+
+void ambient_init(struct ambient_filter *f);
+bool ambient_feed(struct ambient_filter *f, uint16_t adc);
+uint16_t ambient_level(const struct ambient_filter *f);
+uint8_t ambient_brightness(const struct ambient_filter *f);
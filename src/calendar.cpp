@@ -0,0 +1,216 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include <EEPROM.h>
+#include <CRC32.h>
+#include "cJSON.h"
+#include "calendar.h"
+#include "schedule_store.h"
+
+static_assert(STORE_CALENDAR_BASE + sizeof(struct otw_calendar) <= STORE_EEPROM_SIZE,
+              "Calendar does not fit in STORE_EEPROM_SIZE");
+
+struct otw_calendar _otw_calendar;
+static uint8_t _cal_rank[CAL_BITMAP_WORDS];
+
+static const uint16_t days_before_month[12] = {
+	0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334
+};
+static const uint8_t days_in_month[12] = {
+	31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+};
+
+static bool is_leap(int year) {
+	return ((year % 4 == 0) && (year % 100 != 0)) || (year % 400 == 0);
+}
+
+// Day of the week, Monday 0, as the schedule's days are indexed
+static int day_of_week(int year, int doy) {
+	// 1 Jan 0001 was a Monday in the proleptic Gregorian calendar
+	long y = year - 1;
+	return ((365 * y) + (y / 4) - (y / 100) + (y / 400) + doy) % 7;
+}
+
+/** @brief Return the zero-based day of the year (Jan 1st is 0).
+ *
+ * @return int in range [0..365], or -1 for an invalid date
+ */
+int calendar_day_of_year(int year, int month, int day) {
+	if ((month < 1) || (month > 12) || (day < 1)) {
+		return -1;
+	}
+	bool leap_day = (month == 2) && is_leap(year);
+	if (day > days_in_month[month - 1] + (leap_day ? 1 : 0)) {
+		return -1;
+	}
+	int doy = days_before_month[month - 1] + day - 1;
+	if ((month > 2) && is_leap(year)) {
+		doy++;
+	}
+	return doy;
+}
+
+static uint32_t calc_calendar_crc(struct otw_calendar *c) {
+	return CRC32::calculate((uint8_t *)c, offsetof(struct otw_calendar, crc));
+}
+
+static void build_rank(void) {
+	uint8_t total = 0;
+	for (uint8_t i = 0; i < CAL_BITMAP_WORDS; i++) {
+		_cal_rank[i] = total;
+		total += __builtin_popcount(_otw_calendar.days[i]);
+	}
+}
+
+void calendar_init(void) {
+	EEPROM.get(STORE_CALENDAR_BASE, _otw_calendar);
+	if ((_otw_calendar.magic != CAL_MAGIC) ||
+	    (_otw_calendar.crc != calc_calendar_crc(&_otw_calendar)) ||
+	    (_otw_calendar.count > CAL_MAX_OVERRIDES)) {
+		memset(&_otw_calendar, 0, sizeof(_otw_calendar));
+	}
+	build_rank();
+}
+
+bool calendar_has_year(int year) {
+	return (_otw_calendar.magic == CAL_MAGIC) && (_otw_calendar.year == year);
+}
+
+/** @brief Look up the override for a date.
+ *
+ * @param year: calendar year the date belongs to
+ * @param doy: zero-based day of the year from calendar_day_of_year()
+ *
+ * @return pointer to the override, or NULL if the date follows the profile
+ */
+const struct cal_override *calendar_lookup(int year, int doy) {
+	if (!calendar_has_year(year) || (doy < 0) || (doy >= CAL_BITMAP_WORDS * 32)) {
+		return NULL;
+	}
+	uint32_t word = _otw_calendar.days[doy >> 5];
+	uint32_t bit = (uint32_t)1 << (doy & 31);
+	if (!(word & bit)) {
+		return NULL;
+	}
+	uint8_t idx = _cal_rank[doy >> 5] + __builtin_popcount(word & (bit - 1));
+	return &_otw_calendar.overrides[idx];
+}
+
+// JSON keys
+#define JSON_YEAR "year"
+#define JSON_EXCEPTIONS "exceptions"
+#define JSON_MONTH "month"
+#define JSON_DAY "day"
+#define JSON_PROFILE "profile"
+#define JSON_OFFSET "offset"
+
+/** @brief Compile a calendar document into the bitmap form and store it.
+ *
+ * A profile named by an exception need not be stored yet; the date falls
+ * back to the active profile until it is. An exception whose offset would
+ * move doze before midnight or day past sleep is skipped. Storing a
+ * calendar makes the clock look up today's exception again. EEPROM is only
+ * written when the compiled calendar differs from the stored one.
+ *
+ * @return 0 on success, -1 if the document could not be parsed
+ */
+int ingest_calendar(const char *payload, uint16_t len) {
+	cJSON *cal_json = cJSON_ParseWithLength(payload, len);
+	const cJSON *year = cJSON_GetObjectItemCaseSensitive(cal_json, JSON_YEAR);
+	const cJSON *exceptions = cJSON_GetObjectItemCaseSensitive(cal_json, JSON_EXCEPTIONS);
+	if (!cJSON_IsNumber(year) || !cJSON_IsArray(exceptions)) {
+		Serial.println("Failed to parse calendar");
+		cJSON_Delete(cal_json);
+		return -1;
+	}
+
+	struct otw_calendar cal;
+	uint16_t doys[CAL_MAX_OVERRIDES];
+	memset(&cal, 0, sizeof(cal));
+	cal.magic = CAL_MAGIC;
+	cal.year = year->valueint;
+
+	const cJSON *ex;
+	cJSON_ArrayForEach(ex, exceptions) {
+		const cJSON *month = cJSON_GetObjectItemCaseSensitive(ex, JSON_MONTH);
+		const cJSON *day = cJSON_GetObjectItemCaseSensitive(ex, JSON_DAY);
+		const cJSON *profile = cJSON_GetObjectItemCaseSensitive(ex, JSON_PROFILE);
+		const cJSON *offset = cJSON_GetObjectItemCaseSensitive(ex, JSON_OFFSET);
+		if (!cJSON_IsNumber(month) || !cJSON_IsNumber(day)) {
+			continue;
+		}
+		int doy = calendar_day_of_year(cal.year, month->valueint, day->valueint);
+		if ((doy < 0) || (cal.days[doy >> 5] & ((uint32_t)1 << (doy & 31)))) {
+			continue;
+		}
+		if (cal.count >= CAL_MAX_OVERRIDES) {
+			Serial.println("Too many calendar exceptions, ignoring the rest");
+			break;
+		}
+
+		struct cal_override ov;
+		memset(&ov, 0, sizeof(ov));
+		if (cJSON_IsString(profile)) {
+			if (!store_valid_name(profile->valuestring)) {
+				printf("Calendar names bad profile: %s\n", profile->valuestring);
+				continue;
+			}
+			if (store_find_profile(profile->valuestring) < 0) {
+				printf("Calendar names profile not stored yet: %s\n", profile->valuestring);
+			}
+			strcpy(ov.profile, profile->valuestring);
+		}
+		if (cJSON_IsNumber(offset)) {
+			if (!otw_offset_fits(ov.profile, day_of_week(cal.year, doy), offset->valueint)) {
+				printf("Calendar offset %d does not fit %d/%d, skipping\n", offset->valueint, month->valueint,
+				       day->valueint);
+				continue;
+			}
+			ov.offset = offset->valueint;
+		}
+
+		// Insertion keeps overrides sorted by day to match bitmap rank order
+		uint8_t i = cal.count;
+		while ((i > 0) && (doys[i - 1] > doy)) {
+			doys[i] = doys[i - 1];
+			cal.overrides[i] = cal.overrides[i - 1];
+			i--;
+		}
+		doys[i] = doy;
+		cal.overrides[i] = ov;
+		cal.days[doy >> 5] |= (uint32_t)1 << (doy & 31);
+		cal.count++;
+	}
+	cJSON_Delete(cal_json);
+
+	cal.crc = calc_calendar_crc(&cal);
+	if (cal.crc == _otw_calendar.crc && calendar_has_year(cal.year)) {
+		Serial.println("Received calendar matches stored calendar.");
+		return 0;
+	}
+
+	printf("Saving %u calendar exceptions for %u to EEPROM\n", cal.count, cal.year);
+	_otw_calendar = cal;
+	build_rank();
+	EEPROM.put(STORE_CALENDAR_BASE, _otw_calendar);
+	EEPROM.commit();
+	otw_reselect_date();
+	return 0;
+}
+
+void print_calendar(void) {
+	if (_otw_calendar.magic != CAL_MAGIC) {
+		Serial.println("No exception calendar stored");
+		return;
+	}
+	printf("Exception calendar for %u:\n", _otw_calendar.year);
+	uint8_t idx = 0;
+	for (uint16_t doy = 0; doy < CAL_BITMAP_WORDS * 32; doy++) {
+		if (!(_otw_calendar.days[doy >> 5] & ((uint32_t)1 << (doy & 31)))) {
+			continue;
+		}
+		const struct cal_override *ov = &_otw_calendar.overrides[idx++];
+		printf("  day %u: profile '%s'%s offset %d\n", doy, ov->profile[0] ? ov->profile : "-",
+		       (ov->profile[0] && (store_find_profile(ov->profile) < 0)) ? " (not stored)" : "", ov->offset);
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "wake_schedule.h"
+#include "schedule_store.h"
+
+#define SCHEDULE_PATH_CALENDAR "/download/okay_to_wake_calendar.json"
+
+/*
+ * Per-year exception calendar.
+ *
+ * One bit per day-of-year marks dates that have an override. Overrides are
+ * stored sorted by day, so the index of a date's override is the number of
+ * set bits before it. A per-word prefix count kept in RAM makes the lookup
+ * O(1): one word read, one mask and one popcount.
+ *
+ * Overrides keep the profile by name, not slot, so an exception naming a
+ * profile the server has not sent yet takes effect once it is stored.
+ */
+
+#define CAL_MAGIC 0x4F545744 // "OTWD", profiles by name
+#define CAL_MAX_OVERRIDES 32
+#define CAL_BITMAP_WORDS 12 // 384 bits covers 366 days
+
+struct cal_override {
+	char profile[STORE_NAME_LEN];  // profile name, empty for none
+	int16_t offset;                // minutes added to doze, wake and day times
+};
+
+struct otw_calendar {
+	uint32_t magic;
+	uint16_t year;
+	uint8_t count;
+	uint8_t reserved;
+	uint32_t days[CAL_BITMAP_WORDS];
+	struct cal_override overrides[CAL_MAX_OVERRIDES];
+	uint32_t crc;
+};
+
+int calendar_day_of_year(int year, int month, int day);
+void calendar_init(void);
+bool calendar_has_year(int year);
+const struct cal_override *calendar_lookup(int year, int doy);
+int ingest_calendar(const char *payload, uint16_t len);
+void print_calendar(void);
@@ -0,0 +1,248 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <flash_hal.h>
+#include "wake_schedule.h"
+#include "led_limit.h"
+#include "sync_session.h"
+#include "trace.h"
+#include "config.h"
+
+// The last two sectors of the filesystem area (FS_PHYS_* from the linker script)
+#define CONFIG_FLASH_SIZE (2 * CONFIG_SECTOR_SIZE)
+#define CONFIG_FLASH_BASE (FS_PHYS_ADDR + FS_PHYS_SIZE - CONFIG_FLASH_SIZE)
+#define CONFIG_NAME_MAX 16
+
+enum config_type {
+	CONFIG_TYPE_NUMBER,
+	CONFIG_TYPE_COLOR,      // hex, no prefix
+	CONFIG_TYPE_TEXT
+};
+
+struct config_entry {
+	const char *name;
+	uint8_t type;
+	uint32_t min;
+	uint32_t max;
+	uint32_t number;        // default
+	const char *text;       // default
+	char *value;            // RAM copy of a text value
+};
+
+static char _server[CONFIG_VALUE_MAX + 1];
+static char _ntp_server[CONFIG_VALUE_MAX + 1];
+
+static const struct config_entry _entries[CONFIG_KEYS] = {
+	{ "server", CONFIG_TYPE_TEXT, 0, 0, 0, SCHEDULE_SERVER_HOST, _server },
+	{ "ntp_server", CONFIG_TYPE_TEXT, 0, 0, 0, NTP_SERVER_NAME, _ntp_server },
+	{ "poll_minutes", CONFIG_TYPE_NUMBER, 5, 360, MINUTES_BETWEEN_WIFI_WAKES, NULL, NULL },
+	{ "ota_minutes", CONFIG_TYPE_NUMBER, 1, 60, OTA_WINDOW_MINUTES, NULL, NULL },
+	{ "brightness", CONFIG_TYPE_NUMBER, 0, 255, BRIGHT_LEVEL, NULL, NULL },
+	{ "budget_ma", CONFIG_TYPE_NUMBER, 20, 10000, LED_BUDGET_MA, NULL, NULL },
+	{ "color_doze", CONFIG_TYPE_COLOR, 0, 0xFFFFFF, DOZE_COLOR, NULL, NULL },
+	{ "color_wake", CONFIG_TYPE_COLOR, 0, 0xFFFFFF, WAKE_COLOR, NULL, NULL },
+	{ "color_day", CONFIG_TYPE_COLOR, 0, 0xFFFFFF, DAY_COLOR, NULL, NULL },
+	{ "color_sleep", CONFIG_TYPE_COLOR, 0, 0xFFFFFF, SLEEP_COLOR, NULL, NULL },
+};
+
+static struct config_store _store;
+static bool _store_ok = false;
+static uint32_t _numbers[CONFIG_KEYS];
+
+static int flash_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+	return ESP.flashRead(CONFIG_FLASH_BASE + offset, (uint8_t *)buf, len) ? 0 : -1;
+}
+
+static int flash_write(void *ctx, uint32_t offset, const void *buf, size_t len) {
+	return ESP.flashWrite(CONFIG_FLASH_BASE + offset, (const uint32_t *)buf, len) ? 0 : -1;
+}
+
+static int flash_erase(void *ctx, uint8_t sector) {
+	return ESP.flashEraseSector((CONFIG_FLASH_BASE / CONFIG_SECTOR_SIZE) + sector) ? 0 : -1;
+}
+
+static void load_default(uint8_t key) {
+	const struct config_entry *e = &_entries[key];
+	if (e->type == CONFIG_TYPE_TEXT) {
+		strncpy(e->value, e->text, CONFIG_VALUE_MAX);
+		e->value[CONFIG_VALUE_MAX] = '\0';
+	} else {
+		_numbers[key] = e->number;
+	}
+}
+
+// Stored value, or the default if there is none or it no longer fits the key
+static void load(uint8_t key) {
+	const struct config_entry *e = &_entries[key];
+	load_default(key);
+	if (!_store_ok) {
+		return;
+	}
+	if (e->type == CONFIG_TYPE_TEXT) {
+		int len = config_store_get(&_store, key, e->value, CONFIG_VALUE_MAX);
+		if (len > 0) {
+			e->value[len] = '\0';
+		} else {
+			load_default(key);
+		}
+		return;
+	}
+	uint32_t v;
+	if ((config_store_get(&_store, key, &v, sizeof(v)) == sizeof(v)) && (v >= e->min) && (v <= e->max)) {
+		_numbers[key] = v;
+	}
+}
+
+/** @brief Load the stored tunables.
+ *
+ * Falls back to the defaults in config.h for anything not set, and for
+ * everything if the flash layout has no room for the store.
+ */
+void config_init(void) {
+	static const struct config_flash io = { flash_read, flash_write, flash_erase, NULL };
+	if (FS_PHYS_SIZE < CONFIG_FLASH_SIZE) {
+		Serial.println("No flash set aside for the config store, using defaults");
+	} else if (config_store_init(&_store, &io)) {
+		Serial.println("Config store unreadable, using defaults");
+		trace_event(TRACE_ERROR, TRACE_ERR_CONFIG);
+	} else {
+		_store_ok = true;
+	}
+	for (uint8_t key = 0; key < CONFIG_KEYS; key++) {
+		load(key);
+	}
+}
+
+uint32_t config_number(enum config_key key) {
+	return _numbers[key];
+}
+
+const char *config_text(enum config_key key) {
+	return _entries[key].value ? _entries[key].value : "";
+}
+
+static int find_key(const char *name) {
+	for (uint8_t key = 0; key < CONFIG_KEYS; key++) {
+		if (!strcmp(_entries[key].name, name)) {
+			return key;
+		}
+	}
+	return -1;
+}
+
+/** @brief Set one tunable from its text form.
+ *
+ * @return 1 if the value changed, 0 if it was already set, -1 if the name
+ *         or value is not valid
+ */
+static int set_value(const char *name, const char *text) {
+	int key = find_key(name);
+	if (key < 0) {
+		printf("Unknown config key %s\n", name);
+		return -1;
+	}
+	const struct config_entry *e = &_entries[key];
+	int err = 0;
+
+	if (!*text) {
+		// Back to the default
+		uint32_t before = _numbers[key];
+		bool was_default = (e->type == CONFIG_TYPE_TEXT) ? !strcmp(e->value, e->text) : (before == e->number);
+		if (_store_ok) {
+			err = config_store_erase(&_store, key);
+		}
+		load_default(key);
+		if (was_default) {
+			return 0;
+		}
+	} else if (e->type == CONFIG_TYPE_TEXT) {
+		size_t len = strlen(text);
+		if (len > CONFIG_VALUE_MAX) {
+			printf("Config value for %s is too long\n", name);
+			return -1;
+		}
+		if (!strcmp(e->value, text)) {
+			return 0;
+		}
+		if (_store_ok) {
+			err = config_store_set(&_store, key, text, len);
+		}
+		strcpy(e->value, text);
+	} else {
+		char *end;
+		uint32_t v = strtoul(text, &end, (e->type == CONFIG_TYPE_COLOR) ? 16 : 10);
+		if (*end || (v < e->min) || (v > e->max)) {
+			printf("Bad config value %s=%s\n", name, text);
+			return -1;
+		}
+		if (v == _numbers[key]) {
+			return 0;
+		}
+		if (_store_ok) {
+			err = config_store_set(&_store, key, &v, sizeof(v));
+		}
+		_numbers[key] = v;
+	}
+
+	if (err || !_store_ok) {
+		printf("Config %s=%s applied until the next reset only\n", name, text);
+	} else {
+		printf("Config %s=%s saved\n", name, *text ? text : "(default)");
+	}
+	return 1;
+}
+
+/** @brief Apply settings sent by the server.
+ *
+ * @param settings: space separated name=value pairs (X-OTW-Config)
+ *
+ * @return number of values that changed; invalid pairs are skipped
+ */
+int config_apply(const char *settings) {
+	char item[CONFIG_NAME_MAX + CONFIG_VALUE_MAX + 2];
+	int changed = 0;
+	const char *p = settings;
+
+	while (*(p += strspn(p, " "))) {
+		size_t n = strcspn(p, " ");
+		const char *next = p + n;
+		if (n >= sizeof(item)) {
+			Serial.println("Config setting too long");
+			p = next;
+			continue;
+		}
+		memcpy(item, p, n);
+		item[n] = '\0';
+		p = next;
+
+		char *eq = strchr(item, '=');
+		if (!eq) {
+			printf("Bad config setting %s\n", item);
+			continue;
+		}
+		*eq = '\0';
+		if (set_value(item, eq + 1) > 0) {
+			changed++;
+		}
+	}
+	return changed;
+}
+
+void config_print(void) {
+	for (uint8_t key = 0; key < CONFIG_KEYS; key++) {
+		const struct config_entry *e = &_entries[key];
+		bool is_default = (e->type == CONFIG_TYPE_TEXT) ? !strcmp(e->value, e->text) : (_numbers[key] == e->number);
+		if (e->type == CONFIG_TYPE_TEXT) {
+			printf("  %-13s %s", e->name, e->value);
+		} else if (e->type == CONFIG_TYPE_COLOR) {
+			printf("  %-13s %06x", e->name, _numbers[key]);
+		} else {
+			printf("  %-13s %u", e->name, _numbers[key]);
+		}
+		printf("%s\n", is_default ? " (default)" : "");
+	}
+	if (_store_ok) {
+		printf("  Config log: sector %u, %u of %u bytes used\n", _store.active, _store.end, CONFIG_SECTOR_SIZE);
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include "config_store.h"
+
+/*
+ * Runtime tunables, kept in a config_store (see config_store.h) in the last
+ * two sectors of the flash filesystem area, which this firmware does not
+ * otherwise use. Values are loaded into RAM at boot, so reading one costs
+ * nothing.
+ *
+ * The schedule server changes them with a header on the schedule response:
+ *
+ *   X-OTW-Config: poll_minutes=30 brightness=180 color_sleep=400000
+ *
+ * Only values that differ from the stored ones are written, so the header
+ * can be sent on every response. An empty value (brightness=) goes back to
+ * the default below.
+ */
+
+//Defaults, used until the server sets a value
+//How often to wake WiFi to check for schedule updates, until the server
+//sets its own interval with Cache-Control: max-age (see poll_policy.h)
+#define MINUTES_BETWEEN_WIFI_WAKES 60
+//How many minutes to leave WiFi on for ArduinoOTA when the schedule server flags a firmware update
+#define OTA_WINDOW_MINUTES 10
+//LED Brightness (0-255), the ceiling when ambient brightness (-D OTW_AMBIENT) is enabled
+#define BRIGHT_LEVEL 255
+//Colors as 0xRRGGBB
+#define DOZE_COLOR 0x0000FF
+#define WAKE_COLOR 0x00FF00
+#define DAY_COLOR 0x000000
+#define SLEEP_COLOR 0xFF0000
+
+// Keys are stored by number: only ever add to the end
+enum config_key {
+	CONFIG_SERVER,          // schedule server, "http://host[:port]"
+	CONFIG_NTP_SERVER,
+	CONFIG_POLL_MINUTES,
+	CONFIG_OTA_MINUTES,
+	CONFIG_BRIGHTNESS,
+	CONFIG_LED_BUDGET_MA,
+	CONFIG_COLOR_DOZE,      // color keys follow enum sched_events
+	CONFIG_COLOR_WAKE,
+	CONFIG_COLOR_DAY,
+	CONFIG_COLOR_SLEEP,
+	CONFIG_KEYS
+};
+
+void config_init(void);
+uint32_t config_number(enum config_key key);
+const char *config_text(enum config_key key);
+int config_apply(const char *settings);
+void config_print(void);
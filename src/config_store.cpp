@@ -0,0 +1,219 @@
+#include <string.h>
+#include <CRC32.h>
+#include "config_store.h"
+
+#define SECTOR_HEADER_BYTES 8
+#define RECORD_HEADER_BYTES 4
+#define PADDED(n) (((n) + 3) & ~3)
+#define ERASED_WORD 0xFFFFFFFFUL
+
+// Compaction copies every key, then the record being written is appended
+static_assert(SECTOR_HEADER_BYTES + (CONFIG_STORE_KEYS + 1) * (RECORD_HEADER_BYTES + CONFIG_VALUE_MAX) <= CONFIG_SECTOR_SIZE,
+              "Every key at its largest and one more record must fit in one sector");
+
+static uint16_t record_check(uint8_t key, uint8_t len, const uint8_t *value) {
+	CRC32 crc;
+	crc.update(key);
+	crc.update(len);
+	crc.update(value, len);
+	return crc.finalize() & 0xFFFF;
+}
+
+static uint32_t sector_base(uint8_t sector) {
+	return (uint32_t)sector * CONFIG_SECTOR_SIZE;
+}
+
+// Rebuild the index from the active sector's log
+static int scan(struct config_store *s) {
+	uint32_t words[(RECORD_HEADER_BYTES + CONFIG_VALUE_MAX) / 4];
+	uint8_t *rec = (uint8_t *)words;
+	uint32_t pos = SECTOR_HEADER_BYTES;
+
+	memset(s->offset, 0, sizeof(s->offset));
+	memset(s->len, 0, sizeof(s->len));
+	s->dirty = false;
+	while (pos + RECORD_HEADER_BYTES <= CONFIG_SECTOR_SIZE) {
+		if (s->io.read(s->io.ctx, sector_base(s->active) + pos, words, RECORD_HEADER_BYTES)) {
+			return -1;
+		}
+		if (words[0] == ERASED_WORD) {
+			break;
+		}
+		uint8_t key = rec[0];
+		uint8_t len = rec[1];
+		uint16_t check = rec[2] | (rec[3] << 8);
+		if ((key >= CONFIG_STORE_KEYS) || (len > CONFIG_VALUE_MAX) ||
+		    (pos + RECORD_HEADER_BYTES + PADDED(len) > CONFIG_SECTOR_SIZE)) {
+			s->dirty = true;
+			break;
+		}
+		if (s->io.read(s->io.ctx, sector_base(s->active) + pos + RECORD_HEADER_BYTES, rec + RECORD_HEADER_BYTES,
+		               PADDED(len))) {
+			return -1;
+		}
+		// A record cut short by a reset ends the log
+		if (record_check(key, len, rec + RECORD_HEADER_BYTES) != check) {
+			s->dirty = true;
+			break;
+		}
+		s->offset[key] = len ? pos : 0;
+		s->len[key] = len;
+		pos += RECORD_HEADER_BYTES + PADDED(len);
+	}
+	s->end = pos;
+	return 0;
+}
+
+static int write_header(struct config_store *s, uint8_t sector, uint32_t sequence) {
+	uint32_t header[2] = { CONFIG_STORE_MAGIC, sequence };
+	return s->io.write(s->io.ctx, sector_base(sector), header, sizeof(header));
+}
+
+/** @brief Load the store, formatting it if neither sector is valid.
+ *
+ * @return 0 on success, -1 on a flash error
+ */
+int config_store_init(struct config_store *s, const struct config_flash *io) {
+	uint32_t header[2][2];
+	bool valid[2];
+
+	memset(s, 0, sizeof(*s));
+	s->io = *io;
+	for (uint8_t i = 0; i < 2; i++) {
+		if (s->io.read(s->io.ctx, sector_base(i), header[i], sizeof(header[i]))) {
+			return -1;
+		}
+		valid[i] = (header[i][0] == CONFIG_STORE_MAGIC);
+	}
+
+	if (!valid[0] && !valid[1]) {
+		s->active = 0;
+		s->sequence = 1;
+		s->end = SECTOR_HEADER_BYTES;
+		if (s->io.erase(s->io.ctx, 0) || write_header(s, 0, s->sequence)) {
+			return -1;
+		}
+		return 0;
+	}
+	if (valid[0] && valid[1]) {
+		s->active = ((int32_t)(header[1][1] - header[0][1]) > 0) ? 1 : 0;
+	} else {
+		s->active = valid[0] ? 0 : 1;
+	}
+	s->sequence = header[s->active][1];
+	return scan(s);
+}
+
+// Append one record to a sector and point the index at it
+static int append(struct config_store *s, uint8_t sector, uint16_t *pos, uint8_t key, const void *value,
+                  uint8_t len) {
+	uint32_t words[(RECORD_HEADER_BYTES + CONFIG_VALUE_MAX) / 4];
+	uint8_t *rec = (uint8_t *)words;
+	memset(words, 0xFF, sizeof(words));
+	if (len) {
+		memcpy(rec + RECORD_HEADER_BYTES, value, len);
+	}
+	uint16_t check = record_check(key, len, rec + RECORD_HEADER_BYTES);
+	rec[0] = key;
+	rec[1] = len;
+	rec[2] = check & 0xFF;
+	rec[3] = check >> 8;
+
+	uint16_t n = RECORD_HEADER_BYTES + PADDED(len);
+	if (s->io.write(s->io.ctx, sector_base(sector) + *pos, words, n)) {
+		s->dirty = true;
+		return -1;
+	}
+	s->offset[key] = len ? *pos : 0;
+	s->len[key] = len;
+	*pos += n;
+	return 0;
+}
+
+/** @brief Copy the latest value of every key to the other sector.
+ *
+ * The new sector only becomes active once its header is written, after
+ * every record, so an interrupted compaction leaves the old sector in use.
+ * The value being changed is copied too, so a reset before its new record
+ * is appended still leaves the old one.
+ */
+static int compact(struct config_store *s) {
+	uint8_t value[CONFIG_VALUE_MAX];
+	uint8_t old = s->active;
+	uint8_t next = old ^ 1;
+	uint16_t pos = SECTOR_HEADER_BYTES;
+
+	if (s->io.erase(s->io.ctx, next)) {
+		return -1;
+	}
+	for (uint8_t key = 0; key < CONFIG_STORE_KEYS; key++) {
+		if (!s->offset[key]) {
+			continue;
+		}
+		uint8_t len = s->len[key];
+		if (s->io.read(s->io.ctx, sector_base(old) + s->offset[key] + RECORD_HEADER_BYTES, value, len) ||
+		    append(s, next, &pos, key, value, len)) {
+			// Back to the old sector's index
+			scan(s);
+			return -1;
+		}
+	}
+	if (write_header(s, next, s->sequence + 1)) {
+		scan(s);
+		return -1;
+	}
+	s->active = next;
+	s->sequence++;
+	s->end = pos;
+	s->dirty = false;
+	s->compactions++;
+	return 0;
+}
+
+/** @brief Read a value.
+ *
+ * @return the value's length (at most len bytes are copied), or -1 if the
+ *         key is not set
+ */
+int config_store_get(const struct config_store *s, uint8_t key, void *buf, size_t len) {
+	if ((key >= CONFIG_STORE_KEYS) || !s->offset[key]) {
+		return -1;
+	}
+	size_t n = (s->len[key] < len) ? s->len[key] : len;
+	if (n && s->io.read(s->io.ctx, sector_base(s->active) + s->offset[key] + RECORD_HEADER_BYTES, buf, n)) {
+		return -1;
+	}
+	return s->len[key];
+}
+
+/** @brief Store a value; nothing is written if it is unchanged.
+ *
+ * @param len: 0 deletes the key
+ *
+ * @return 0 on success, -1 on a bad key or length or a flash error
+ */
+int config_store_set(struct config_store *s, uint8_t key, const void *value, size_t len) {
+	if ((key >= CONFIG_STORE_KEYS) || (len > CONFIG_VALUE_MAX)) {
+		return -1;
+	}
+	if (!s->offset[key] && !len) {
+		return 0;
+	}
+	if (s->offset[key] && (s->len[key] == len)) {
+		uint8_t current[CONFIG_VALUE_MAX];
+		if ((config_store_get(s, key, current, len) == (int)len) && !memcmp(current, value, len)) {
+			return 0;
+		}
+	}
+
+	if (s->dirty || (s->end + RECORD_HEADER_BYTES + PADDED(len) > CONFIG_SECTOR_SIZE)) {
+		if (compact(s)) {
+			return -1;
+		}
+	}
+	return append(s, s->active, &s->end, key, value, len);
+}
+
+int config_store_erase(struct config_store *s, uint8_t key) {
+	return config_store_set(s, key, NULL, 0);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Log-structured key-value store in two flash sectors.
+ *
+ * Every write appends a record to the active sector, so a value can change
+ * many times before a sector is erased. When the sector is full the latest
+ * record of each key is copied to the other sector, whose header is written
+ * last: until then the old sector is still the valid one, so losing power
+ * at any point leaves either the old or the new value. A RAM index of the
+ * latest record per key is built at boot, so a read is one flash read.
+ *
+ * Sector:  u32 magic "OTWC", u32 sequence (the higher valid one is active)
+ * Record:  u8 key, u8 len, u16 check (low half of the CRC32 of key, len
+ *          and value), then the value padded to 4 bytes. A record of
+ *          length 0 deletes the key. Erased flash (0xFF) ends the log.
+ *
+ * Writes are whole 4 byte words, as the ESP8266 flash API needs.
+ *
+ * Portable: no Arduino dependencies (utility/host has a CRC32 stand-in).
+ */
+
+#define CONFIG_STORE_MAGIC 0x4357544F // "OTWC"
+#define CONFIG_SECTOR_SIZE 4096
+#define CONFIG_STORE_KEYS 32
+#define CONFIG_VALUE_MAX 64
+
+struct config_flash {
+	// Offsets are from the start of the first of the two sectors
+	int (*read)(void *ctx, uint32_t offset, void *buf, size_t len);
+	int (*write)(void *ctx, uint32_t offset, const void *buf, size_t len);
+	int (*erase)(void *ctx, uint8_t sector);
+	void *ctx;
+};
+
+struct config_store {
+	struct config_flash io;
+	uint32_t sequence;
+	uint16_t offset[CONFIG_STORE_KEYS];  // latest record in the active sector, 0 if unset
+	uint8_t len[CONFIG_STORE_KEYS];
+	uint16_t end;                        // where the next record goes
+	uint8_t active;
+	bool dirty;                          // log ends in a torn record; compact on next write
+	uint16_t compactions;                // since boot
+};
+
+int config_store_init(struct config_store *s, const struct config_flash *io);
+int config_store_get(const struct config_store *s, uint8_t key, void *buf, size_t len);
+int config_store_set(struct config_store *s, uint8_t key, const void *value, size_t len);
+int config_store_erase(struct config_store *s, uint8_t key);
@@ -0,0 +1,85 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include "console.h"
+
+static const struct console_command *_commands = NULL;
+static uint8_t _count = 0;
+static char _line[CONSOLE_LINE_MAX + 1];
+static uint8_t _len = 0;
+static bool _overflow = false;
+
+void console_begin(const struct console_command *commands, uint8_t count) {
+	_commands = commands;
+	_count = count;
+	_len = 0;
+	_overflow = false;
+	printf("Serial console ready, type help\n");
+}
+
+static void print_help(void) {
+	printf("  %-16s %s\n", "help", "list commands");
+	for (uint8_t i = 0; i < _count; i++) {
+		const struct console_command *c = &_commands[i];
+		char name[24];
+		snprintf(name, sizeof(name), "%s %s", c->name, c->usage);
+		printf("  %-16s %s\n", name, c->help);
+	}
+}
+
+static void run_line(char *line) {
+	line += strspn(line, " \t");
+	char *args = line + strcspn(line, " \t");
+	if (*args) {
+		*args++ = '\0';
+		args += strspn(args, " \t");
+	}
+	if (!strcmp(line, "help") || !strcmp(line, "?")) {
+		print_help();
+		return;
+	}
+	for (uint8_t i = 0; i < _count; i++) {
+		if (!strcmp(line, _commands[i].name)) {
+			_commands[i].run(args);
+			return;
+		}
+	}
+	printf("Unknown command %s, type help\n", line);
+}
+
+/** @brief Read the input received so far and run a completed line.
+ *
+ * Only reads bytes the UART already has, so it never waits. At most one
+ * command runs per call; the rest of the input stays buffered for the next.
+ *
+ * @return true if a command ran
+ */
+bool console_poll(void) {
+	if (!_commands) {
+		return false;
+	}
+	while (Serial.available() > 0) {
+		int c = Serial.read();
+		if ((c == '\r') || (c == '\n')) {
+			bool dropped = _overflow;
+			_line[_len] = '\0';
+			_len = 0;
+			_overflow = false;
+			if (dropped) {
+				printf("Line too long, max %u characters\n", CONSOLE_LINE_MAX);
+			} else if (_line[strspn(_line, " \t")]) {
+				run_line(_line);
+				return true;
+			}
+		} else if ((c == '\b') || (c == 0x7F)) {
+			if (_len) {
+				_len--;
+			}
+		} else if (_len < CONSOLE_LINE_MAX) {
+			_line[_len++] = c;
+		} else {
+			_overflow = true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Serial command console for diagnosing a clock on the bench.
+ *
+ * console_poll() takes whatever bytes the UART has already received and
+ * returns at once; a line is only acted on once its CR or LF arrives. The
+ * line is kept in a fixed buffer and split in place, so nothing is
+ * allocated. Lines longer than CONSOLE_LINE_MAX are dropped whole.
+ *
+ * Commands are a table supplied by the caller; "help" lists it.
+ */
+
+#define CONSOLE_LINE_MAX 64
+//How often the main loop's idle wait checks for input; the UART buffers
+//256 bytes, so nothing typed is lost in between
+#define CONSOLE_POLL_MS 100
+
+// args: rest of the line with leading spaces removed, "" if none
+typedef void (*console_handler)(char *args);
+
+struct console_command {
+	const char *name;
+	const char *usage;      // arguments, "" if none
+	const char *help;
+	console_handler run;
+};
+
+void console_begin(const struct console_command *commands, uint8_t count);
+bool console_poll(void);
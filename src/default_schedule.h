@@ -0,0 +1,21 @@
+#pragma once
+
+// Generated by utility/embed_schedule.py from utility/example_sched.json; do not edit
+
+#include "wake_schedule.h"
+
+#define DEFAULT_SCHEDULE_CRC 0xFBC97525UL
+
+// doze, wake, day, sleep as {hour, minute}
+static const struct otw_week default_schedule PROGMEM = {
+	{
+		{{5, 45}, {6, 0}, {6, 15}, {19, 15}}, // monday
+		{{5, 45}, {6, 0}, {6, 15}, {19, 15}}, // tuesday
+		{{5, 45}, {6, 0}, {6, 15}, {19, 0}}, // wednesday
+		{{6, 15}, {6, 30}, {6, 45}, {19, 30}}, // thursday
+		{{6, 0}, {6, 15}, {6, 30}, {19, 30}}, // friday
+		{{5, 45}, {6, 0}, {6, 15}, {18, 0}}, // saturday
+		{{6, 0}, {6, 15}, {6, 30}, {20, 15}}, // sunday
+	},
+	DEFAULT_SCHEDULE_CRC
+};
@@ -0,0 +1,299 @@
+#include <string.h>
+#include "delta_patch.h"
+
+enum delta_state {
+	DP_HEADER,
+	DP_CONTROL,
+	DP_DIFF,
+	DP_ZEROS,
+	DP_EXTRA,
+	DP_DONE,
+	DP_ERROR
+};
+
+enum delta_field {
+	DF_DIFF,
+	DF_EXTRA,
+	DF_SEEK
+};
+
+static uint32_t read_le32(const uint8_t *b) {
+	return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static int fail(struct delta_patch *p, const char *error) {
+	p->error = error;
+	p->state = DP_ERROR;
+	return -1;
+}
+
+void delta_patch_init(struct delta_patch *p, const struct delta_io *io) {
+	memset((void *)p, 0, sizeof(*p));
+	p->io = *io;
+	p->crc.reset();
+	p->state = DP_HEADER;
+}
+
+// Check the running image is the one the patch was made against
+static int check_old(struct delta_patch *p, uint32_t old_crc) {
+	CRC32 crc;
+	for (uint32_t pos = 0; pos < p->old_size; pos += DELTA_WINDOW_BYTES) {
+		uint32_t n = p->old_size - pos;
+		if (n > DELTA_WINDOW_BYTES) {
+			n = DELTA_WINDOW_BYTES;
+		}
+		if (p->io.read_old(p->io.ctx, pos, p->window, n)) {
+			return fail(p, "old image read failed");
+		}
+		crc.update(p->window, n);
+	}
+	if (crc.finalize() != old_crc) {
+		return fail(p, "patch is for a different image");
+	}
+	return 0;
+}
+
+static int start(struct delta_patch *p) {
+	if (memcmp(p->header, DELTA_MAGIC, 4)) {
+		return fail(p, "not a delta patch");
+	}
+	p->old_size = read_le32(p->header + 4);
+	p->new_size = read_le32(p->header + 12);
+	p->new_crc = read_le32(p->header + 16);
+	if (p->new_size == 0) {
+		return fail(p, "empty image");
+	}
+	if (check_old(p, read_le32(p->header + 8))) {
+		return -1;
+	}
+	if (p->io.begin && p->io.begin(p->io.ctx, p->old_size, p->new_size)) {
+		return fail(p, "update refused");
+	}
+	p->state = DP_CONTROL;
+	return 0;
+}
+
+static int run_done(struct delta_patch *p);
+
+// Validate a finished control record and move on to its diff run
+static int control_done(struct delta_patch *p) {
+	uint32_t diff = p->fields[DF_DIFF];
+	uint32_t extra = p->fields[DF_EXTRA];
+	if ((diff > p->old_size - p->old_pos) || (diff > p->new_size - p->written) ||
+	    (extra > p->new_size - p->written - diff)) {
+		return fail(p, "record out of bounds");
+	}
+	p->extra_len = extra;
+	p->state = diff ? DP_DIFF : DP_EXTRA;
+	p->remaining = diff ? diff : extra;
+	// A record may only move the old position
+	return p->remaining ? 0 : run_done(p);
+}
+
+// Once a run ends: the old position seeks, then the next record starts
+static int run_done(struct delta_patch *p) {
+	if ((p->state == DP_DIFF) && p->extra_len) {
+		p->state = DP_EXTRA;
+		p->remaining = p->extra_len;
+		return 0;
+	}
+	int64_t pos = (int64_t)p->old_pos + p->fields[DF_SEEK];
+	if ((pos < 0) || (pos > p->old_size)) {
+		return fail(p, "seek out of bounds");
+	}
+	p->old_pos = pos;
+	p->state = (p->written == p->new_size) ? DP_DONE : DP_CONTROL;
+	p->field = DF_DIFF;
+	p->varint = 0;
+	p->shift = 0;
+	return 0;
+}
+
+// Hand rebuilt bytes to the writer, holding back the end of a bad image
+static int emit(struct delta_patch *p, const uint8_t *buf, size_t len) {
+	p->crc.update(buf, len);
+	if ((p->written + len == p->new_size) && (p->crc.finalize() != p->new_crc)) {
+		return fail(p, "new image CRC mismatch");
+	}
+	if (p->io.write_new(p->io.ctx, buf, len)) {
+		return fail(p, "write failed");
+	}
+	p->written += len;
+	return 0;
+}
+
+// Copy an unchanged stretch of the old image through the window
+static int copy_old(struct delta_patch *p, uint32_t len) {
+	while (len) {
+		uint32_t n = (len > DELTA_WINDOW_BYTES) ? DELTA_WINDOW_BYTES : len;
+		if (p->io.read_old(p->io.ctx, p->old_pos, p->window, n)) {
+			return fail(p, "old image read failed");
+		}
+		if (emit(p, p->window, n)) {
+			return -1;
+		}
+		p->old_pos += n;
+		p->remaining -= n;
+		len -= n;
+	}
+	return 0;
+}
+
+/** @brief Collect one byte of a varint.
+ *
+ * @return 1 once the varint is complete (in p->varint), 0 if more bytes
+ *         follow, -1 if it is too long
+ */
+static int varint_byte(struct delta_patch *p, uint8_t b) {
+	if (p->shift > 28) {
+		fail(p, "bad varint");
+		return -1;
+	}
+	p->varint |= (uint32_t)(b & 0x7F) << p->shift;
+	p->shift += 7;
+	return (b & 0x80) ? 0 : 1;
+}
+
+/** @brief Apply a chunk of patch data.
+ *
+ * @param p: applier state from delta_patch_init()
+ * @param in: patch bytes
+ * @param len: number of patch bytes
+ *
+ * @return 0 on success, -1 on a malformed patch, a mismatched old or new
+ *         image, or an I/O error (reason in p->error)
+ */
+int delta_patch_feed(struct delta_patch *p, const uint8_t *in, size_t len) {
+	const uint8_t *end = in + len;
+
+	while (in < end) {
+		switch (p->state) {
+		case DP_HEADER:
+			p->header[p->written++] = *in++;
+			if (p->written == DELTA_HEADER_BYTES) {
+				p->written = 0;
+				if (start(p)) {
+					return -1;
+				}
+			}
+			break;
+
+		case DP_CONTROL: {
+			int done = varint_byte(p, *in++);
+			if (done < 0) {
+				return -1;
+			}
+			if (!done) {
+				break;
+			}
+			// Seek is zigzag coded so small moves either way stay short
+			p->fields[p->field] = (p->field == DF_SEEK) ? (int32_t)((p->varint >> 1) ^ (0 - (p->varint & 1)))
+			                                            : (int32_t)p->varint;
+			p->varint = 0;
+			p->shift = 0;
+			if (++p->field > DF_SEEK) {
+				if (control_done(p)) {
+					return -1;
+				}
+			}
+			break;
+		}
+
+		case DP_DIFF: {
+			if (*in == 0) {
+				in++;
+				p->state = DP_ZEROS;
+				break;
+			}
+			size_t n = 1;
+			size_t max = end - in;
+			if (max > p->remaining) {
+				max = p->remaining;
+			}
+			if (max > DELTA_WINDOW_BYTES) {
+				max = DELTA_WINDOW_BYTES;
+			}
+			while ((n < max) && in[n]) {
+				n++;
+			}
+			if (p->io.read_old(p->io.ctx, p->old_pos, p->window, n)) {
+				return fail(p, "old image read failed");
+			}
+			for (size_t i = 0; i < n; i++) {
+				p->window[i] += in[i];
+			}
+			if (emit(p, p->window, n)) {
+				return -1;
+			}
+			in += n;
+			p->old_pos += n;
+			p->remaining -= n;
+			if (!p->remaining && run_done(p)) {
+				return -1;
+			}
+			break;
+		}
+
+		case DP_ZEROS: {
+			int done = varint_byte(p, *in++);
+			if (done < 0) {
+				return -1;
+			}
+			if (!done) {
+				break;
+			}
+			uint32_t run = p->varint;
+			p->varint = 0;
+			p->shift = 0;
+			if (run >= p->remaining) {
+				return fail(p, "zero run out of bounds");
+			}
+			p->state = DP_DIFF;
+			if (copy_old(p, run + 1)) {
+				return -1;
+			}
+			if (!p->remaining && run_done(p)) {
+				return -1;
+			}
+			break;
+		}
+
+		case DP_EXTRA: {
+			size_t n = end - in;
+			if (n > p->remaining) {
+				n = p->remaining;
+			}
+			if (emit(p, in, n)) {
+				return -1;
+			}
+			in += n;
+			p->remaining -= n;
+			if (!p->remaining && run_done(p)) {
+				return -1;
+			}
+			break;
+		}
+
+		case DP_DONE:
+			return fail(p, "data after the end of the patch");
+
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** @brief Check the whole patch was applied.
+ *
+ * @return 0 if the new image is complete and matched its CRC
+ */
+int delta_patch_finish(struct delta_patch *p) {
+	if (p->state == DP_DONE) {
+		return 0;
+	}
+	if (p->state != DP_ERROR) {
+		fail(p, "patch truncated");
+	}
+	return -1;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <CRC32.h>
+
+/*
+ * Streaming applier for binary delta patches (bsdiff style).
+ *
+ * The new image is rebuilt from the running one as the patch arrives, and
+ * handed to a writer (the OTA partition on the clock) in order. The only
+ * buffer is a DELTA_WINDOW_BYTES window of the old image; patch bytes can be
+ * fed in chunks of any size, e.g. straight from the heatshrink decoder.
+ *
+ * Patch format, integers little endian:
+ *   "OTWD" u32 old_size u32 old_crc u32 new_size u32 new_crc
+ *   then records until new_size bytes have been produced:
+ *     varint diff_len, varint extra_len, zigzag varint seek
+ *     diff_len bytes added (mod 256) to the old image at the old position
+ *     extra_len bytes copied as they are
+ *   The old position advances by diff_len, then moves by seek. In the diff
+ *   bytes a 0 is followed by a varint n and stands for n + 1 zeros, so
+ *   unchanged code costs a few bytes however long it is.
+ *
+ * The old image is checked against old_crc before anything is written, and
+ * the last byte of the new image is held back unless it matches new_crc, so
+ * a bad patch never leaves a complete image for the writer to commit.
+ *
+ * Portable: no Arduino dependencies (utility/host has a CRC32 stand-in).
+ */
+
+#define DELTA_MAGIC "OTWD"
+#define DELTA_HEADER_BYTES 20
+#define DELTA_WINDOW_BYTES 256
+//URLs ending in this are applied as patches instead of full images
+#define DELTA_PATCH_SUFFIX ".otwd"
+
+struct delta_io {
+	// Called once the header is read; return -1 to refuse the patch
+	int (*begin)(void *ctx, uint32_t old_size, uint32_t new_size);
+	int (*read_old)(void *ctx, uint32_t offset, uint8_t *buf, size_t len);
+	int (*write_new)(void *ctx, const uint8_t *buf, size_t len);
+	void *ctx;
+};
+
+struct delta_patch {
+	struct delta_io io;
+	uint8_t window[DELTA_WINDOW_BYTES];
+	uint8_t header[DELTA_HEADER_BYTES];
+	uint32_t old_size;
+	uint32_t new_size;
+	uint32_t new_crc;
+	uint32_t old_pos;
+	uint32_t written;
+	uint32_t remaining;     // bytes left in the current diff or extra run
+	uint32_t extra_len;
+	uint32_t varint;
+	int32_t fields[3];
+	uint8_t shift;
+	uint8_t field;
+	uint8_t state;
+	CRC32 crc;
+	const char *error;
+};
+
+void delta_patch_init(struct delta_patch *p, const struct delta_io *io);
+int delta_patch_feed(struct delta_patch *p, const uint8_t *in, size_t len);
+int delta_patch_finish(struct delta_patch *p);
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <string.h>
+#include "energy.h"
+
+struct energy_account device_energy;
+
+static const uint32_t radio_ua[ENERGY_RADIO_STATES] = {
+	0, ENERGY_RADIO_LISTEN_UA, ENERGY_RADIO_ACTIVE_UA
+};
+
+static const uint32_t cpu_ua[ENERGY_CPU_STATES] = {
+	ENERGY_CPU_AWAKE_UA, ENERGY_CPU_AWAKE_UA, ENERGY_CPU_SLEEP_UA
+};
+
+void energy_init(struct energy_account *e, uint32_t now_ms) {
+	memset(e, 0, sizeof(*e));
+	e->last_ms = now_ms;
+	e->radio = ENERGY_RADIO_ACTIVE;
+	e->cpu = ENERGY_CPU_ACTIVE;
+}
+
+// Charge the time since the last call to the current states
+void energy_update(struct energy_account *e, uint32_t now_ms) {
+	uint32_t dt = now_ms - e->last_ms;
+	e->last_ms = now_ms;
+	e->window_ms += dt;
+
+	e->charge[ENERGY_CPU] += (uint64_t)cpu_ua[e->cpu] * dt;
+	e->charge[ENERGY_RADIO] += (uint64_t)radio_ua[e->radio] * dt;
+	e->charge[ENERGY_LEDS] += (uint64_t)e->led_ua * dt;
+	e->cpu_ms[e->cpu] += dt;
+	e->radio_ms[e->radio] += dt;
+	if (e->led_lit) {
+		e->led_on_ms += dt;
+	}
+}
+
+void energy_set_radio(struct energy_account *e, uint32_t now_ms, enum energy_radio state) {
+	energy_update(e, now_ms);
+	e->radio = state;
+}
+
+void energy_set_cpu(struct energy_account *e, uint32_t now_ms, enum energy_cpu state) {
+	energy_update(e, now_ms);
+	e->cpu = state;
+}
+
+/** @brief Set the strip current, as estimated by led_render_current_ua().
+ *
+ * @param lit: any pixel is on, rather than only the drivers' idle draw
+ */
+void energy_set_leds(struct energy_account *e, uint32_t now_ms, uint32_t led_ua, bool lit) {
+	energy_update(e, now_ms);
+	e->led_ua = led_ua;
+	e->led_lit = lit;
+}
+
+/** @brief Charge one consumer would use over a day at the window's average.
+ *
+ * @return microamp-hours per day, 0 before any time has been integrated
+ */
+uint32_t energy_uah_per_day(const struct energy_account *e, enum energy_consumer consumer) {
+	if (e->window_ms == 0) {
+		return 0;
+	}
+	// average uA = charge / window; uAh/day = average uA * 24
+	return (e->charge[consumer] * 24) / e->window_ms;
+}
+
+uint32_t energy_total_uah_per_day(const struct energy_account *e) {
+	uint32_t total = 0;
+	for (uint8_t i = 0; i < ENERGY_CONSUMERS; i++) {
+		total += energy_uah_per_day(e, (enum energy_consumer)i);
+	}
+	return total;
+}
+
+// Tenths of a percent of the window
+static uint32_t permille(const struct energy_account *e, uint32_t ms) {
+	return e->window_ms ? (uint32_t)(((uint64_t)ms * 1000) / e->window_ms) : 0;
+}
+
+/** @brief Describe the window as mAh per day and time in each state.
+ *
+ * @return length of the text, as snprintf()
+ */
+size_t energy_format(const struct energy_account *e, char *buf, size_t len) {
+	uint32_t total = energy_total_uah_per_day(e);
+	uint32_t cpu = energy_uah_per_day(e, ENERGY_CPU);
+	uint32_t radio = energy_uah_per_day(e, ENERGY_RADIO);
+	uint32_t leds = energy_uah_per_day(e, ENERGY_LEDS);
+	uint32_t r_active = permille(e, e->radio_ms[ENERGY_RADIO_ACTIVE]);
+	uint32_t r_listen = permille(e, e->radio_ms[ENERGY_RADIO_LISTEN]);
+	uint32_t c_active = permille(e, e->cpu_ms[ENERGY_CPU_ACTIVE]);
+	uint32_t c_sleep = permille(e, e->cpu_ms[ENERGY_CPU_SLEEP]);
+	uint32_t l_on = permille(e, e->led_on_ms);
+
+	return snprintf(buf, len,
+	                "Energy over %lu min: %lu.%lu mAh/day (cpu %lu.%lu, radio %lu.%lu, leds %lu.%lu)\n"
+	                "  radio active %lu.%lu%% listen %lu.%lu%%, cpu active %lu.%lu%% sleep %lu.%lu%%, leds on %lu.%lu%%\n",
+	                (unsigned long)(e->window_ms / 60000),
+	                (unsigned long)(total / 1000), (unsigned long)((total % 1000) / 100),
+	                (unsigned long)(cpu / 1000), (unsigned long)((cpu % 1000) / 100),
+	                (unsigned long)(radio / 1000), (unsigned long)((radio % 1000) / 100),
+	                (unsigned long)(leds / 1000), (unsigned long)((leds % 1000) / 100),
+	                (unsigned long)(r_active / 10), (unsigned long)(r_active % 10),
+	                (unsigned long)(r_listen / 10), (unsigned long)(r_listen % 10),
+	                (unsigned long)(c_active / 10), (unsigned long)(c_active % 10),
+	                (unsigned long)(c_sleep / 10), (unsigned long)(c_sleep % 10),
+	                (unsigned long)(l_on / 10), (unsigned long)(l_on % 10));
+}
+
+// Start a new window, keeping the current states
+void energy_reset_window(struct energy_account *e) {
+	e->window_ms = 0;
+	memset(e->charge, 0, sizeof(e->charge));
+	memset(e->radio_ms, 0, sizeof(e->radio_ms));
+	memset(e->cpu_ms, 0, sizeof(e->cpu_ms));
+	e->led_on_ms = 0;
+}
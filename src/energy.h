@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Energy accounting.
+ *
+ * Integrates the time spent in each radio, CPU and LED state and turns it
+ * into charge using the currents below, so changes to the schedule, the
+ * poll interval or sleep modes can be compared by estimated mAh per day.
+ * The LED current is the strip estimate the budget limiter works from
+ * (led_limit.h), so the report and the limit agree.
+ * The firmware feeds device_energy as states change; utility/energy_sim.cpp
+ * drives the same code with a simulated clock.
+ *
+ * Portable: no Arduino dependencies, so host tools can simulate it.
+ */
+
+// Measured at the supply (see README): LEDs and WiFi off, the clock running its loop
+#define ENERGY_CPU_AWAKE_UA 18000
+// ESP8266 light sleep, from the datasheet (not measured on this board)
+#define ENERGY_CPU_SLEEP_UA 1000
+// Measured: WiFi active (74 mA) less the idle draw above
+#define ENERGY_RADIO_ACTIVE_UA 56000
+// Associated in DTIM modem sleep, averaged over beacons (estimate)
+#define ENERGY_RADIO_LISTEN_UA 3000
+
+#define ENERGY_DAY_MS (24UL * 60 * 60 * 1000)
+
+enum energy_radio {
+	ENERGY_RADIO_OFF,
+	ENERGY_RADIO_LISTEN,
+	ENERGY_RADIO_ACTIVE,
+	ENERGY_RADIO_STATES
+};
+
+enum energy_cpu {
+	ENERGY_CPU_ACTIVE,  // running loop work
+	ENERGY_CPU_IDLE,    // waiting in delay(), same draw as active
+	ENERGY_CPU_SLEEP,   // light sleep
+	ENERGY_CPU_STATES
+};
+
+enum energy_consumer {
+	ENERGY_CPU,
+	ENERGY_RADIO,
+	ENERGY_LEDS,
+	ENERGY_CONSUMERS
+};
+
+struct energy_account {
+	uint32_t last_ms;
+	uint32_t window_ms;                         // time integrated since the last reset
+	uint64_t charge[ENERGY_CONSUMERS];          // uA * ms
+	uint32_t radio_ms[ENERGY_RADIO_STATES];
+	uint32_t cpu_ms[ENERGY_CPU_STATES];
+	uint32_t led_on_ms;
+	uint8_t radio;
+	uint8_t cpu;
+	uint32_t led_ua;
+	bool led_lit;
+};
+
+extern struct energy_account device_energy;
+
+void energy_init(struct energy_account *e, uint32_t now_ms);
+void energy_update(struct energy_account *e, uint32_t now_ms);
+void energy_set_radio(struct energy_account *e, uint32_t now_ms, enum energy_radio state);
+void energy_set_cpu(struct energy_account *e, uint32_t now_ms, enum energy_cpu state);
+void energy_set_leds(struct energy_account *e, uint32_t now_ms, uint32_t led_ua, bool lit);
+uint32_t energy_uah_per_day(const struct energy_account *e, enum energy_consumer consumer);
+uint32_t energy_total_uah_per_day(const struct energy_account *e);
+size_t energy_format(const struct energy_account *e, char *buf, size_t len);
+void energy_reset_window(struct energy_account *e);
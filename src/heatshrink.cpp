@@ -0,0 +1,109 @@
+#include <string.h>
+#include "heatshrink.h"
+
+enum hs_state {
+	HS_TAG,
+	HS_LITERAL,
+	HS_INDEX,
+	HS_COUNT,
+	HS_ERROR
+};
+
+// Decoded bytes are batched before calling the sink
+#define HS_OUT_CHUNK 32
+
+void hs_decoder_init(struct hs_decoder *d) {
+	memset(d, 0, sizeof(*d));
+	d->state = HS_TAG;
+}
+
+/** @brief Decode a chunk of compressed input.
+ *
+ * @param d: decoder state from hs_decoder_init()
+ * @param in: compressed bytes
+ * @param len: number of compressed bytes
+ * @param sink: called with decoded bytes, possibly several times per feed
+ * @param ctx: passed through to the sink
+ *
+ * @return 0 on success, -1 if the stream refers back past its start
+ */
+int hs_decoder_feed(struct hs_decoder *d, const uint8_t *in, size_t len, hs_sink sink, void *ctx) {
+	uint8_t out[HS_OUT_CHUNK];
+	uint8_t out_len = 0;
+	const uint8_t *end = in + len;
+
+	if (d->state == HS_ERROR) {
+		return -1;
+	}
+
+	while (1) {
+		uint8_t need;
+		switch (d->state) {
+			case HS_TAG:
+				need = 1;
+				break;
+			case HS_LITERAL:
+				need = 8;
+				break;
+			case HS_INDEX:
+				need = HS_WINDOW_BITS;
+				break;
+			default:
+				need = HS_LOOKAHEAD_BITS;
+				break;
+		}
+
+		while (d->bit_count < need) {
+			if (in == end) {
+				if (out_len) {
+					sink(ctx, out, out_len);
+				}
+				return 0;
+			}
+			d->bits = (d->bits << 8) | *in++;
+			d->bit_count += 8;
+		}
+		d->bit_count -= need;
+		uint16_t value = (d->bits >> d->bit_count) & ((1 << need) - 1);
+
+		switch (d->state) {
+			case HS_TAG:
+				d->state = value ? HS_LITERAL : HS_INDEX;
+				break;
+
+			case HS_LITERAL:
+				d->window[d->decoded & (HS_WINDOW_SIZE - 1)] = value;
+				d->decoded++;
+				out[out_len++] = value;
+				if (out_len == HS_OUT_CHUNK) {
+					sink(ctx, out, out_len);
+					out_len = 0;
+				}
+				d->state = HS_TAG;
+				break;
+
+			case HS_INDEX:
+				d->index = value + 1;
+				if (d->index > d->decoded) {
+					d->state = HS_ERROR;
+					return -1;
+				}
+				d->state = HS_COUNT;
+				break;
+
+			case HS_COUNT:
+				for (uint16_t i = 0; i <= value; i++) {
+					uint8_t c = d->window[(d->decoded - d->index) & (HS_WINDOW_SIZE - 1)];
+					d->window[d->decoded & (HS_WINDOW_SIZE - 1)] = c;
+					d->decoded++;
+					out[out_len++] = c;
+					if (out_len == HS_OUT_CHUNK) {
+						sink(ctx, out, out_len);
+						out_len = 0;
+					}
+				}
+				d->state = HS_TAG;
+				break;
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Streaming decoder for heatshrink (LZSS) compressed payloads.
+ *
+ * Compatible with `heatshrink -e -w 8 -l 4`. The only buffer is the
+ * 2^HS_WINDOW_BITS byte window; decoded bytes are handed to a sink callback
+ * as soon as they are produced, and input may be fed in chunks of any size.
+ *
+ * Bitstream, most significant bit first:
+ *   1 <8 bits>                         literal byte
+ *   0 <WINDOW bits> <LOOKAHEAD bits>   copy (count - 1) + 1 bytes from
+ *                                      (index + 1) bytes back
+ *
+ * Portable: no Arduino dependencies.
+ */
+
+#define HS_WINDOW_BITS 8
+#define HS_LOOKAHEAD_BITS 4
+#define HS_WINDOW_SIZE (1 << HS_WINDOW_BITS)
+#define HS_CONTENT_ENCODING "heatshrink"
+
+typedef void (*hs_sink)(void *ctx, const uint8_t *buf, size_t len);
+
+struct hs_decoder {
+	uint8_t window[HS_WINDOW_SIZE];
+	uint32_t decoded;   // total bytes produced, bounds back-references
+	uint32_t bits;      // bit accumulator
+	uint8_t bit_count;
+	uint8_t state;
+	uint16_t index;
+};
+
+void hs_decoder_init(struct hs_decoder *d);
+int hs_decoder_feed(struct hs_decoder *d, const uint8_t *in, size_t len, hs_sink sink, void *ctx);
@@ -0,0 +1,279 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <lwip/tcp.h>
+#include "http_fetch.h"
+
+static const char *error_strs[HTTP_FETCH_ERRORS] = {
+	"ok", "connect failed", "connect timed out", "request not sent", "read timed out", "connection reset",
+	"bad response"
+};
+
+/*
+ * lwIP callbacks: record what happened and leave the work to the loop
+ */
+
+// The request and body are a few hundred bytes, well inside an empty send buffer
+static bool send_request(struct http_fetch *f, struct tcp_pcb *pcb) {
+	if (tcp_write(pcb, f->request, f->request_len, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+		return false;
+	}
+	if (f->body_len && (tcp_write(pcb, f->body, f->body_len, TCP_WRITE_FLAG_COPY) != ERR_OK)) {
+		return false;
+	}
+	return tcp_output(pcb) == ERR_OK;
+}
+
+static err_t on_connected(void *arg, struct tcp_pcb *pcb, err_t err) {
+	struct http_fetch *f = (struct http_fetch *)arg;
+	if (!send_request(f, pcb)) {
+		f->send_failed = true;
+	}
+	f->connected = true;
+	f->last_rx_ms = millis();
+	return ERR_OK;
+}
+
+static err_t on_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+	struct http_fetch *f = (struct http_fetch *)arg;
+	if (!p) {
+		f->closed = true;
+		return ERR_OK;
+	}
+	if (f->rx) {
+		pbuf_cat(f->rx, p);
+	} else {
+		f->rx = p;
+	}
+	f->received = true;
+	f->last_rx_ms = millis();
+	return ERR_OK;
+}
+
+// Connection reset or aborted; lwIP has already freed the pcb
+static void on_error(void *arg, err_t err) {
+	struct http_fetch *f = (struct http_fetch *)arg;
+	f->pcb = NULL;
+	f->reset = true;
+}
+
+/*
+ * Loop side
+ */
+
+static void release(struct http_fetch *f) {
+	if (f->pcb) {
+		tcp_arg(f->pcb, NULL);
+		tcp_recv(f->pcb, NULL);
+		tcp_err(f->pcb, NULL);
+		if (tcp_close(f->pcb) != ERR_OK) {
+			tcp_abort(f->pcb);
+		}
+		f->pcb = NULL;
+	}
+	if (f->rx) {
+		pbuf_free(f->rx);
+		f->rx = NULL;
+	}
+}
+
+static bool finish(struct http_fetch *f, uint8_t error) {
+	if ((error != HTTP_FETCH_OK) || !f->keep_alive || f->closed || f->reset) {
+		f->keep_alive = false;
+		release(f);
+	} else if (f->rx) {
+		// Kept for the next request; anything after the response is ignored
+		pbuf_free(f->rx);
+		f->rx = NULL;
+	}
+	f->error = error;
+	f->state = (error == HTTP_FETCH_OK) ? HTTP_FETCH_DONE : HTTP_FETCH_FAILED;
+	return true;
+}
+
+// The parser's callbacks, passed on to the caller's
+static void header_hook(void *ctx, const char *name, const char *value) {
+	struct http_fetch *f = (struct http_fetch *)ctx;
+	if (!strcasecmp(name, "Connection") && !strcasecmp(value, "close")) {
+		f->keep_alive = false;
+	}
+	if (f->on_header) {
+		f->on_header(f->ctx, name, value);
+	}
+}
+
+static int body_hook(void *ctx, const uint8_t *buf, size_t len) {
+	struct http_fetch *f = (struct http_fetch *)ctx;
+	return f->on_body ? f->on_body(f->ctx, buf, len) : 0;
+}
+
+static int open_connection(struct http_fetch *f) {
+	f->connected = false;
+	f->closed = false;
+	f->reset = false;
+	f->send_failed = false;
+	f->received = false;
+	f->started_ms = millis();
+	f->error = HTTP_FETCH_ERR_CONNECT;
+	f->pcb = tcp_new();
+	if (!f->pcb) {
+		return -1;
+	}
+	tcp_arg(f->pcb, f);
+	tcp_recv(f->pcb, on_recv);
+	tcp_err(f->pcb, on_error);
+	ip_addr_t addr;
+	ip_addr_set_ip4_u32(&addr, f->ip);
+	if (tcp_connect(f->pcb, &addr, f->port, on_connected) != ERR_OK) {
+		release(f);
+		return -1;
+	}
+	f->state = HTTP_FETCH_CONNECTING;
+	f->error = HTTP_FETCH_OK;
+	return 0;
+}
+
+/** @brief Start a request; it goes out once the connection is up.
+ *
+ * A connection kept open by the last fetch on f is used if it goes to the
+ * same server; any other is closed.
+ *
+ * @return 0, or -1 if the request does not fit or no connection could be
+ *         started (see http_fetch_error_str())
+ */
+int http_fetch_start(struct http_fetch *f, const struct http_request *req) {
+	struct tcp_pcb *kept = NULL;
+	if (f->pcb && (f->state == HTTP_FETCH_DONE) && f->keep_alive && !f->closed && !f->reset &&
+	    (f->ip == req->ip) && (f->port == req->port)) {
+		kept = f->pcb;
+		f->pcb = NULL;
+	}
+	release(f);
+	memset((void *)f, 0, sizeof(*f));
+	http_response_init(&f->response, req->max_body, header_hook, body_hook, f);
+	f->state = HTTP_FETCH_FAILED;
+	f->error = HTTP_FETCH_ERR_SEND;
+
+	char port[8] = "";
+	char length[28] = "";
+	if (req->port != 80) {
+		snprintf(port, sizeof(port), ":%u", req->port);
+	}
+	if (req->body) {
+		snprintf(length, sizeof(length), "Content-Length: %u\r\n", req->body_len);
+	}
+	int n = snprintf(f->request, sizeof(f->request), "%s %s HTTP/1.1\r\nHost: %s%s\r\nConnection: %s\r\n%s%s\r\n",
+	                 req->method ? req->method : "GET", req->path, req->host, port,
+	                 req->keep_alive ? "keep-alive" : "close", length, req->headers ? req->headers : "");
+	if ((n < 0) || (n >= (int)sizeof(f->request))) {
+		if (kept) {
+			f->pcb = kept;
+			release(f);
+		}
+		return -1;
+	}
+	f->request_len = n;
+	f->body = req->body;
+	f->body_len = req->body ? req->body_len : 0;
+	f->keep_alive = req->keep_alive;
+	f->ip = req->ip;
+	f->port = req->port;
+	f->connect_timeout_ms = req->connect_timeout_ms;
+	f->read_timeout_ms = req->read_timeout_ms;
+	f->on_header = req->on_header;
+	f->on_body = req->on_body;
+	f->ctx = req->ctx;
+
+	if (kept) {
+		f->pcb = kept;
+		f->reused = true;
+		f->connected = true;
+		f->started_ms = millis();
+		f->last_rx_ms = f->started_ms;
+		f->state = HTTP_FETCH_RECEIVING;
+		f->error = HTTP_FETCH_OK;
+		if (!send_request(f, kept)) {
+			f->send_failed = true;
+		}
+		return 0;
+	}
+	return open_connection(f);
+}
+
+/** @brief Parse whatever arrived since the last call and check the timeouts.
+ *
+ * Never waits. Call it until it returns true, yielding in between so
+ * lwIP can run.
+ *
+ * @return true once the fetch is over: state is then HTTP_FETCH_DONE, or
+ *         HTTP_FETCH_FAILED with error set
+ */
+bool http_fetch_poll(struct http_fetch *f) {
+	if ((f->state != HTTP_FETCH_CONNECTING) && (f->state != HTTP_FETCH_RECEIVING)) {
+		return true;
+	}
+	if (f->state == HTTP_FETCH_CONNECTING) {
+		if (f->connected) {
+			f->state = HTTP_FETCH_RECEIVING;
+		} else if (f->reset || f->closed) {
+			return finish(f, HTTP_FETCH_ERR_CONNECT);
+		} else if (millis() - f->started_ms > f->connect_timeout_ms) {
+			return finish(f, HTTP_FETCH_ERR_CONNECT_TIMEOUT);
+		} else {
+			return false;
+		}
+	}
+	// The server dropped the kept connection before answering: send again on a new one
+	if (f->reused && !f->received && (f->closed || f->reset || f->send_failed)) {
+		f->reused = false;
+		release(f);
+		return open_connection(f) ? finish(f, HTTP_FETCH_ERR_CONNECT) : false;
+	}
+	if (f->send_failed) {
+		return finish(f, HTTP_FETCH_ERR_SEND);
+	}
+
+	// No yield in here, so nothing is added to the queue while it is parsed
+	struct pbuf *p = f->rx;
+	if (p) {
+		f->rx = NULL;
+		int err = 0;
+		for (struct pbuf *q = p; q && !err; q = q->next) {
+			err = http_response_feed(&f->response, (const uint8_t *)q->payload, q->len);
+		}
+		if (f->pcb) {
+			tcp_recved(f->pcb, p->tot_len);
+		}
+		pbuf_free(p);
+		if (err) {
+			return finish(f, HTTP_FETCH_ERR_RESPONSE);
+		}
+	}
+	if (http_response_done(&f->response)) {
+		return finish(f, HTTP_FETCH_OK);
+	}
+	if (f->reset) {
+		return finish(f, HTTP_FETCH_ERR_RESET);
+	}
+	if (f->closed) {
+		return finish(f, http_response_finish(&f->response) ? HTTP_FETCH_ERR_RESPONSE : HTTP_FETCH_OK);
+	}
+	if (millis() - f->last_rx_ms > f->read_timeout_ms) {
+		return finish(f, HTTP_FETCH_ERR_READ_TIMEOUT);
+	}
+	return false;
+}
+
+// Close a connection kept open by keep_alive
+void http_fetch_close(struct http_fetch *f) {
+	f->keep_alive = false;
+	release(f);
+}
+
+const char *http_fetch_error_str(const struct http_fetch *f) {
+	if (f->error == HTTP_FETCH_ERR_RESPONSE) {
+		return http_response_error_str(f->response.error);
+	}
+	return (f->error < HTTP_FETCH_ERRORS) ? error_strs[f->error] : "?";
+}
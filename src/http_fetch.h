@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "http_response.h"
+
+/*
+ * Event-driven HTTP/1.1 client on lwIP's raw TCP API.
+ *
+ * http_fetch_start() only sends the SYN. lwIP's callbacks then run
+ * whenever the loop yields: they send the request and queue received
+ * segments, and nothing else. http_fetch_poll(), called from the loop,
+ * feeds the queued data through the response parser (http_response.h), so
+ * the header and body callbacks run in loop context and may do real work.
+ * Segments are only acknowledged to the window once parsed, so a slow
+ * consumer holds the server back instead of filling the heap.
+ *
+ * Between polls the loop is free to render the lights, answer the console
+ * and check in with the stall monitor. A connection that takes longer than
+ * connect_timeout_ms, or goes quiet for read_timeout_ms, is aborted.
+ *
+ * With keep_alive set the connection stays open after the response, and
+ * the next http_fetch_start() on the same struct to the same server sends
+ * its request on it straight away. If the server has meanwhile dropped the
+ * idle connection, the request goes out again on a new one.
+ * http_fetch_close() ends it. Requests may carry a small body (a POST),
+ * sent right after the headers.
+ *
+ * The ESP8266 runs lwIP and the loop on one core and only switches at
+ * yield(), so the callbacks and the loop never touch the queue at the same
+ * time.
+ */
+
+#define HTTP_FETCH_CONNECT_TIMEOUT_MS 5000
+#define HTTP_FETCH_READ_TIMEOUT_MS 5000
+#define HTTP_FETCH_REQUEST_MAX 320
+
+enum http_fetch_state {
+	HTTP_FETCH_IDLE,
+	HTTP_FETCH_CONNECTING,
+	HTTP_FETCH_RECEIVING,
+	HTTP_FETCH_DONE,
+	HTTP_FETCH_FAILED
+};
+
+enum http_fetch_error {
+	HTTP_FETCH_OK,
+	HTTP_FETCH_ERR_CONNECT,         // refused, reset or out of memory
+	HTTP_FETCH_ERR_CONNECT_TIMEOUT,
+	HTTP_FETCH_ERR_SEND,
+	HTTP_FETCH_ERR_READ_TIMEOUT,
+	HTTP_FETCH_ERR_RESET,           // the server reset the connection mid-response
+	HTTP_FETCH_ERR_RESPONSE,        // see response.error
+	HTTP_FETCH_ERRORS
+};
+
+struct http_request {
+	uint32_t ip;                    // IPv4 address, as IPAddress converts to uint32_t
+	uint16_t port;
+	const char *method;             // NULL for GET
+	const char *host;
+	const char *path;
+	const char *headers;            // extra header lines, each ending in \r\n, or NULL
+	const uint8_t *body;            // request body or NULL, valid until the fetch is over
+	uint16_t body_len;
+	bool keep_alive;                // leave the connection open for the next request
+	uint32_t max_body;              // longest response body accepted
+	uint32_t connect_timeout_ms;
+	uint32_t read_timeout_ms;
+	http_header_cb on_header;       // called from http_fetch_poll()
+	http_body_cb on_body;
+	void *ctx;
+};
+
+struct tcp_pcb;
+struct pbuf;
+
+struct http_fetch {
+	struct http_response response;
+	uint8_t state;                  // http_fetch_state
+	uint8_t error;                  // http_fetch_error
+	// Set from lwIP callbacks
+	bool connected;
+	bool closed;                    // by the server
+	bool reset;                     // reset or aborted
+	bool send_failed;
+	bool received;                  // any response bytes on this request
+	struct tcp_pcb *pcb;            // NULL once lwIP has freed it
+	struct pbuf *rx;                // received, not yet parsed
+	uint32_t last_rx_ms;
+	// Set at start
+	bool keep_alive;                // still true after the response if the connection is kept
+	bool reused;                    // the request went out on a kept connection
+	uint32_t ip;
+	uint16_t port;
+	uint32_t started_ms;
+	uint32_t connect_timeout_ms;
+	uint32_t read_timeout_ms;
+	http_header_cb on_header;
+	http_body_cb on_body;
+	void *ctx;
+	const uint8_t *body;
+	uint16_t body_len;
+	uint16_t request_len;
+	char request[HTTP_FETCH_REQUEST_MAX];
+};
+
+int http_fetch_start(struct http_fetch *f, const struct http_request *req);
+bool http_fetch_poll(struct http_fetch *f);
+void http_fetch_close(struct http_fetch *f);
+const char *http_fetch_error_str(const struct http_fetch *f);
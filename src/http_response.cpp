@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "http_response.h"
+
+enum http_state {
+	HR_STATUS,
+	HR_HEADERS,
+	HR_BODY,            // Content-Length bytes
+	HR_UNTIL_CLOSE,     // no length: the body ends with the connection
+	HR_CHUNK_SIZE,
+	HR_CHUNK_DATA,
+	HR_CHUNK_END,       // CRLF after the chunk data
+	HR_TRAILERS,
+	HR_DONE,
+	HR_ERROR
+};
+
+static const char *error_strs[HTTP_ERRORS] = {
+	"ok", "malformed response", "body too large", "aborted", "connection closed early"
+};
+
+static int fail(struct http_response *r, uint8_t error) {
+	r->error = error;
+	r->state = HR_ERROR;
+	return -1;
+}
+
+void http_response_init(struct http_response *r, uint32_t max_body, http_header_cb on_header, http_body_cb on_body,
+                        void *ctx) {
+	memset((void *)r, 0, sizeof(*r));
+	r->state = HR_STATUS;
+	r->max_body = max_body;
+	r->on_header = on_header;
+	r->on_body = on_body;
+	r->ctx = ctx;
+}
+
+static char *trim(char *s) {
+	while ((*s == ' ') || (*s == '\t')) {
+		s++;
+	}
+	char *end = s + strlen(s);
+	while ((end > s) && ((end[-1] == ' ') || (end[-1] == '\t'))) {
+		*--end = '\0';
+	}
+	return s;
+}
+
+// Parse a whole decimal or hex number; -1 for anything else
+static int parse_number(const char *s, int base, uint32_t *value) {
+	char *end;
+	if (!isxdigit((unsigned char)*s)) {
+		return -1;
+	}
+	unsigned long v = strtoul(s, &end, base);
+	if ((*end != '\0') || (v > UINT32_MAX)) {
+		return -1;
+	}
+	*value = v;
+	return 0;
+}
+
+// Transfer-Encoding lists codings in the order applied; chunked must be last
+static bool ends_chunked(const char *value) {
+	size_t n = strlen(value);
+	if (n < 7) {
+		return false;
+	}
+	const char *tail = value + n - 7;
+	for (uint8_t i = 0; i < 7; i++) {
+		if (tolower((unsigned char)tail[i]) != "chunked"[i]) {
+			return false;
+		}
+	}
+	return (n == 7) || (tail[-1] == ' ') || (tail[-1] == ',');
+}
+
+static int status_line(struct http_response *r, char *line) {
+	// HTTP/1.x NNN reason
+	if (strncmp(line, "HTTP/1.", 7) || !isdigit((unsigned char)line[7]) || (line[8] != ' ') ||
+	    !isdigit((unsigned char)line[9]) || !isdigit((unsigned char)line[10]) ||
+	    !isdigit((unsigned char)line[11]) || (line[12] && (line[12] != ' '))) {
+		return fail(r, HTTP_ERR_PROTOCOL);
+	}
+	r->status = atoi(line + 9);
+	r->chunked = false;
+	r->has_length = false;
+	r->state = HR_HEADERS;
+	return 0;
+}
+
+static int header_line(struct http_response *r, char *line) {
+	char *colon = strchr(line, ':');
+	if (!colon) {
+		return fail(r, HTTP_ERR_PROTOCOL);
+	}
+	*colon = '\0';
+	char *name = trim(line);
+	char *value = trim(colon + 1);
+	if (!strcasecmp(name, "Content-Length")) {
+		if (parse_number(value, 10, &r->remaining)) {
+			return fail(r, HTTP_ERR_PROTOCOL);
+		}
+		r->has_length = true;
+	} else if (!strcasecmp(name, "Transfer-Encoding")) {
+		r->chunked = ends_chunked(value);
+	}
+	if (r->on_header) {
+		r->on_header(r->ctx, name, value);
+	}
+	return 0;
+}
+
+// The blank line after the headers: work out how the body is framed
+static int headers_done(struct http_response *r) {
+	if ((r->status >= 100) && (r->status < 200)) {
+		// Interim response, the real one follows
+		r->status = 0;
+		r->state = HR_STATUS;
+		return 0;
+	}
+	r->headers = true;
+	if ((r->status == 204) || (r->status == 304)) {
+		r->state = HR_DONE;
+	} else if (r->chunked) {
+		r->state = HR_CHUNK_SIZE;
+	} else if (r->has_length) {
+		if (r->remaining > r->max_body) {
+			return fail(r, HTTP_ERR_TOO_LARGE);
+		}
+		r->state = r->remaining ? HR_BODY : HR_DONE;
+	} else {
+		r->state = HR_UNTIL_CLOSE;
+	}
+	return 0;
+}
+
+static int chunk_size_line(struct http_response *r, char *line) {
+	line[strcspn(line, ";")] = '\0';
+	uint32_t size;
+	if (parse_number(trim(line), 16, &size)) {
+		return fail(r, HTTP_ERR_PROTOCOL);
+	}
+	if (size > r->max_body - r->body_len) {
+		return fail(r, HTTP_ERR_TOO_LARGE);
+	}
+	r->remaining = size;
+	r->state = size ? HR_CHUNK_DATA : HR_TRAILERS;
+	return 0;
+}
+
+// A complete line (CRLF or LF stripped) in one of the line states
+static int line_done(struct http_response *r) {
+	char *line = r->line;
+	bool overflow = r->line_overflow;
+	line[r->line_len] = '\0';
+	r->line_len = 0;
+	r->line_overflow = false;
+	if (overflow) {
+		// Only a header line may be skipped; the others are short
+		return ((r->state == HR_HEADERS) || (r->state == HR_TRAILERS)) ? 0 : fail(r, HTTP_ERR_PROTOCOL);
+	}
+	switch (r->state) {
+	case HR_STATUS:
+		return status_line(r, line);
+	case HR_HEADERS:
+		return line[0] ? header_line(r, line) : headers_done(r);
+	case HR_CHUNK_SIZE:
+		return chunk_size_line(r, line);
+	case HR_CHUNK_END:
+		if (line[0]) {
+			return fail(r, HTTP_ERR_PROTOCOL);
+		}
+		r->state = HR_CHUNK_SIZE;
+		return 0;
+	case HR_TRAILERS:
+		if (!line[0]) {
+			r->state = HR_DONE;
+		}
+		return 0;
+	}
+	return 0;
+}
+
+static int body(struct http_response *r, const uint8_t *buf, size_t len) {
+	if (len > r->max_body - r->body_len) {
+		return fail(r, HTTP_ERR_TOO_LARGE);
+	}
+	r->body_len += len;
+	if (r->on_body && r->on_body(r->ctx, buf, len)) {
+		return fail(r, HTTP_ERR_ABORTED);
+	}
+	return 0;
+}
+
+/** @brief Parse the next part of the response.
+ *
+ * Bytes after the end of the response are ignored.
+ *
+ * @return 0, or -1 once the response is in error (see error)
+ */
+int http_response_feed(struct http_response *r, const uint8_t *buf, size_t len) {
+	size_t i = 0;
+	while ((i < len) && (r->state != HR_DONE)) {
+		size_t n = len - i;
+		switch (r->state) {
+		case HR_ERROR:
+			return -1;
+		case HR_BODY:
+		case HR_CHUNK_DATA:
+			if (n > r->remaining) {
+				n = r->remaining;
+			}
+			if (body(r, buf + i, n)) {
+				return -1;
+			}
+			i += n;
+			r->remaining -= n;
+			if (!r->remaining) {
+				r->state = (r->state == HR_BODY) ? HR_DONE : HR_CHUNK_END;
+			}
+			break;
+		case HR_UNTIL_CLOSE:
+			if (body(r, buf + i, n)) {
+				return -1;
+			}
+			i += n;
+			break;
+		default: {
+			char c = buf[i++];
+			if (c == '\n') {
+				if (r->line_len && (r->line[r->line_len - 1] == '\r')) {
+					r->line_len--;
+				}
+				if (line_done(r)) {
+					return -1;
+				}
+			} else if (r->line_len < HTTP_LINE_MAX) {
+				r->line[r->line_len++] = c;
+			} else {
+				r->line_overflow = true;
+			}
+			break;
+		}
+		}
+	}
+	return (r->state == HR_ERROR) ? -1 : 0;
+}
+
+/** @brief The connection closed: end a body that runs until close.
+ *
+ * @return 0 if the whole response arrived, -1 otherwise
+ */
+int http_response_finish(struct http_response *r) {
+	if (r->state == HR_UNTIL_CLOSE) {
+		r->state = HR_DONE;
+	}
+	if (r->state == HR_ERROR) {
+		return -1;
+	}
+	return (r->state == HR_DONE) ? 0 : fail(r, HTTP_ERR_TRUNCATED);
+}
+
+bool http_response_done(const struct http_response *r) {
+	return r->state == HR_DONE;
+}
+
+const char *http_response_error_str(uint8_t error) {
+	return (error < HTTP_ERRORS) ? error_strs[error] : "?";
+}
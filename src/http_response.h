@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Incremental HTTP/1.1 response parser.
+ *
+ * Takes the response in chunks of any size as it comes off the socket and
+ * hands each header and the decoded body to callbacks as soon as they are
+ * complete. The body may be sized by Content-Length, sent chunked, or run
+ * until the server closes the connection. Interim 1xx responses are
+ * skipped, and 204 and 304 responses end after their headers.
+ *
+ * Only one header line is buffered; lines longer than HTTP_LINE_MAX are
+ * skipped whole. A body longer than max_body stops the parse.
+ *
+ * Portable: no Arduino dependencies.
+ */
+
+//Longest status or header line kept; X-OTW-Config is the longest expected
+#define HTTP_LINE_MAX 512
+
+enum http_parse_error {
+	HTTP_ERR_NONE,
+	HTTP_ERR_PROTOCOL,      // malformed status line, length or chunk size
+	HTTP_ERR_TOO_LARGE,     // body over max_body
+	HTTP_ERR_ABORTED,       // the body callback refused the data
+	HTTP_ERR_TRUNCATED,     // connection closed before the body was complete
+	HTTP_ERRORS
+};
+
+// name and value are NUL terminated and trimmed, valid during the call only
+typedef void (*http_header_cb)(void *ctx, const char *name, const char *value);
+// Return nonzero to abort the response
+typedef int (*http_body_cb)(void *ctx, const uint8_t *buf, size_t len);
+
+struct http_response {
+	int status;             // 0 until the status line arrives
+	bool headers;           // status and headers are all in
+	uint32_t body_len;      // decoded body bytes so far
+	uint8_t error;          // http_parse_error
+	// Parser state
+	uint8_t state;
+	bool chunked;
+	bool has_length;
+	bool line_overflow;
+	uint16_t line_len;
+	uint32_t remaining;     // bytes left of the body or current chunk
+	uint32_t max_body;
+	http_header_cb on_header;
+	http_body_cb on_body;
+	void *ctx;
+	char line[HTTP_LINE_MAX + 1];
+};
+
+void http_response_init(struct http_response *r, uint32_t max_body, http_header_cb on_header, http_body_cb on_body,
+                        void *ctx);
+int http_response_feed(struct http_response *r, const uint8_t *buf, size_t len);
+int http_response_finish(struct http_response *r);
+bool http_response_done(const struct http_response *r);
+const char *http_response_error_str(uint8_t error);
@@ -0,0 +1,57 @@
+#include "led_limit.h"
+
+// Microamps per level, indexed by channel (R, G, B) and level after brightness
+static uint16_t _channel_ua[3][256];
+
+void led_limit_init(void) {
+	static const uint32_t full_ua[3] = { LED_CHANNEL_R_UA, LED_CHANNEL_G_UA, LED_CHANNEL_B_UA };
+	for (uint8_t ch = 0; ch < 3; ch++) {
+		for (uint16_t v = 0; v < 256; v++) {
+			_channel_ua[ch][v] = (full_ua[ch] * v) / 255;
+		}
+	}
+}
+
+/** @brief Estimate the channel current of a frame.
+ *
+ * @param colors: 0xRRGGBB per pixel, before brightness scaling
+ * @param brightness: scaling the output applies (as Adafruit_NeoPixel)
+ *
+ * @return microamps, not counting LED_PIXEL_IDLE_UA per pixel
+ */
+uint32_t led_limit_frame_ua(const uint32_t *colors, uint16_t count, uint8_t brightness) {
+	uint16_t scale = (uint16_t)brightness + 1;
+	uint32_t ua = 0;
+	for (uint16_t i = 0; i < count; i++) {
+		uint32_t c = colors[i];
+		ua += _channel_ua[0][(((c >> 16) & 0xFF) * scale) >> 8];
+		ua += _channel_ua[1][(((c >> 8) & 0xFF) * scale) >> 8];
+		ua += _channel_ua[2][((c & 0xFF) * scale) >> 8];
+	}
+	return ua;
+}
+
+/** @brief Highest brightness up to `requested` that keeps the strip under budget.
+ *
+ * @return requested when the frame already fits, 0 if even the idle draw does not
+ */
+uint8_t led_limit_brightness(const uint32_t *colors, uint16_t count, uint8_t requested, uint32_t budget_ua) {
+	uint32_t idle = (uint32_t)count * LED_PIXEL_IDLE_UA;
+	if (budget_ua <= idle) {
+		return 0;
+	}
+	uint32_t room = budget_ua - idle;
+	uint32_t ua = led_limit_frame_ua(colors, count, requested);
+	if (ua <= room) {
+		return requested;
+	}
+	// Current is close to linear in brightness: start there and correct for rounding
+	uint8_t b = ((uint64_t)room * requested) / ua;
+	while ((b < requested) && (led_limit_frame_ua(colors, count, b + 1) <= room)) {
+		b++;
+	}
+	while ((b > 0) && (led_limit_frame_ua(colors, count, b) > room)) {
+		b--;
+	}
+	return b;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Strip current estimate and budget limiter.
+ *
+ * Per-channel tables give the current one LED channel draws at each of
+ * its 256 levels, so estimating a frame is three lookups and adds per
+ * pixel, with no division (the ESP8266 has no hardware divider). The
+ * limiter picks the highest brightness not above the requested one whose
+ * frame stays under the budget, so a long strip on a USB supply dims
+ * instead of browning out.
+ *
+ * Portable: no Arduino dependencies.
+ */
+
+//Override with -D LED_BUDGET_MA=N in build_flags (supply rating less the ESP8266's share)
+#ifndef LED_BUDGET_MA
+#define LED_BUDGET_MA 400
+#endif
+
+// Full-scale current of each channel; calibrate per strip. Measured: LEDs on
+// yellow (120 mA) less WiFi active, over 3 pixels x 2 channels at full
+#define LED_CHANNEL_UA 7700
+#ifndef LED_CHANNEL_R_UA
+#define LED_CHANNEL_R_UA LED_CHANNEL_UA
+#endif
+#ifndef LED_CHANNEL_G_UA
+#define LED_CHANNEL_G_UA LED_CHANNEL_UA
+#endif
+#ifndef LED_CHANNEL_B_UA
+#define LED_CHANNEL_B_UA LED_CHANNEL_UA
+#endif
+// WS2812B driver draw with all channels off
+#define LED_PIXEL_IDLE_UA 600
+
+void led_limit_init(void);
+uint32_t led_limit_frame_ua(const uint32_t *colors, uint16_t count, uint8_t brightness);
+uint8_t led_limit_brightness(const uint32_t *colors, uint16_t count, uint8_t requested, uint32_t budget_ua);
@@ -0,0 +1,92 @@
+#include <Arduino.h>
+#include "led_output.h"
+
+#ifdef OTW_LED_UART
+
+#include "ws2812_uart.h"
+
+// UART1 transmit FIFO depth
+#define LED_UART_FIFO 128
+// Time to send one UART byte (8 slots at WS2812_UART_BAUD), in 1/10 us
+#define LED_UART_BYTE_DUS 25
+
+static uint8_t _pixels[LED_COUNT * 3];   // GRB, brightness applied
+static uint8_t _brightness;
+static uint32_t _idle_at_us;             // previous frame sent and latched
+
+void led_output_begin(uint8_t brightness) {
+	_brightness = brightness;
+	Serial1.begin(WS2812_UART_BAUD, SERIAL_6N1, SERIAL_TX_ONLY);
+	// Inverted: idle (and stop bit) low, start bit high
+	USC0(1) |= (1 << UCTXI);
+	_idle_at_us = micros() + WS2812_RESET_US;
+}
+
+// Applies to pixels set afterwards
+void led_output_brightness(uint8_t brightness) {
+	_brightness = brightness;
+}
+
+void led_output_set(uint16_t i, uint32_t color) {
+	if (i >= LED_COUNT) {
+		return;
+	}
+	// Same scaling as Adafruit_NeoPixel::setBrightness()
+	uint16_t scale = (uint16_t)_brightness + 1;
+	_pixels[(i * 3) + 0] = (((color >> 8) & 0xFF) * scale) >> 8;
+	_pixels[(i * 3) + 1] = (((color >> 16) & 0xFF) * scale) >> 8;
+	_pixels[(i * 3) + 2] = ((color & 0xFF) * scale) >> 8;
+}
+
+static uint8_t fifo_used(void) {
+	return (USS(1) >> USTXC) & 0xFF;
+}
+
+/** @brief Queue the frame on UART1.
+ *
+ * Bytes are encoded straight into the FIFO. A strip of up to 10 pixels
+ * fits whole, so this only copies bytes; longer strips wait for room as
+ * the FIFO drains, with interrupts still enabled.
+ */
+void led_output_show(void) {
+	// A new frame must not start until the last one has latched
+	while ((int32_t)(micros() - _idle_at_us) < 0) {
+	}
+
+	uint8_t quad[WS2812_UART_EXPAND];
+	for (size_t i = 0; i < sizeof(_pixels); i++) {
+		ws2812_uart_encode(&_pixels[i], 1, quad);
+		while ((LED_UART_FIFO - fifo_used()) < WS2812_UART_EXPAND) {
+		}
+		for (uint8_t q = 0; q < WS2812_UART_EXPAND; q++) {
+			USF(1) = quad[q];
+		}
+	}
+	_idle_at_us = micros() + ((fifo_used() * LED_UART_BYTE_DUS) / 10) + WS2812_RESET_US;
+}
+
+#else
+
+#include <Adafruit_NeoPixel.h>
+
+static Adafruit_NeoPixel strip(LED_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800);
+
+void led_output_begin(uint8_t brightness) {
+	strip.begin();
+	strip.setBrightness(brightness);
+}
+
+// Applies to pixels set afterwards; the stored ones are rescaled lossily
+void led_output_brightness(uint8_t brightness) {
+	strip.setBrightness(brightness);
+}
+
+void led_output_set(uint16_t i, uint32_t color) {
+	strip.setPixelColor(i, color);
+}
+
+void led_output_show(void) {
+	strip.show();
+}
+
+#endif
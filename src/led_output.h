@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * WS2812 strip output.
+ *
+ * The default backend is Adafruit_NeoPixel on LED_PIN, which bit-bangs the
+ * frame with interrupts disabled (about 30 us per pixel) and can upset
+ * WiFi timing. Building with -D OTW_LED_UART (the `nodemcuv2-uart` env)
+ * instead encodes the frame for UART1 (see ws2812_uart.h) and feeds it to
+ * the hardware FIFO with interrupts left alone. The FIFO holds 10 pixels;
+ * past that show() waits for it to drain at the line rate, 30 us per pixel
+ * (about 9 ms for 300), plus up to WS2812_RESET_US for the last frame to
+ * latch. UART1 can only transmit on GPIO2 (D4), so the strip's data line
+ * has to move there.
+ */
+
+#define LED_PIN 12
+#define LED_UART_PIN 2
+//Override with -D LED_COUNT=N in build_flags for longer strips
+#ifndef LED_COUNT
+#define LED_COUNT 3
+#endif
+
+void led_output_begin(uint8_t brightness);
+void led_output_brightness(uint8_t brightness);
+void led_output_set(uint16_t i, uint32_t color);
+void led_output_show(void);
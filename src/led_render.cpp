@@ -0,0 +1,118 @@
+#include "led_render.h"
+#include "led_limit.h"
+
+#define DIRTY_WORDS ((LED_COUNT + 31) / 32)
+
+static uint32_t _frame[LED_COUNT];
+static uint32_t _dirty[DIRTY_WORDS];
+static bool _any_dirty;
+static uint8_t _requested;               // brightness asked for
+static uint8_t _applied;                 // brightness after the current limit
+static uint32_t _current_ua;
+static uint32_t _budget_ua = (uint32_t)LED_BUDGET_MA * 1000;
+
+void led_render_begin(uint8_t brightness) {
+	_requested = brightness;
+	_applied = brightness;
+	led_limit_init();
+	led_output_begin(brightness);
+}
+
+// Takes effect at the next commit, subject to the current budget
+void led_render_set_brightness(uint8_t brightness) {
+	if (brightness == _requested) {
+		return;
+	}
+	_requested = brightness;
+	_any_dirty = true;
+}
+
+// Replaces LED_BUDGET_MA; takes effect at the next commit
+void led_render_set_budget(uint16_t ma) {
+	if ((uint32_t)ma * 1000 == _budget_ua) {
+		return;
+	}
+	_budget_ua = (uint32_t)ma * 1000;
+	_any_dirty = true;
+}
+
+// Brightness the strip is actually driven at
+uint8_t led_render_brightness(void) {
+	return _applied;
+}
+
+// Estimated strip current of the last commit, including idle draw
+uint32_t led_render_current_ua(void) {
+	return _current_ua;
+}
+
+void led_render_pixel(uint16_t i, uint32_t color) {
+	if ((i >= LED_COUNT) || (_frame[i] == color)) {
+		return;
+	}
+	_frame[i] = color;
+	_dirty[i / 32] |= 1UL << (i % 32);
+	_any_dirty = true;
+}
+
+void led_render_segment(uint16_t first, uint16_t count, uint32_t color) {
+	for (uint16_t i = 0; i < count; i++) {
+		led_render_pixel(first + i, color);
+	}
+}
+
+void led_render_fill(uint32_t color) {
+	led_render_segment(0, LED_COUNT, color);
+}
+
+static void mark_all_dirty(void) {
+	for (uint16_t w = 0; w < DIRTY_WORDS; w++) {
+		_dirty[w] = 0xFFFFFFFFUL;
+	}
+}
+
+/** @brief Send changed pixels to the strip.
+ *
+ * Brightness is limited to what keeps the frame under the budget first.
+ * Brightness is applied by the output when pixels are set, so a change
+ * resends every pixel from its unscaled color.
+ *
+ * @return true if the strip was updated, false if nothing had changed
+ */
+bool led_render_commit(void) {
+	if (!_any_dirty) {
+		return false;
+	}
+	_any_dirty = false;
+
+	uint8_t limit = led_limit_brightness(_frame, LED_COUNT, _requested, _budget_ua);
+	if (limit != _applied) {
+		_applied = limit;
+		led_output_brightness(limit);
+		mark_all_dirty();
+	}
+	_current_ua = led_limit_frame_ua(_frame, LED_COUNT, _applied) + ((uint32_t)LED_COUNT * LED_PIXEL_IDLE_UA);
+
+	bool sent = false;
+	for (uint16_t w = 0; w < DIRTY_WORDS; w++) {
+		uint32_t bits = _dirty[w];
+		_dirty[w] = 0;
+		while (bits) {
+			uint16_t i = (w * 32) + __builtin_ctz(bits);
+			bits &= bits - 1;
+			if (i < LED_COUNT) {
+				led_output_set(i, _frame[i]);
+				sent = true;
+			}
+		}
+	}
+	if (sent) {
+		led_output_show();
+	}
+	return sent;
+}
+
+// Colors currently drawn, LED_COUNT entries
+const uint32_t *led_render_frame(void) {
+	return _frame;
+}
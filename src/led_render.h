@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "led_output.h"
+
+/*
+ * Framebuffer renderer for the LED strip.
+ *
+ * Patterns draw into a frame of LED_COUNT colors (0xRRGGBB, before
+ * brightness). Only pixels whose color actually changes are marked dirty,
+ * and led_render_commit() passes just those to the output and skips show()
+ * when there are none. Redrawing the same state every loop pass therefore
+ * costs a compare per pixel and never touches the strip.
+ *
+ * Every commit also holds the strip under LED_BUDGET_MA (see led_limit.h)
+ * by lowering the brightness for frames that would draw more, or under
+ * the budget set with led_render_set_budget().
+ */
+
+void led_render_begin(uint8_t brightness);
+void led_render_set_brightness(uint8_t brightness);
+void led_render_set_budget(uint16_t ma);
+uint8_t led_render_brightness(void);
+uint32_t led_render_current_ua(void);
+void led_render_pixel(uint16_t i, uint32_t color);
+void led_render_fill(uint32_t color);
+void led_render_segment(uint16_t first, uint16_t count, uint32_t color);
+bool led_render_commit(void);
+const uint32_t *led_render_frame(void);
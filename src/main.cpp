@@ -11,7 +11,8 @@
     * Changes to green LEDs at 6:30am
     * Turns of LEDs at 7:30am
     * Time is set via NTP at power-up
-    * OTA updates are available for 10 minutes after powerup at which point WiFi is shut off for power savings
+    * WiFi is shut off right after each schedule check for power savings; the schedule server can flag a
+      firmware update to open a 10 minute OTA window or have the clock pull the image over HTTP
 
     Programming Settings:
     Board: Adafruit Feather Huzzah ESP8266
@@ -24,13 +25,12 @@
 */
 
 /* Default timer settings are found in wake_schedule.c */
+/* Poll interval, OTA window, brightness and colors can be changed by the server, see config.h */
 
-//How many minutes to leave WiFi on after power-up for purposes of over-the-air-updates
-#define MINUTES_BEFORE_WIFI_SHUTOFF 10
-//How often to wake WiFi to check for schedule updates
-#define MINUTES_BETWEEN_WIFI_WAKES 60
-//LED Brightness (0-255)
-int BRIGHT_LEVEL = 255;
+//Show sleep and doze as a bar that shrinks until wake time (0 for solid colors)
+#define NIGHT_PROGRESS_BAR 1
+//Longest wait between passes of the main loop while anything else needs attention
+#define LOOP_TICK_MS 10000
 
 
 /*
@@ -41,48 +41,56 @@ int BRIGHT_LEVEL = 255;
  */
 
 /* Includes */
-#include <ESP8266WiFiMulti.h>
-#include <WiFiUdp.h>
+#include <ESP8266WiFi.h>
 #include <Timezone.h>
-#include <Adafruit_NeoPixel.h>
 #include <ArduinoOTA.h>
-#include <ESP8266HTTPClient.h>
 #include "credentials.h"
 
 #include "wake_schedule.h"
-
-#define LED_PIN    12
-#define LED_COUNT 3
-
-const uint32_t state_colors[5] = {
-  ((uint32_t)0x00 << 16) | ((uint32_t)0x00 <<  8) | 0xFF, //Doze color
-  ((uint32_t)0x00 << 16) | ((uint32_t)0xFF <<  8) | 0x00, //Wake color
-  ((uint32_t)0x00 << 16) | ((uint32_t)0x00 <<  8) | 0x00, //Daytime color
-  ((uint32_t)0xFF << 16) | ((uint32_t)0x00 <<  8) | 0x00, //Sleep color
-  ((uint32_t)0x52 << 16) | ((uint32_t)0x52 <<  8) | 0x52  //Boot color
-};
+#include "ambient.h"
+#include "calendar.h"
+#include "config.h"
+#include "console.h"
+#include "energy.h"
+#include "led_limit.h"
+#include "led_render.h"
+#include "metrics.h"
+#include "mqtt_link.h"
+#include "poll_policy.h"
+#include "progress_bar.h"
+#include "schedule_store.h"
+#include "stall.h"
+#include "sync_session.h"
+#include "trace.h"
+#include "wifi_link.h"
+
+//Shown from power-up until the first schedule state
+#define BOOT_COLOR 0x525252
 
 /* Prototypes */
 time_t compileTime(void);
+uint32_t state_color(uint8_t state);
+uint8_t strip_brightness(void);
+void apply_config(void);
 void change_lights(uint8_t state);
-unsigned long getUTC(void);
+void show_lights(void);
+uint32_t draw_night_progress(uint8_t state, int day_num, time_t utc, time_t local);
+uint32_t until_offset_change(time_t utc, uint32_t limit_s);
+void idle_wait(uint32_t ms);
+void sync_wait(void);
+bool run_sync_session(uint32_t *wake_target, uint32_t *window_end);
 void printDateTime(time_t t, const char *tz);
 int big_time(int hoursmins[2]);
-void sendNTPpacket(IPAddress& address);
-
-Adafruit_NeoPixel strip(LED_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800);
-
-//UDP stuff for NTP internet time lookup
-//https://www.geekstips.com/arduino-time-sync-ntp-server-esp8266-udp/
-unsigned int localPort = 2390;      // local port to listen for UDP packets
-IPAddress timeServerIP; // time.nist.gov NTP server address
-const char* ntpServerName = "2.north-america.pool.ntp.org";
-const int NTP_PACKET_SIZE = 48; // NTP time stamp is in the first 48 bytes of the message
-byte packetBuffer[ NTP_PACKET_SIZE]; //buffer to hold incoming and outgoing packets
-// A UDP instance to let us send and receive packets over UDP
-WiFiUDP udp;
-// Declare object for multi WiFi access point connection
-ESP8266WiFiMulti wifiMulti;
+void set_timezone_for_ap(void);
+time_t local_now(void);
+
+struct poll_policy schedule_poll;
+// The radio is up for an ArduinoOTA push until the window ends
+bool ota_window = false;
+
+#ifdef OTW_AMBIENT
+struct ambient_filter ambient;
+#endif
 
 //Timezone stuff for central time
 //https://github.com/JChristensen/Timezone/blob/master/examples/Clock/Clock.ino
@@ -96,55 +104,113 @@ TimeChangeRule PACIFIC_STD = {"EST", First, Sun, Nov, 2, -480};     // Standard
 Timezone myTZ(CENTRAL_DST,CENTRAL_STD);
 TimeChangeRule *tcr;        // pointer to the time change rule, use to get TZ abbrev
 
-void setup() {
-  Serial.begin(115200);
-
-  strip.begin();           // INITIALIZE NeoPixel strip object (REQUIRED)
-  for (uint8_t i=0; i<LED_COUNT; i++) strip.setPixelColor(i,state_colors[4]);
-  strip.show();            // Turn OFF all pixels ASAP
-  strip.setBrightness(BRIGHT_LEVEL); // Set BRIGHTNESS to about 1/5 (max = 255)
+/*
+ * Serial console commands (see console.h)
+ */
 
-  // We start by connecting to a WiFi network
+// Set from the console: a state shown instead of the schedule's (-1 for none),
+// and a sync to run on the next loop pass
+int forced_state = -1;
+bool sync_requested = false;
+
+void cmd_sched(char *args) {
+  print_schedule();
+  store_print_index();
+  print_calendar();
+  if (forced_state >= 0) {
+    printf("State forced to %s\n", get_event_str(forced_state));
+  }
+}
 
-  Serial.println();
-  Serial.println();
+void cmd_state(char *args) {
+  if (!strcmp(args, "auto")) {
+    forced_state = -1;
+    trace_event(TRACE_FORCED, E_UNKNOWN);
+    Serial.println("Following the schedule");
+    return;
+  }
+  for (uint8_t s = E_DOZE; s <= E_SLEEP; s++) {
+    if (!strcasecmp(args, get_event_str(s))) {
+      forced_state = s;
+      trace_event(TRACE_FORCED, s);
+      printf("Forcing %s until state auto\n", get_event_str(s));
+      return;
+    }
+  }
+  Serial.println("state doze|wake|day|sleep|auto");
+}
 
-  /* Explicitly set the ESP8266 to be a WiFi-client, otherwise, it by default,
-     would try to act as both a client and an access-point and could cause
-     network-issues with your other WiFi-devices on your WiFi-network. */
-  WiFi.mode(WIFI_STA);
+void cmd_sync(char *args) {
+  sync_requested = true;
+}
 
-  wifiMulti.addAP(STASSID1, STAPSK1);
-  wifiMulti.addAP(STASSID2, STAPSK2);
+void cmd_metrics(char *args) {
+  metrics_print();
+  stall_print();
+}
 
-  bool trying_to_connect = true;
-  Serial.print("\nConnecting to WiFi...");
+void cmd_heap(char *args) {
+  printf("Heap: %u free, largest block %u, fragmentation %u%%\n", ESP.getFreeHeap(), ESP.getMaxFreeBlockSize(),
+         ESP.getHeapFragmentation());
+  printf("Stack: %u bytes never used\n", ESP.getFreeContStack());
+}
 
-  while (trying_to_connect) {
-    if (wifiMulti.run(10000) == WL_CONNECTED) {
-      WiFi.hostname("Okay-to-Wake");
-      trying_to_connect = false;
-    }
-    else {
-      Serial.print(".");
-    }
+void cmd_config(char *args) {
+  if (*args && config_apply(args)) {
+    apply_config();
   }
+  config_print();
+}
 
-  Serial.println("");
-  Serial.println("WiFi connected");
-  Serial.println("IP address: ");
-  Serial.println(WiFi.localIP());
+void cmd_net(char *args) {
+  wifi_link_report();
+  sync_session_report();
+}
 
-  Serial.println("Starting UDP");
-  udp.begin(localPort);
-  Serial.print("Local port: ");
-  Serial.println(udp.localPort());
+void cmd_trace(char *args) {
+  trace_dump();
+}
 
-  otw_init();
+const struct console_command console_commands[] = {
+  { "sched", "", "print the schedule, profiles and calendar", cmd_sched },
+  { "state", "NAME", "force doze, wake, day or sleep; auto to follow the schedule", cmd_state },
+  { "sync", "", "run a sync session now", cmd_sync },
+  { "metrics", "", "print metrics records, loop pass histogram and stalls", cmd_metrics },
+  { "heap", "", "print free heap, fragmentation and stack", cmd_heap },
+  { "config", "[K=V..]", "print settings, or change them as X-OTW-Config does", cmd_config },
+  { "net", "", "print WiFi and the last sync session", cmd_net },
+  { "trace", "", "dump the RTC event trace for utility/otw_trace_decode", cmd_trace },
+};
 
-  // The second AP is in the Eastern time zone (for visiting family)
-  if (WiFi.SSID() == STASSID2) myTZ.setRules(EASTERN_DST,EASTERN_STD);
+void setup() {
+  Serial.begin(115200);
+  // Run from the build time until NTP, so early trace events are near the right day
   setTime(myTZ.toUTC(compileTime()));
+  trace_init();
+  energy_init(&device_energy, millis());
+  config_init();
+
+#ifdef OTW_AMBIENT
+  ambient_init(&ambient);
+  ambient_feed(&ambient, analogRead(A0));
+#endif
+  led_render_begin(strip_brightness());
+  led_render_set_budget(config_number(CONFIG_LED_BUDGET_MA));
+  led_render_fill(BOOT_COLOR);
+  led_render_commit();     // Show the boot color ASAP
+
+  Serial.println();
+  Serial.println();
+  config_print();
+
+  // Schedule and clock come first so the lights work even if WiFi is down
+  otw_init();
+  poll_policy_init(&schedule_poll, ESP.getChipId(), config_number(CONFIG_POLL_MINUTES)*60);
+  metrics_init();
+
+  // Network work happens in sync sessions started from loop()
+  wifi_link_init();
+  sync_session_init(set_timezone_for_ap, local_now, sync_wait);
 
   ArduinoOTA.onStart([]() {
     Serial.println("Start");
@@ -163,29 +229,23 @@ void setup() {
     else if (error == OTA_RECEIVE_ERROR) Serial.println("Receive Failed");
     else if (error == OTA_END_ERROR) Serial.println("End Failed");
   });
-  ArduinoOTA.begin();
+
+#ifdef OTW_USE_MQTT
+  mqtt_link_begin();
+#endif
+  console_begin(console_commands, sizeof(console_commands) / sizeof(console_commands[0]));
+  // From here the loop checks in with the stall monitor
+  stall_init();
 }
 
-void check_for_new_schedule(void) {
-  Serial.println("Checking server for schedule:");
-  WiFiClient client;
-  HTTPClient http;
-  Serial.println(SCHEDULE_SERVER_PATH_JSON);
-  http.begin(client, SCHEDULE_SERVER_PATH_JSON);
-  int httpResponseCode = http.GET();
-  Serial.print("response code:");
-  Serial.println(httpResponseCode);
-  if (httpResponseCode == 200) {
-    String payload = http.getString();
-    Serial.println(payload);
-
-    const char *sched = payload.c_str();
-
-    int err = ingest_schedule(sched, strlen(sched));
-    if (err) {
-      printf("Error processing received schedule\n");
-    }
-  }
+void set_timezone_for_ap(void) {
+  // The second AP is in the Eastern time zone (for visiting family)
+  if (WiFi.SSID() == STASSID2) myTZ.setRules(EASTERN_DST,EASTERN_STD);
+  else myTZ.setRules(CENTRAL_DST,CENTRAL_STD);
+}
+
+time_t local_now(void) {
+  return myTZ.toLocal(now());
 }
 
 /** @brief Return the number corresponding to the day of the week with 0
@@ -208,49 +268,104 @@ void minutes_in_future_to_ticks(uint32_t *future_ticks, int minutes_to_wait) {
   *future_ticks =  millis() + ((uint32_t)(minutes_to_wait)*60*1000);
 }
 
-void loop() {
-  uint8_t state = E_DAY;
-  change_lights(state);
+void seconds_in_future_to_ticks(uint32_t *future_ticks, uint32_t seconds_to_wait) {
+  *future_ticks =  millis() + (seconds_to_wait*1000);
+}
 
-  unsigned long myUTC;
-  while (1) {
-    myUTC = getUTC();
-    if (myUTC == 0) {
-      delay(2000);
-      Serial.println("Retrying...");
-    }
-    else break;
+void schedule_next_poll(uint32_t *future_ticks) {
+  uint32_t seconds = poll_policy_next_seconds(&schedule_poll);
+  printf("Next schedule check in %u seconds\n", seconds);
+  seconds_in_future_to_ticks(future_ticks, seconds);
+}
+
+/** @brief Run a sync session and plan the next radio wake.
+ *
+ * @param wake_target: set to the next schedule check, or to the retry time
+ *        if no access point could be reached
+ * @param window_end: set to the end of the OTA window, if one was opened
+ *
+ * @return true if the server flagged a firmware update and the link was left
+ *         up for an ArduinoOTA window
+ */
+bool run_sync_session(uint32_t *wake_target, uint32_t *window_end) {
+  if (!sync_session_run(&schedule_poll)) {
+    minutes_in_future_to_ticks(wake_target, wifi_link_retry_minutes());
+    return false;
   }
-  setTime(myUTC);
+  apply_config();
+  if (sync_session_update() == SYNC_UPDATE_WINDOW) {
+    uint32_t minutes = config_number(CONFIG_OTA_MINUTES);
+    printf("Opening OTA window for %u minutes\n", minutes);
+    ArduinoOTA.begin();
+    minutes_in_future_to_ticks(window_end, minutes);
+    return true;
+  }
+  schedule_next_poll(wake_target);
+  return false;
+}
 
-  /* Get schedule from home server */
-  check_for_new_schedule();
+// Pick up tunables the server may have changed during the last session
+void apply_config(void) {
+  led_render_set_brightness(strip_brightness());
+  led_render_set_budget(config_number(CONFIG_LED_BUDGET_MA));
+  poll_policy_set_default(&schedule_poll, config_number(CONFIG_POLL_MINUTES)*60);
+}
 
-  uint32_t wifi_shutdown_target = 0;
+// Print the estimated energy use once a day and add it to the telemetry
+void report_energy(void) {
+  energy_update(&device_energy, millis());
+  if (device_energy.window_ms < ENERGY_DAY_MS) {
+    return;
+  }
+  char buf[256];
+  energy_format(&device_energy, buf, sizeof(buf));
+  Serial.print(buf);
+  uint32_t total = energy_total_uah_per_day(&device_energy);
+  uint32_t radio = energy_uah_per_day(&device_energy, ENERGY_RADIO);
+  metrics_record(METRIC_ENERGY, total ? (radio * 100) / total : 0, total / 1000);
+  energy_reset_window(&device_energy);
+}
+
+void loop() {
+  uint8_t state = E_DAY;
+  change_lights(state);
+  show_lights();
+
+  uint32_t ota_window_end = 0;
   uint32_t wifi_wake_target = 0;
-  char wifi_state = true;
+  int traced_doy = -1;
 
-  minutes_in_future_to_ticks(&wifi_shutdown_target, MINUTES_BEFORE_WIFI_SHUTOFF);
+  // Sync once at power-up; the radio only stays on if a firmware update is pending
+  ota_window = run_sync_session(&wifi_wake_target, &ota_window_end);
 
   while(1) {
-    if (wifi_state) {
+    uint32_t pass_start = millis();
+    stall_checkin();
+    if (ota_window) {
+      uint8_t region = stall_enter(STALL_OTA);
       ArduinoOTA.handle();
-      if (millis() > wifi_shutdown_target) {
-        //Shutoff WiFi after X minutes. Leaves a window for OTA update after power cycling
-        Serial.println("\nTurning WiFi off to save energy");
-        WiFi.forceSleepBegin();
-        minutes_in_future_to_ticks(&wifi_wake_target, MINUTES_BETWEEN_WIFI_WAKES);
-        wifi_state = false;
+      stall_leave(region);
+      if (millis() > ota_window_end) {
+        Serial.println("OTA window closed");
+        sync_session_disconnect();
+        schedule_next_poll(&wifi_wake_target);
+        ota_window = false;
       }
-    } else if (millis() > wifi_wake_target) {
+    }
+    // Pushed schedules don't replace the session: time, calendar and telemetry still run on schedule
+    else if (sync_requested || (millis() > wifi_wake_target)) {
+        sync_requested = false;
         Serial.println("\nWaking WiFi to check for schedule changes");
-        WiFi.forceSleepWake();
-        WiFi.waitForConnectResult();
-        check_for_new_schedule();
-        Serial.println("\nTurning WiFi off to save energy");
-        WiFi.forceSleepBegin();
-        minutes_in_future_to_ticks(&wifi_wake_target, MINUTES_BETWEEN_WIFI_WAKES);
+        ota_window = run_sync_session(&wifi_wake_target, &ota_window_end);
+        led_render_fill(state_color(state));    // The server may have changed the colors
     }
+#ifdef OTW_USE_MQTT
+    else if (mqtt_link_listening()) {
+      uint8_t region = stall_enter(STALL_MQTT);
+      mqtt_link_poll();
+      stall_leave(region);
+    }
+#endif
 
     time_t utc = now();
     time_t local = myTZ.toLocal(utc, &tcr);
@@ -265,47 +380,44 @@ void loop() {
 
     // Convert 1-7 (sun-sat) to 0-6 (mon-sun)
     int day_num = convert_weekday_start(local);
-
-    int doze = sched_to_big_time(day_num, E_DOZE);
-    int wake = sched_to_big_time(day_num, E_WAKE);
-    int day = sched_to_big_time(day_num, E_DAY);
-    int sleep = sched_to_big_time(day_num, E_SLEEP);
-
-    //Day = <Sleep and >Day
-    //FIXME: Ths assumes E_SLEEP will start at night and not in the early morning (eg: 00:12 for 12:12am would trip this up)
-    if ((rn >= day) && (rn < sleep)) {
-      if (state != E_DAY) {
-        state = E_DAY;
-        change_lights(state);
-      }
-    }
-    //Doze = <Wake and >=Doze
-    else if ((rn >= doze) && (rn < wake)) {
-      if (state != E_DOZE) {
-        state = E_DOZE;
-        change_lights(state);
-      }
+    int doy = calendar_day_of_year(year(local), month(local), day(local));
+    otw_select_date(year(local), doy, day_num);
+    if (doy != traced_doy) {
+      traced_doy = doy;
+      trace_event(TRACE_DAY, day_num | (calendar_lookup(year(local), doy) ? 0x80 : 0));
     }
 
-    //Wake = <Day and >=Wake
-    else if ((rn >= wake) && (rn < day)) {
-      if (state != E_WAKE) {
-        state = E_WAKE;
-        change_lights(state);
-      }
+    uint8_t next = (forced_state >= 0) ? forced_state : sched_state_at(day_num, rn, (enum sched_events)state);
+    if (next != state) {
+      state = next;
+      change_lights(state);
     }
-    //Sleep = <Doze and >=Sleep
-    else if ((rn >= sleep) || (rn < doze)) {
-      if (state != E_SLEEP) {
-        state = E_SLEEP;
-        change_lights(state);
-      }
+
+    uint32_t wait_ms = LOOP_TICK_MS;
+#if NIGHT_PROGRESS_BAR
+    if ((state == E_SLEEP) || (state == E_DOZE)) {
+      wait_ms = draw_night_progress(state, day_num, utc, local);
     }
+#endif
+    show_lights();
 
     Serial.print("state = ");
     Serial.println(get_event_str(state));
-    // wait ten seconds before asking for the time again
-    delay(10000);
+    metrics_loop_pass(millis() - pass_start);
+    report_energy();
+    // The OTA window and MQTT need regular servicing, and a due schedule check caps the wait
+    bool radio_busy = ota_window;
+#ifdef OTW_USE_MQTT
+    radio_busy = radio_busy || mqtt_link_listening();
+#endif
+    if (radio_busy && (wait_ms > LOOP_TICK_MS)) {
+      wait_ms = LOOP_TICK_MS;
+    }
+    int32_t until_poll = (int32_t)(wifi_wake_target - millis());
+    if (!radio_busy && (until_poll < (int32_t)wait_ms)) {
+      wait_ms = (until_poll > 0) ? until_poll : 0;
+    }
+    idle_wait(wait_ms);
   }
 }
 
@@ -313,95 +425,158 @@ int big_time(int hoursmins[2]) {
   return (hoursmins[0]*60) + hoursmins[1];
 }
 
+// Transition waiting to be recorded with the current of its first frame
+static int pending_transition = -1;
+
 void change_lights(uint8_t state) {
-  for (uint8_t i=0; i<LED_COUNT; i++) strip.setPixelColor(i,state_colors[state]);
-  strip.show();
+  pending_transition = state;
+  trace_event(TRACE_STATE, state);
+  led_render_fill(state_color(state));
 }
 
-unsigned long getUTC(void) {
-  //get a random server from the pool
-  WiFi.hostByName(ntpServerName, timeServerIP); 
+uint32_t state_color(uint8_t state) {
+  if (state > E_SLEEP) {
+    return BOOT_COLOR;
+  }
+  return config_number((enum config_key)(CONFIG_COLOR_DOZE + state));
+}
 
-  sendNTPpacket(timeServerIP); // send an NTP packet to a time server
-  // wait to see if a reply is available
-  delay(1000);
+// Configured brightness, capped by the ambient light when that is enabled
+uint8_t strip_brightness(void) {
+  uint8_t level = config_number(CONFIG_BRIGHTNESS);
+#ifdef OTW_AMBIENT
+  level = min(level, ambient_brightness(&ambient));
+#endif
+  return level;
+}
 
-  int cb = udp.parsePacket();
-  if (!cb) {
-    Serial.println("no packet yet");
-    return 0;
+// Push whatever was drawn this pass to the strip, if anything changed
+void show_lights(void) {
+  static uint8_t last_brightness = 0;
+  if (led_render_commit()) {
+    uint32_t strip_ua = led_render_current_ua();
+    energy_set_leds(&device_energy, millis(), strip_ua, strip_ua > (uint32_t)LED_COUNT * LED_PIXEL_IDLE_UA);
+    if (led_render_brightness() != last_brightness) {
+      last_brightness = led_render_brightness();
+      printf("Strip brightness %u, estimated %u mA\n", last_brightness, led_render_current_ua() / 1000);
+    }
   }
-  else {
-    Serial.print("packet received, length=");
-    Serial.println(cb);
-    // We've received a packet, read the data from it
-    udp.read(packetBuffer, NTP_PACKET_SIZE); // read the packet into the buffer
-
-    //the timestamp starts at byte 40 of the received packet and is four bytes,
-    // or two words, long. First, esxtract the two words:
-
-    unsigned long highWord = word(packetBuffer[40], packetBuffer[41]);
-    unsigned long lowWord = word(packetBuffer[42], packetBuffer[43]);
-    // combine the four bytes (two words) into a long integer
-    // this is NTP time (seconds since Jan 1 1900):
-    unsigned long secsSince1900 = highWord << 16 | lowWord;
-    Serial.print("Seconds since Jan 1 1900 = " );
-    Serial.println(secsSince1900);
-
-    // now convert NTP time into everyday time:
-    Serial.print("Unix time = ");
-    // Unix time starts on Jan 1 1970. In seconds, that's 2208988800:
-    const unsigned long seventyYears = 2208988800UL;
-    // subtract seventy years:
-    unsigned long epoch = secsSince1900 - seventyYears;
-    // print Unix time:
-    Serial.println(epoch);
-
-
-    // print the hour, minute and second:
-    Serial.print("The UTC time is ");       // UTC is the time at Greenwich Meridian (GMT)
-    Serial.print((epoch  % 86400L) / 3600); // print the hour (86400 equals secs per day)
-    Serial.print(':');
-    if ( ((epoch % 3600) / 60) < 10 ) {
-      // In the first 10 minutes of each hour, we'll want a leading '0'
-      Serial.print('0');
+  if (pending_transition >= 0) {
+    metrics_record(METRIC_TRANSITION, pending_transition, led_render_current_ua() / 1000);
+    pending_transition = -1;
+  }
+}
+
+/** @brief Wait between loop passes.
+ *
+ * The wait is cut into CONSOLE_POLL_MS slices so console input is picked
+ * up and the stall monitor sees the loop check in; a command ends the
+ * wait early so the loop acts on it. With ambient
+ * brightness enabled A0 is also sampled every AMBIENT_SAMPLE_MS, and the
+ * strip is only touched when the filtered reading moves to another
+ * brightness step.
+ */
+void idle_wait(uint32_t ms) {
+  uint32_t start = millis();
+  energy_set_cpu(&device_energy, start, ENERGY_CPU_IDLE);
+#ifdef OTW_AMBIENT
+  uint32_t next_sample = start + AMBIENT_SAMPLE_MS;
+#endif
+  uint32_t waited;
+  while ((waited = millis() - start) < ms) {
+    delay(min(ms - waited, (uint32_t)CONSOLE_POLL_MS));
+    stall_checkin();
+    if (console_poll()) {
+      break;
     }
-    Serial.print((epoch  % 3600) / 60); // print the minute (3600 equals secs per minute)
-    Serial.print(':');
-    if ( (epoch % 60) < 10 ) {
-      // In the first 10 seconds of each minute, we'll want a leading '0'
-      Serial.print('0');
+#ifdef OTW_AMBIENT
+    if ((int32_t)(millis() - next_sample) < 0) {
+      continue;
     }
-    Serial.println(epoch % 60); // print the second
-    return epoch;
+    next_sample += AMBIENT_SAMPLE_MS;
+    if (ambient_feed(&ambient, analogRead(A0))) {
+      energy_set_cpu(&device_energy, millis(), ENERGY_CPU_ACTIVE);
+      printf("Ambient light %u, brightness %u\n", ambient_level(&ambient), ambient_brightness(&ambient));
+      led_render_set_brightness(strip_brightness());
+      show_lights();
+      energy_set_cpu(&device_energy, millis(), ENERGY_CPU_IDLE);
+    }
+#endif
   }
+  energy_set_cpu(&device_energy, millis(), ENERGY_CPU_ACTIVE);
 }
 
-// send an NTP request to the time server at the given address
-void sendNTPpacket(IPAddress& address)
-{
-  Serial.println("sending NTP packet...");
-  // set all bytes in the buffer to 0
-  memset(packetBuffer, 0, NTP_PACKET_SIZE);
-  // Initialize values needed to form NTP request
-  // (see URL above for details on the packets)
-  packetBuffer[0] = 0b11100011;   // LI, Version, Mode
-  packetBuffer[1] = 0;     // Stratum, or type of clock
-  packetBuffer[2] = 6;     // Polling Interval
-  packetBuffer[3] = 0xEC;  // Peer Clock Precision
-  // 8 bytes of zero for Root Delay & Root Dispersion
-  packetBuffer[12]  = 49;
-  packetBuffer[13]  = 0x4E;
-  packetBuffer[14]  = 49;
-  packetBuffer[15]  = 52;
-
-  // all NTP fields have been given values, now
-  // you can send a packet requesting a timestamp:
-  udp.beginPacket(address, 123); //NTP requests are to port 123
-  udp.write(packetBuffer, NTP_PACKET_SIZE);
-  udp.endPacket();
+// Runs every few ms while a sync session waits on the schedule or telemetry
+void sync_wait(void) {
+  stall_checkin();
+  show_lights();
+  console_poll();
+  if (ota_window) {
+    uint8_t region = stall_enter(STALL_OTA);
+    ArduinoOTA.handle();
+    stall_leave(region);
+  }
+}
+
+/** @brief Seconds until myTZ's UTC offset next changes, at most limit_s.
+ *
+ * Waits are worked out in local wall-clock time, which jumps at a DST
+ * change; one that spans the change would end up to an hour late. Assumes
+ * at most one change within limit_s.
+ */
+uint32_t until_offset_change(time_t utc, uint32_t limit_s) {
+  time_t offset = myTZ.toLocal(utc) - utc;
+  if (myTZ.toLocal(utc + limit_s) - (utc + limit_s) == offset) {
+    return limit_s;
+  }
+  // The offset is unchanged at lo and changed at hi
+  uint32_t lo = 0;
+  uint32_t hi = limit_s;
+  while (hi - lo > 1) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (myTZ.toLocal(utc + mid) - (utc + mid) == offset) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return hi;
 }
 
+/** @brief Draw the night as a bar that shrinks until wake time.
+ *
+ * A state forced from the console, or one outside the night, has no bar to
+ * show and fills the strip with its color instead.
+ *
+ * @return ms until the display next needs redrawing: the next pixel going
+ *         out, the doze transition, midnight (a new date may bring a
+ *         calendar exception), or a DST change (the local times move);
+ *         LOOP_TICK_MS without a bar
+ */
+uint32_t draw_night_progress(uint8_t state, int day_num, time_t utc, time_t local) {
+  int32_t now_s = ((int32_t)hour(local) * 3600) + (minute(local) * 60) + second(local);
+  int32_t start_s, end_s;
+  sched_night_span(day_num, now_s, &start_s, &end_s);
+  if ((forced_state >= 0) || (now_s < start_s) || (now_s >= end_s)) {
+    led_render_fill(state_color(state));
+    return LOOP_TICK_MS;
+  }
+
+  uint16_t lit = progress_lit(now_s, start_s, end_s, LED_COUNT);
+  led_render_segment(0, lit, state_color(state));
+  led_render_segment(lit, LED_COUNT - lit, 0);
+
+  uint32_t wait_s = 86400 - now_s;
+  uint32_t pixel_s = progress_next_change_s(now_s, start_s, end_s, LED_COUNT);
+  if (pixel_s && (pixel_s < wait_s)) {
+    wait_s = pixel_s;
+  }
+  int32_t doze_s = (int32_t)sched_to_big_time(day_num, E_DOZE) * 60;
+  if ((now_s < doze_s) && ((uint32_t)(doze_s - now_s) < wait_s)) {
+    wait_s = doze_s - now_s;
+  }
+  return until_offset_change(utc, wait_s) * 1000;
+}
 
 // Function to return the compile date and time as a time_t value
 time_t compileTime()
@@ -0,0 +1,149 @@
+#include <Arduino.h>
+#include <string.h>
+#include <CRC32.h>
+#include <TimeLib.h>
+#include "metrics.h"
+
+// RAM mirror of the RTC ring; written back whole after every change
+struct metrics_rtc {
+	uint16_t magic;
+	uint8_t head;     // oldest record
+	uint8_t count;
+	uint32_t crc;
+	struct metric_record records[METRICS_MAX_RECORDS];
+};
+
+static_assert(sizeof(struct metrics_rtc) <= METRICS_RTC_BYTES, "metrics ring does not fit its RTC blocks");
+
+static const char *metric_names[METRIC_TYPES] = {
+	"boot", "transition", "wifi", "ntp", "heap", "session", "energy", "stall"
+};
+
+static struct metrics_rtc _ring;
+static uint8_t _sent = 0;
+static uint16_t _loop_hist[METRICS_LOOP_BUCKETS];
+static uint16_t _loop_max_ms = 0;
+
+static uint32_t ring_crc(void) {
+	uint32_t saved = _ring.crc;
+	_ring.crc = 0;
+	uint32_t crc = CRC32::calculate((uint8_t *)&_ring, sizeof(_ring));
+	_ring.crc = saved;
+	return crc;
+}
+
+static void ring_save(void) {
+	_ring.crc = ring_crc();
+	ESP.rtcUserMemoryWrite(METRICS_RTC_BLOCK, (uint32_t *)&_ring, sizeof(_ring));
+}
+
+/** @brief Restore records kept in RTC memory across a reset.
+ *
+ * After a power cycle RTC memory holds garbage; the magic and CRC catch
+ * that and the ring starts empty. A boot record with the reset reason is
+ * always added.
+ */
+void metrics_init(void) {
+	ESP.rtcUserMemoryRead(METRICS_RTC_BLOCK, (uint32_t *)&_ring, sizeof(_ring));
+	if ((_ring.magic != METRICS_MAGIC) || (_ring.crc != ring_crc()) ||
+	    (_ring.head >= METRICS_MAX_RECORDS) || (_ring.count > METRICS_MAX_RECORDS)) {
+		memset(&_ring, 0, sizeof(_ring));
+		_ring.magic = METRICS_MAGIC;
+	} else {
+		printf("Restored %u metrics records from RTC memory\n", _ring.count);
+	}
+	struct rst_info *reset = ESP.getResetInfoPtr();
+	metrics_record(METRIC_BOOT, reset ? reset->reason : 0, 0);
+}
+
+// When full, the oldest record is overwritten
+void metrics_record(uint8_t type, uint8_t a, uint16_t b) {
+	uint8_t slot = (_ring.head + _ring.count) % METRICS_MAX_RECORDS;
+	if (_ring.count == METRICS_MAX_RECORDS) {
+		_ring.head = (_ring.head + 1) % METRICS_MAX_RECORDS;
+		if (_sent) {
+			_sent--;
+		}
+	} else {
+		_ring.count++;
+	}
+	_ring.records[slot].time = now();
+	_ring.records[slot].type = type;
+	_ring.records[slot].a = a;
+	_ring.records[slot].b = b;
+	ring_save();
+}
+
+// Kept in RAM only; a reset loses at most one session's worth
+void metrics_loop_pass(uint32_t ms) {
+	uint8_t bucket = 0;
+	while ((bucket < METRICS_LOOP_BUCKETS - 1) && (ms >= (1UL << bucket))) {
+		bucket++;
+	}
+	if (_loop_hist[bucket] < UINT16_MAX) {
+		_loop_hist[bucket]++;
+	}
+	if (ms > _loop_max_ms) {
+		_loop_max_ms = (ms < UINT16_MAX) ? ms : UINT16_MAX;
+	}
+}
+
+/** @brief Build the telemetry upload body.
+ *
+ * @param buf: at least TELEMETRY_MAX_BYTES
+ *
+ * @return number of bytes written, 0 if buf is too small
+ */
+size_t metrics_encode(uint8_t *buf, size_t len, uint32_t chip_id, uint32_t schedule_crc) {
+	size_t size = sizeof(struct telemetry_header) + (_ring.count * sizeof(struct metric_record));
+	if (len < size) {
+		return 0;
+	}
+
+	struct telemetry_header h;
+	h.magic = TELEMETRY_MAGIC;
+	h.chip_id = chip_id;
+	h.schedule_crc = schedule_crc;
+	h.uptime_s = millis() / 1000;
+	memcpy(h.loop_hist, _loop_hist, sizeof(h.loop_hist));
+	h.loop_max_ms = _loop_max_ms;
+	h.version = TELEMETRY_VERSION;
+	h.count = _ring.count;
+	memcpy(buf, &h, sizeof(h));
+
+	uint8_t *out = buf + sizeof(h);
+	for (uint8_t i = 0; i < _ring.count; i++) {
+		memcpy(out, &_ring.records[(_ring.head + i) % METRICS_MAX_RECORDS], sizeof(struct metric_record));
+		out += sizeof(struct metric_record);
+	}
+	_sent = _ring.count;
+	return size;
+}
+
+// The server has the records from the last metrics_encode(); drop them
+void metrics_ack(void) {
+	_ring.head = (_ring.head + _sent) % METRICS_MAX_RECORDS;
+	_ring.count -= _sent;
+	_sent = 0;
+	memset(_loop_hist, 0, sizeof(_loop_hist));
+	_loop_max_ms = 0;
+	ring_save();
+}
+
+// Records not yet uploaded and the loop pass histogram, for the console
+void metrics_print(void) {
+	printf("Metrics: %u records, %u sent awaiting ack\n", _ring.count, _sent);
+	for (uint8_t i = 0; i < _ring.count; i++) {
+		const struct metric_record *r = &_ring.records[(_ring.head + i) % METRICS_MAX_RECORDS];
+		printf("  %10u %-10s a=%u b=%u\n", r->time, (r->type < METRIC_TYPES) ? metric_names[r->type] : "?", r->a,
+		       r->b);
+	}
+	printf("Loop passes (ms: count), max %u ms\n", _loop_max_ms);
+	for (uint8_t b = 0; b < METRICS_LOOP_BUCKETS; b++) {
+		if (b < METRICS_LOOP_BUCKETS - 1) {
+			printf("  <%-5lu %u\n", 1UL << b, _loop_hist[b]);
+		} else {
+			printf("  >=%-4lu %u\n", 1UL << (b - 1), _loop_hist[b]);
+		}
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "wake_schedule.h"
+
+/*
+ * On-device metrics ring buffer.
+ *
+ * Small fixed-size records are kept in RTC user memory, so they survive a
+ * watchdog or exception reset (but not a power cycle). The ring is uploaded
+ * in one binary POST during the telemetry stage of a sync session and
+ * cleared once the server accepts it. Nothing here wakes the radio.
+ *
+ * RTC user memory blocks 0..31 are used by the OTA bootloader; metrics use
+ * blocks 32..79 and the event trace (trace.h) blocks 80..127.
+ */
+
+#define METRICS_RTC_BLOCK 32
+#define METRICS_RTC_BYTES 192
+#define METRICS_MAGIC 0x4F4D // "OM"
+#define METRICS_MAX_RECORDS ((METRICS_RTC_BYTES - 8) / sizeof(struct metric_record))
+
+// Loop pass durations: bucket n counts passes under 2^n ms, the last bucket the rest
+#define METRICS_LOOP_BUCKETS 12
+// Session radio-on time is recorded in these units
+#define METRICS_SESSION_UNIT_MS 100
+
+#define TELEMETRY_PATH "/telemetry"
+#define TELEMETRY_MAGIC 0x5457544F // "OTWT"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAX_BYTES (sizeof(struct telemetry_header) + (METRICS_MAX_RECORDS * sizeof(struct metric_record)))
+
+enum metric_type {
+	METRIC_BOOT,        // a: reset reason
+	METRIC_TRANSITION,  // a: new light state (sched_events), b: estimated strip mA
+	METRIC_WIFI,        // a: -RSSI dBm (0 if association failed), b: connect ms
+	METRIC_NTP,         // a: requests sent, b: clock correction in seconds (int16)
+	METRIC_HEAP,        // a: fragmentation %, b: free heap bytes
+	METRIC_SESSION,     // a: failed stage mask, b: radio-on time in METRICS_SESSION_UNIT_MS
+	METRIC_ENERGY,      // a: radio share %, b: estimated mAh per day
+	METRIC_STALL,       // a: stall_region | stalls << 4 (see stall.h), b: longest stall ms
+	METRIC_TYPES
+};
+
+struct metric_record {
+	uint32_t time;      // UTC seconds
+	uint8_t type;
+	uint8_t a;
+	uint16_t b;
+};
+
+// Upload body: this header followed by `count` records, little-endian
+struct telemetry_header {
+	uint32_t magic;
+	uint32_t chip_id;
+	uint32_t schedule_crc;
+	uint32_t uptime_s;
+	uint16_t loop_hist[METRICS_LOOP_BUCKETS];
+	uint16_t loop_max_ms;
+	uint8_t version;
+	uint8_t count;
+};
+
+void metrics_init(void);
+void metrics_record(uint8_t type, uint8_t a, uint16_t b);
+void metrics_loop_pass(uint32_t ms);
+size_t metrics_encode(uint8_t *buf, size_t len, uint32_t chip_id, uint32_t schedule_crc);
+void metrics_ack(void);
+void metrics_print(void);
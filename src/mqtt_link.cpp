@@ -0,0 +1,130 @@
+#ifdef OTW_USE_MQTT
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <ESP8266WiFi.h>
+#include <PubSubClient.h>
+#include "wake_schedule.h"
+#include "calendar.h"
+#include "energy.h"
+#include "wifi_link.h"
+#include "mqtt_link.h"
+
+WiFiClient mqtt_client;
+PubSubClient mqtt(mqtt_client);
+
+static char _client_id[24];
+static char _topic_schedule[40];
+static char _topic_calendar[40];
+static bool _listening = false;
+static uint32_t _last_attempt_ms = 0;
+static uint32_t _offline_since_ms = 0;
+
+static void on_message(char *topic, uint8_t *payload, unsigned int length) {
+	printf("MQTT message on %s (%u bytes)\n", topic, length);
+	int err;
+	if (strcmp(topic, _topic_calendar) == 0) {
+		err = ingest_calendar((const char *)payload, length);
+	} else {
+		err = ingest_schedule((const char *)payload, length);
+	}
+	if (err) {
+		printf("Error processing MQTT message\n");
+	}
+}
+
+void mqtt_link_begin(void) {
+	uint32_t chip_id = ESP.getChipId();
+	snprintf(_client_id, sizeof(_client_id), "okay-to-wake-%06x", chip_id);
+	snprintf(_topic_schedule, sizeof(_topic_schedule), MQTT_TOPIC_SCHEDULE, chip_id);
+	snprintf(_topic_calendar, sizeof(_topic_calendar), MQTT_TOPIC_CALENDAR, chip_id);
+
+	mqtt.setServer(MQTT_BROKER_HOST, MQTT_BROKER_PORT);
+	mqtt.setCallback(on_message);
+	mqtt.setBufferSize(MQTT_MAX_PAYLOAD);
+	mqtt.setKeepAlive(MQTT_KEEPALIVE_S);
+}
+
+static bool mqtt_connect(void) {
+	_last_attempt_ms = millis();
+	// Clean session off: the broker queues QoS 1 messages while we are away
+	if (!mqtt.connect(_client_id, NULL, NULL, NULL, 0, false, NULL, false)) {
+		printf("MQTT connect failed, state %d\n", mqtt.state());
+		return false;
+	}
+	mqtt.subscribe(_topic_schedule, 1);
+	mqtt.subscribe(_topic_calendar, 1);
+	printf("MQTT connected, listening on %s\n", _topic_schedule);
+	return true;
+}
+
+/** @brief Connect to the broker and keep the radio in modem sleep.
+ *
+ * The WiFi link must already be up.
+ *
+ * @return true if listening, false if the broker could not be reached
+ */
+bool mqtt_link_listen(void) {
+	if (!mqtt.connected() && !mqtt_connect()) {
+		_listening = false;
+		return false;
+	}
+	WiFi.setSleepMode(WIFI_MODEM_SLEEP, MQTT_LISTEN_INTERVAL);
+	energy_set_radio(&device_energy, millis(), ENERGY_RADIO_LISTEN);
+	_listening = true;
+	_offline_since_ms = 0;
+	return true;
+}
+
+bool mqtt_link_listening(void) {
+	return _listening;
+}
+
+/** @brief Leave modem sleep for a sync session on the listening link.
+ *
+ * The broker session stays connected; mqtt_link_listen() at the end of the
+ * sync session puts the radio back into modem sleep.
+ */
+void mqtt_link_pause(void) {
+	if (!_listening) {
+		return;
+	}
+	WiFi.setSleepMode(WIFI_NONE_SLEEP);
+	energy_set_radio(&device_energy, millis(), ENERGY_RADIO_ACTIVE);
+	_listening = false;
+}
+
+/** @brief Service the MQTT session; call on every pass through the loop.
+ *
+ * Reconnects to the broker while WiFi is up. If the session cannot be
+ * restored within MQTT_GIVE_UP_MS the radio is put to sleep and the clock
+ * falls back to polling through wifi_link.
+ */
+void mqtt_link_poll(void) {
+	if (!_listening) {
+		return;
+	}
+	if (mqtt.loop()) {
+		_offline_since_ms = 0;
+		return;
+	}
+
+	if (_offline_since_ms == 0) {
+		_offline_since_ms = millis();
+	}
+	if ((WiFi.status() == WL_CONNECTED) && (millis() - _last_attempt_ms > MQTT_RECONNECT_MS)) {
+		if (mqtt_connect()) {
+			_offline_since_ms = 0;
+			return;
+		}
+	}
+	if (millis() - _offline_since_ms > MQTT_GIVE_UP_MS) {
+		Serial.println("MQTT unavailable, falling back to polling");
+		mqtt.disconnect();
+		wifi_link_down();
+		wifi_link_report();
+		_listening = false;
+	}
+}
+
+#endif /* OTW_USE_MQTT */
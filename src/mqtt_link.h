@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Optional MQTT push updates, enabled with -D OTW_USE_MQTT (see the
+ * nodemcuv2-mqtt env in platformio.ini).
+ *
+ * The clock keeps a persistent session (clean session off, QoS 1
+ * subscriptions) and the server publishes retained schedule and calendar
+ * documents, so edits land within one loop pass instead of the next hourly
+ * poll. Between messages the radio stays associated in DTIM-aligned modem
+ * sleep. The regular sync session still runs every poll interval on the
+ * same link, for NTP, the calendar and telemetry.
+ *
+ * utility/mqtt_broker.cpp is a local broker to test against.
+ */
+
+#define MQTT_BROKER_HOST "192.168.1.105"
+#define MQTT_BROKER_PORT 1883
+//Topics are formatted with the chip ID so each clock can get its own schedule
+#define MQTT_TOPIC_SCHEDULE "okay-to-wake/%06x/schedule"
+#define MQTT_TOPIC_CALENDAR "okay-to-wake/%06x/calendar"
+//Largest retained document accepted (PubSubClient buffer size)
+#define MQTT_MAX_PAYLOAD 3072
+#define MQTT_KEEPALIVE_S 120
+//Wake for every Nth DTIM beacon while in modem sleep
+#define MQTT_LISTEN_INTERVAL 3
+//Retry the broker this often while the WiFi link is still up
+#define MQTT_RECONNECT_MS 30000
+//Give up listening and fall back to hourly polling after this long offline
+#define MQTT_GIVE_UP_MS 300000
+
+void mqtt_link_begin(void);
+bool mqtt_link_listen(void);
+bool mqtt_link_listening(void);
+void mqtt_link_pause(void);
+void mqtt_link_poll(void);
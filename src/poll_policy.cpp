@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+#include "poll_policy.h"
+
+static uint32_t clamp_interval(uint32_t s) {
+	if (s < POLL_MIN_S) {
+		return POLL_MIN_S;
+	}
+	if (s > POLL_MAX_S) {
+		return POLL_MAX_S;
+	}
+	return s;
+}
+
+static uint32_t next_random(struct poll_policy *p) {
+	uint32_t x = p->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	p->rng = x;
+	return x;
+}
+
+void poll_policy_init(struct poll_policy *p, uint32_t chip_id, uint32_t default_s) {
+	p->default_s = clamp_interval(default_s);
+	p->base_s = p->default_s;
+	p->server_set = false;
+	p->retry_s = 0;
+	p->unchanged = 0;
+	// Spread the chip ID bits before using it as a seed; xorshift needs non-zero
+	p->rng = (chip_id * 2654435761UL) | 1;
+}
+
+/** @brief Change the interval used while the server sends no max-age.
+ *
+ * An interval already set by the server is kept until its next response.
+ */
+void poll_policy_set_default(struct poll_policy *p, uint32_t default_s) {
+	p->default_s = clamp_interval(default_s);
+	if (!p->server_set) {
+		p->base_s = p->default_s;
+	}
+}
+
+/** @brief Read interval hints from the schedule server's response headers.
+ *
+ * @param cache_control: value of the Cache-Control header, may be NULL
+ * @param retry_after: value of the Retry-After header in seconds, may be NULL
+ */
+void poll_policy_server_hint(struct poll_policy *p, const char *cache_control, const char *retry_after) {
+	const char *max_age = cache_control ? strstr(cache_control, "max-age=") : NULL;
+	p->server_set = (max_age != NULL);
+	if (max_age) {
+		p->base_s = clamp_interval(strtoul(max_age + 8, NULL, 10));
+	} else {
+		p->base_s = p->default_s;
+	}
+
+	// Only the delta-seconds form is supported, an HTTP-date parses as 0
+	p->retry_s = retry_after ? strtoul(retry_after, NULL, 10) : 0;
+}
+
+/** @brief Record the outcome of a successful schedule check.
+ *
+ * @param changed: true if the server sent a schedule that differs from ours
+ */
+void poll_policy_result(struct poll_policy *p, bool changed) {
+	if (changed) {
+		p->unchanged = 0;
+	} else if (p->unchanged < UINT16_MAX) {
+		p->unchanged++;
+	}
+}
+
+/** @brief Seconds until the next schedule check should start.
+ *
+ * A pending Retry-After is used once and then cleared.
+ */
+uint32_t poll_policy_next_seconds(struct poll_policy *p) {
+	uint32_t interval;
+	if (p->retry_s) {
+		interval = clamp_interval(p->retry_s);
+		p->retry_s = 0;
+	} else {
+		uint8_t shift = p->unchanged / POLL_STABLE_CHECKS;
+		if (shift > POLL_MAX_BACKOFF_SHIFT) {
+			shift = POLL_MAX_BACKOFF_SHIFT;
+		}
+		interval = clamp_interval(p->base_s << shift);
+	}
+
+	uint32_t span = (interval * POLL_JITTER_PCT) / 100;
+	if (span) {
+		interval = interval - span + (next_random(p) % (2 * span + 1));
+	}
+	return interval;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Decides how long to wait before the next schedule check.
+ *
+ * The server can set the interval with "Cache-Control: max-age=N" and push a
+ * single check further out with "Retry-After: N". Every interval gets a
+ * per-device jitter seeded from the chip ID so clocks that booted together
+ * drift apart, and the interval is doubled (up to POLL_MAX_BACKOFF_SHIFT
+ * times) after every POLL_STABLE_CHECKS checks that found no change.
+ *
+ * Portable: no Arduino dependencies, so host tools can simulate it.
+ */
+
+//Interval limits regardless of what the server asks for
+#define POLL_MIN_S (5*60)
+#define POLL_MAX_S (6*60*60)
+//Each interval is randomly lengthened or shortened by up to this much
+#define POLL_JITTER_PCT 10
+//Unchanged checks before the interval is doubled
+#define POLL_STABLE_CHECKS 6
+#define POLL_MAX_BACKOFF_SHIFT 2
+
+struct poll_policy {
+	uint32_t default_s;   // interval used until the server sends max-age
+	uint32_t base_s;      // current server-directed interval
+	bool server_set;      // base_s came from the server's max-age
+	uint32_t retry_s;     // one-shot Retry-After, 0 if none
+	uint16_t unchanged;   // consecutive checks without a schedule change
+	uint32_t rng;         // xorshift state seeded from the chip ID
+};
+
+void poll_policy_init(struct poll_policy *p, uint32_t chip_id, uint32_t default_s);
+void poll_policy_set_default(struct poll_policy *p, uint32_t default_s);
+void poll_policy_server_hint(struct poll_policy *p, const char *cache_control, const char *retry_after);
+void poll_policy_result(struct poll_policy *p, bool changed);
+uint32_t poll_policy_next_seconds(struct poll_policy *p);
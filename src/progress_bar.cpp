@@ -0,0 +1,36 @@
+#include "progress_bar.h"
+
+/** @brief Pixels lit at a moment in the span.
+ *
+ * @return count at or before start_s, 0 at or after end_s
+ */
+uint16_t progress_lit(int32_t now_s, int32_t start_s, int32_t end_s, uint16_t count) {
+	int32_t total = end_s - start_s;
+	int32_t remaining = end_s - now_s;
+	if ((total <= 0) || (remaining >= total)) {
+		return count;
+	}
+	if (remaining <= 0) {
+		return 0;
+	}
+	// Round up so the last pixel stays lit until the very end
+	return (((int64_t)remaining * count) + total - 1) / total;
+}
+
+/** @brief Seconds until the number of lit pixels next changes.
+ *
+ * @return 0 if it will not change again (the span is over or empty)
+ */
+uint32_t progress_next_change_s(int32_t now_s, int32_t start_s, int32_t end_s, uint16_t count) {
+	int32_t total = end_s - start_s;
+	if ((total <= 0) || (now_s >= end_s) || (count == 0)) {
+		return 0;
+	}
+	if (now_s < start_s) {
+		return start_s - now_s;
+	}
+	uint16_t lit = progress_lit(now_s, start_s, end_s, count);
+	// lit drops by one once remaining <= (lit - 1) * total / count
+	int32_t boundary = end_s - (int32_t)(((int64_t)(lit - 1) * total) / count);
+	return (boundary > now_s) ? (boundary - now_s) : 1;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Progress bar arithmetic for the night display.
+ *
+ * A bar of `count` pixels covers the span from start_s to end_s and
+ * shrinks as end_s approaches, one pixel going out every
+ * (end_s - start_s) / count seconds. Besides how many pixels are lit, it
+ * tells the caller how long until the next pixel goes out, so the display
+ * only needs attention at those moments however long the strip is.
+ *
+ * Portable: no Arduino dependencies.
+ */
+
+uint16_t progress_lit(int32_t now_s, int32_t start_s, int32_t end_s, uint16_t count);
+uint32_t progress_next_change_s(int32_t now_s, int32_t start_s, int32_t end_s, uint16_t count);
@@ -0,0 +1,231 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include <EEPROM.h>
+#include <CRC32.h>
+#include "schedule_store.h"
+
+static_assert(STORE_ETAG_BASE + sizeof(struct store_etag) <= STORE_CALENDAR_BASE,
+              "Schedule profiles and ETag overlap the calendar");
+
+struct store_index _store_index;
+static struct store_etag _store_etag;
+
+static uint32_t calc_index_crc(struct store_index *idx) {
+	return CRC32::calculate((uint8_t *)idx, offsetof(struct store_index, crc));
+}
+
+static uint32_t calc_etag_crc(struct store_etag *e) {
+	return CRC32::calculate((uint8_t *)e, offsetof(struct store_etag, crc));
+}
+
+static uint16_t slot_offset(uint8_t slot) {
+	return STORE_SLOT_BASE + (slot * sizeof(struct otw_week));
+}
+
+static void write_index(void) {
+	_store_index.crc = calc_index_crc(&_store_index);
+	EEPROM.put(0, _store_index);
+	EEPROM.commit();
+}
+
+// name must have passed store_valid_name()
+static void set_name(uint8_t slot, const char *name) {
+	memset(_store_index.names[slot], 0, STORE_NAME_LEN);
+	memcpy(_store_index.names[slot], name, strlen(name));
+}
+
+/** @brief Check a profile name fits a slot whole.
+ *
+ * Names are never truncated, so two long names cannot end up in one slot.
+ *
+ * @return true for 1 to STORE_NAME_LEN - 1 characters
+ */
+bool store_valid_name(const char *name) {
+	return name && name[0] && (strnlen(name, STORE_NAME_LEN) < STORE_NAME_LEN);
+}
+
+/** @brief Build a fresh index, keeping a schedule written by older firmware.
+ *
+ * The single-schedule layout stored one otw_week at offset 0, which overlaps
+ * the index. If that week has a valid CRC it becomes the "default" profile.
+ */
+static void migrate_legacy(void) {
+	struct otw_week legacy;
+	EEPROM.get(0, legacy);
+	bool legacy_valid = (calc_week_crc(&legacy) == legacy.crc);
+
+	memset(&_store_index, 0, sizeof(_store_index));
+	_store_index.magic = STORE_MAGIC;
+	_store_index.active = 0;
+	set_name(0, STORE_DEFAULT_PROFILE);
+
+	if (!legacy_valid) {
+		use_default_week(&legacy);
+	} else {
+		Serial.println("Migrating stored schedule to default profile");
+	}
+	EEPROM.put(slot_offset(0), legacy);
+	write_index();
+}
+
+void store_init(void) {
+	EEPROM.begin(STORE_EEPROM_SIZE);
+	EEPROM.get(0, _store_index);
+
+	if ((_store_index.magic != STORE_MAGIC) ||
+	    (_store_index.crc != calc_index_crc(&_store_index)) ||
+	    (_store_index.active >= STORE_MAX_PROFILES)) {
+		Serial.println("Profile index invalid, rebuilding");
+		migrate_legacy();
+	}
+	EEPROM.get(STORE_ETAG_BASE, _store_etag);
+	if ((_store_etag.crc != calc_etag_crc(&_store_etag)) || !memchr(_store_etag.etag, '\0', STORE_ETAG_LEN)) {
+		memset(&_store_etag, 0, sizeof(_store_etag));
+	}
+	store_print_index();
+}
+
+/** @brief Read one profile slot from EEPROM.
+ *
+ * @return 0 on success, -1 if the slot is unused or fails its CRC check
+ */
+int store_load_profile(uint8_t slot, struct otw_week *w) {
+	if ((slot >= STORE_MAX_PROFILES) || (_store_index.names[slot][0] == '\0')) {
+		return -1;
+	}
+	EEPROM.get(slot_offset(slot), *w);
+	if (calc_week_crc(w) != w->crc) {
+		return -1;
+	}
+	return 0;
+}
+
+int store_find_profile(const char *name) {
+	// An empty name would match an unused slot
+	if (!store_valid_name(name)) {
+		return -1;
+	}
+	for (uint8_t i = 0; i < STORE_MAX_PROFILES; i++) {
+		if (strncmp(_store_index.names[i], name, STORE_NAME_LEN) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** @brief Store a week under a profile name, reusing its slot if it exists.
+ *
+ * EEPROM is only committed when the stored bytes actually change.
+ *
+ * @return slot number on success, -1 if the name is empty or too long, or
+ *         every slot is taken
+ */
+int store_save_profile(const char *name, struct otw_week *w) {
+	if (!store_valid_name(name)) {
+		printf("Bad profile name '%s', 1 to %u characters\n", name, STORE_NAME_LEN - 1);
+		return -1;
+	}
+	int slot = store_find_profile(name);
+	if (slot < 0) {
+		for (uint8_t i = 0; i < STORE_MAX_PROFILES; i++) {
+			if (_store_index.names[i][0] == '\0') {
+				slot = i;
+				break;
+			}
+		}
+		if (slot < 0) {
+			Serial.println("No free profile slot");
+			return -1;
+		}
+		set_name(slot, name);
+		_store_index.crc = calc_index_crc(&_store_index);
+		EEPROM.put(0, _store_index);
+	}
+
+	w->crc = calc_week_crc(w);
+	EEPROM.put(slot_offset(slot), *w);
+	EEPROM.commit();
+	return slot;
+}
+
+/** @brief Make a stored profile the active one.
+ *
+ * @return slot number on success, -1 if no profile has that name
+ */
+int store_select_profile(const char *name) {
+	int slot = store_find_profile(name);
+	if (slot < 0) {
+		printf("Unknown profile: %s\n", name);
+		return -1;
+	}
+	if (slot != _store_index.active) {
+		_store_index.active = slot;
+		write_index();
+	}
+	return slot;
+}
+
+uint8_t store_active_slot(void) {
+	return _store_index.active;
+}
+
+const char *store_active_name(void) {
+	return _store_index.names[_store_index.active];
+}
+
+const char *store_profile_name(uint8_t slot) {
+	if (slot >= STORE_MAX_PROFILES) {
+		return "";
+	}
+	return _store_index.names[slot];
+}
+
+void store_print_index(void) {
+	char msg_buf[32*STORE_MAX_PROFILES] = { 0 };
+	for (uint8_t i = 0; i < STORE_MAX_PROFILES; i++) {
+		if (_store_index.names[i][0] == '\0') {
+			continue;
+		}
+		uint16_t str_start = strlen(msg_buf);
+		snprintf(msg_buf + str_start, sizeof(msg_buf)-str_start, "%c %u: %s\n",
+		         (i == _store_index.active) ? '*' : ' ', i, _store_index.names[i]);
+	}
+	Serial.print(msg_buf);
+}
+
+/** @brief ETag to send with If-None-Match on the next schedule download.
+ *
+ * @param week_crc: CRC of the schedule now in use
+ *
+ * @return the stored ETag, or NULL if there is none or the schedule has
+ *         changed since it was received (another profile, an MQTT push)
+ */
+const char *store_schedule_etag(uint32_t week_crc) {
+	if (!_store_etag.etag[0] || (_store_etag.week_crc != week_crc)) {
+		return NULL;
+	}
+	return _store_etag.etag;
+}
+
+/** @brief Remember the ETag of a schedule download that was applied.
+ *
+ * EEPROM is only written when the ETag or schedule changed. An empty or
+ * over-long ETag clears the stored one.
+ */
+void store_set_schedule_etag(const char *etag, uint32_t week_crc) {
+	struct store_etag e;
+	memset(&e, 0, sizeof(e));
+	size_t len = strlen(etag);
+	if ((len > 0) && (len < STORE_ETAG_LEN)) {
+		memcpy(e.etag, etag, len);
+		e.week_crc = week_crc;
+	}
+	e.crc = calc_etag_crc(&e);
+	if (e.crc == _store_etag.crc) {
+		return;
+	}
+	_store_etag = e;
+	EEPROM.put(STORE_ETAG_BASE, _store_etag);
+	EEPROM.commit();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include "wake_schedule.h"
+
+/*
+ * EEPROM layout:
+ *
+ *   0                    struct store_index (names of each slot + active slot)
+ *   STORE_SLOT_BASE      struct otw_week slot[STORE_MAX_PROFILES]
+ *   STORE_ETAG_BASE      struct store_etag (the last schedule download's ETag)
+ *   STORE_CALENDAR_BASE  struct otw_calendar (see calendar.h)
+ *
+ * Switching profiles only rewrites the index. Firmware before profiles were
+ * added stored a single otw_week at offset 0; it is migrated to the
+ * "default" profile the first time the index is found to be invalid.
+ */
+
+#define STORE_MAGIC 0x4F545750 // "OTWP"
+#define STORE_MAX_PROFILES 6
+#define STORE_NAME_LEN 12
+#define STORE_DEFAULT_PROFILE "default"
+#define STORE_CALENDAR_BASE 512
+#define STORE_EEPROM_SIZE 1024
+
+struct store_index {
+	uint32_t magic;
+	uint8_t active;
+	uint8_t reserved[3];
+	char names[STORE_MAX_PROFILES][STORE_NAME_LEN];
+	uint32_t crc;
+};
+
+#define STORE_SLOT_BASE sizeof(struct store_index)
+#define STORE_ETAG_BASE (STORE_SLOT_BASE + (STORE_MAX_PROFILES * sizeof(struct otw_week)))
+//Longest ETag kept, quotes included; the reference server's are 14 characters
+#define STORE_ETAG_LEN 40
+
+// Only valid while the active schedule still has the CRC it was received with
+struct store_etag {
+	uint32_t week_crc;
+	char etag[STORE_ETAG_LEN];
+	uint32_t crc;
+};
+
+void store_init(void);
+bool store_valid_name(const char *name);
+int store_load_profile(uint8_t slot, struct otw_week *w);
+int store_save_profile(const char *name, struct otw_week *w);
+int store_find_profile(const char *name);
+int store_select_profile(const char *name);
+uint8_t store_active_slot(void);
+const char *store_active_name(void);
+const char *store_profile_name(uint8_t slot);
+void store_print_index(void);
+const char *store_schedule_etag(uint32_t week_crc);
+void store_set_schedule_etag(const char *etag, uint32_t week_crc);
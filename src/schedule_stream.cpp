@@ -0,0 +1,240 @@
+#include <string.h>
+#include <stdlib.h>
+#include "schedule_stream.h"
+
+// Recognized keys at depth 1 beyond the weekday names (0..6)
+#define KEY_UNKNOWN -1
+#define KEY_PROFILE 7
+#define KEY_ACTIVATE 8
+
+#define JSON_PROFILE "profile"
+#define JSON_ACTIVATE "activate"
+
+#define HAVE_FULL_WEEK (((uint64_t)1 << (7 * 4 * 2)) - 1)
+
+void sched_stream_init(struct sched_stream *s) {
+	memset(s, 0, sizeof(*s));
+	s->activate = -1;
+	for (uint8_t i = 0; i < 4; i++) {
+		s->key[i] = KEY_UNKNOWN;
+	}
+}
+
+static int8_t lookup(const char *const *names, uint8_t count, const char *token) {
+	for (uint8_t i = 0; i < count; i++) {
+		if (strcmp(names[i], token) == 0) {
+			return i;
+		}
+	}
+	return KEY_UNKNOWN;
+}
+
+static void append(struct sched_stream *s, char c) {
+	if (s->token_len < SCHED_STREAM_TOKEN_LEN - 1) {
+		s->token[s->token_len++] = c;
+	} else {
+		// Too long to be anything we recognize
+		s->token_len = SCHED_STREAM_TOKEN_LEN;
+	}
+}
+
+static const char *token(struct sched_stream *s) {
+	if (s->token_len >= SCHED_STREAM_TOKEN_LEN) {
+		return "";
+	}
+	s->token[s->token_len] = '\0';
+	return s->token;
+}
+
+static void end_key(struct sched_stream *s) {
+	static const char *const fields[2] = { "hours", "minutes" };
+	const char *t = token(s);
+	int8_t id = KEY_UNKNOWN;
+
+	switch (s->depth) {
+		case 1:
+			id = lookup(json_week, 7, t);
+			if (strcmp(t, JSON_PROFILE) == 0) id = KEY_PROFILE;
+			if (strcmp(t, JSON_ACTIVATE) == 0) id = KEY_ACTIVATE;
+			break;
+		case 2:
+			if ((s->key[1] >= 0) && (s->key[1] < 7)) {
+				id = lookup(json_event, 4, t);
+			}
+			break;
+		case 3:
+			if (s->key[2] >= 0) {
+				id = lookup(fields, 2, t);
+			}
+			break;
+		default:
+			return;
+	}
+	s->key[s->depth] = id;
+}
+
+static void end_string(struct sched_stream *s) {
+	if ((s->depth == 1) && (s->key[1] == KEY_PROFILE)) {
+		// Refused rather than cut short, so a long name can't land on another profile
+		const char *t = token(s);
+		if (!store_valid_name(t)) {
+			s->error = true;
+			return;
+		}
+		memcpy(s->profile, t, strlen(t) + 1);
+	}
+}
+
+static void end_scalar(struct sched_stream *s) {
+	const char *t = token(s);
+
+	if ((s->depth == 1) && (s->key[1] == KEY_ACTIVATE)) {
+		if (strcmp(t, "true") == 0) s->activate = 1;
+		else if (strcmp(t, "false") == 0) s->activate = 0;
+		return;
+	}
+
+	if ((s->depth != 3) || (s->key[1] < 0) || (s->key[1] >= 7) || (s->key[2] < 0) || (s->key[3] < 0)) {
+		return;
+	}
+
+	char *end;
+	long value = strtol(t, &end, 10);
+	uint8_t field = s->key[3];
+	if ((*t == '\0') || (*end != '\0') || (value < 0) || (value >= (field ? 60 : 24))) {
+		s->error = true;
+		return;
+	}
+
+	struct otw_time *ts;
+	struct otw_day *day = &s->week.dow[(uint8_t)s->key[1]];
+	switch (s->key[2]) {
+		case E_DOZE:
+			ts = &day->doze;
+			break;
+		case E_WAKE:
+			ts = &day->wake;
+			break;
+		case E_DAY:
+			ts = &day->day;
+			break;
+		default:
+			ts = &day->sleep;
+			break;
+	}
+	if (field) {
+		ts->minute = value;
+	} else {
+		ts->hour = value;
+	}
+	s->have |= (uint64_t)1 << ((((s->key[1] * 4) + s->key[2]) * 2) + field);
+}
+
+static void handle_char(struct sched_stream *s, char c) {
+	if (s->in_string) {
+		if (s->escape) {
+			s->escape = false;
+			append(s, c);
+		} else if (c == '\\') {
+			s->escape = true;
+		} else if (c == '"') {
+			s->in_string = false;
+			if (s->expect_key) {
+				end_key(s);
+			} else {
+				end_string(s);
+			}
+		} else {
+			append(s, c);
+		}
+		return;
+	}
+
+	if (s->in_scalar) {
+		if (((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'z')) ||
+		    (c == '.') || (c == '-') || (c == '+') || (c == 'E')) {
+			append(s, c);
+			return;
+		}
+		s->in_scalar = false;
+		end_scalar(s);
+	}
+
+	switch (c) {
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			break;
+		case '"':
+			s->in_string = true;
+			s->token_len = 0;
+			break;
+		case '{':
+		case '[':
+			if (s->depth >= SCHED_STREAM_MAX_DEPTH - 1) {
+				s->error = true;
+				return;
+			}
+			s->depth++;
+			if (c == '[') {
+				s->is_array |= (1 << s->depth);
+			} else {
+				s->is_array &= ~(1 << s->depth);
+			}
+			if (s->depth < 4) {
+				s->key[s->depth] = KEY_UNKNOWN;
+			}
+			s->expect_key = (c == '{');
+			break;
+		case '}':
+		case ']':
+			if ((s->depth == 0) || (((s->is_array >> s->depth) & 1) != (c == ']'))) {
+				s->error = true;
+				return;
+			}
+			s->depth--;
+			s->expect_key = false;
+			break;
+		case ':':
+			s->expect_key = false;
+			break;
+		case ',':
+			s->expect_key = !((s->is_array >> s->depth) & 1);
+			break;
+		default:
+			if (((c >= '0') && (c <= '9')) || (c == '-') || ((c >= 'a') && (c <= 'z'))) {
+				s->in_scalar = true;
+				s->token_len = 0;
+				append(s, c);
+			} else {
+				s->error = true;
+			}
+			break;
+	}
+}
+
+void sched_stream_feed(struct sched_stream *s, const uint8_t *buf, size_t len) {
+	for (size_t i = 0; (i < len) && !s->error; i++) {
+		handle_char(s, buf[i]);
+	}
+}
+
+/** @brief Check what the fed document contained.
+ *
+ * @return SCHED_STREAM_WEEK if every day had all four events,
+ *         SCHED_STREAM_COMMAND if it only named a profile,
+ *         SCHED_STREAM_ERROR otherwise
+ */
+int sched_stream_finish(struct sched_stream *s) {
+	if (s->error || s->in_string || (s->depth != 0)) {
+		return SCHED_STREAM_ERROR;
+	}
+	if (s->have == HAVE_FULL_WEEK) {
+		return SCHED_STREAM_WEEK;
+	}
+	if ((s->have == 0) && (s->profile[0] != '\0')) {
+		return SCHED_STREAM_COMMAND;
+	}
+	return SCHED_STREAM_ERROR;
+}
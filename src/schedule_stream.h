@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "wake_schedule.h"
+#include "schedule_store.h"
+
+/*
+ * Incremental parser for schedule documents.
+ *
+ * Accepts the same JSON as ingest_schedule() one chunk at a time, so a
+ * download can be parsed as it arrives (optionally straight out of the
+ * heatshrink decoder) without holding the whole document in RAM. Keys the
+ * clock does not know about are skipped at any depth.
+ */
+
+#define SCHED_STREAM_MAX_DEPTH 16
+#define SCHED_STREAM_TOKEN_LEN 16
+
+enum sched_stream_result {
+	SCHED_STREAM_ERROR = -1,
+	SCHED_STREAM_WEEK,     // a complete week, maybe with a profile name
+	SCHED_STREAM_COMMAND   // only a profile name: switch to a stored profile
+};
+
+struct sched_stream {
+	struct otw_week week;
+	uint64_t have;                        // one bit per day/event/field seen
+	char profile[STORE_NAME_LEN];
+	int8_t activate;                      // -1 if not given
+	// Tokenizer state
+	uint8_t depth;
+	uint16_t is_array;                    // bit per depth
+	int8_t key[4];                        // recognized key at depths 1..3
+	bool expect_key;
+	bool in_string;
+	bool escape;
+	bool in_scalar;
+	bool error;
+	char token[SCHED_STREAM_TOKEN_LEN];
+	uint8_t token_len;
+};
+
+void sched_stream_init(struct sched_stream *s);
+void sched_stream_feed(struct sched_stream *s, const uint8_t *buf, size_t len);
+int sched_stream_finish(struct sched_stream *s);
@@ -0,0 +1,118 @@
+#include <Arduino.h>
+#include <string.h>
+#include "metrics.h"
+#include "stall.h"
+#include "trace.h"
+
+// timer1 counts the 80 MHz APB clock; TIM_DIV16 gives 5 counts per us
+#define TIMER1_COUNTS_PER_MS 5000
+// timer1 is a 23 bit down counter
+static_assert(STALL_TICK_MS * TIMER1_COUNTS_PER_MS < (1UL << 23), "stall tick too long for timer1");
+
+static const char *region_names[STALL_REGIONS] = {
+	"loop", "wifi", "dns", "ntp", "schedule", "calendar", "telemetry", "update", "ota", "mqtt"
+};
+
+struct stall_stats {
+	uint16_t count;
+	uint32_t max_ms;
+};
+
+// Written by the interrupt
+static volatile uint32_t _ticks = 0;
+static volatile uint16_t _charged[STALL_REGIONS];
+// Written by the loop
+static volatile uint8_t _region = STALL_LOOP;
+static uint32_t _checkin_ticks = 0;
+static struct stall_stats _stats[STALL_REGIONS];
+
+static void IRAM_ATTR on_tick(void) {
+	_ticks++;
+	uint8_t r = _region;
+	if (_charged[r] < UINT16_MAX) {
+		_charged[r]++;
+	}
+}
+
+void stall_init(void) {
+	memset(_stats, 0, sizeof(_stats));
+	_region = STALL_LOOP;
+	timer1_attachInterrupt(on_tick);
+	timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+	timer1_write(STALL_TICK_MS * TIMER1_COUNTS_PER_MS);
+}
+
+/** @brief Tell the monitor the loop is still running.
+ *
+ * Cheap when the loop is on time. After a stall, charges it to every
+ * region that held the loop, prints it and traces the region that held
+ * it longest.
+ */
+void stall_checkin(void) {
+	uint16_t charged[STALL_REGIONS];
+	noInterrupts();
+	uint32_t ticks = _ticks - _checkin_ticks;
+	_checkin_ticks = _ticks;
+	for (uint8_t r = 0; r < STALL_REGIONS; r++) {
+		charged[r] = _charged[r];
+		_charged[r] = 0;
+	}
+	interrupts();
+	if (ticks * STALL_TICK_MS <= STALL_BUDGET_MS) {
+		return;
+	}
+
+	uint8_t worst = STALL_LOOP;
+	for (uint8_t r = 0; r < STALL_REGIONS; r++) {
+		if (!charged[r]) {
+			continue;
+		}
+		uint32_t ms = (uint32_t)charged[r] * STALL_TICK_MS;
+		if (_stats[r].count < UINT16_MAX) {
+			_stats[r].count++;
+		}
+		if (ms > _stats[r].max_ms) {
+			_stats[r].max_ms = ms;
+		}
+		if (charged[r] > charged[worst]) {
+			worst = r;
+		}
+	}
+	printf("Loop stalled %lu ms, mostly in %s (%lu ms)\n", (unsigned long)(ticks * STALL_TICK_MS),
+	       region_names[worst], (unsigned long)charged[worst] * STALL_TICK_MS);
+	trace_event(TRACE_STALL, worst);
+}
+
+/** @brief Charge the loop's time to a region until stall_leave().
+ *
+ * @return the region to hand back to stall_leave(), so regions can nest
+ */
+uint8_t stall_enter(uint8_t region) {
+	uint8_t previous = _region;
+	_region = (region < STALL_REGIONS) ? region : STALL_LOOP;
+	return previous;
+}
+
+void stall_leave(uint8_t previous) {
+	_region = previous;
+}
+
+// One METRIC_STALL per region that stalled since the last upload
+void stall_record_metrics(void) {
+	for (uint8_t r = 0; r < STALL_REGIONS; r++) {
+		if (_stats[r].count) {
+			metrics_record(METRIC_STALL, STALL_METRIC_A(r, _stats[r].count),
+			               min(_stats[r].max_ms, (uint32_t)UINT16_MAX));
+		}
+	}
+	memset(_stats, 0, sizeof(_stats));
+}
+
+void stall_print(void) {
+	printf("Stalls over %u ms since the last upload (region: count, longest)\n", STALL_BUDGET_MS);
+	for (uint8_t r = 0; r < STALL_REGIONS; r++) {
+		if (_stats[r].count) {
+			printf("  %-10s %u, %lu ms\n", region_names[r], _stats[r].count, (unsigned long)_stats[r].max_ms);
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Main loop stall monitor.
+ *
+ * A timer1 interrupt ticks every STALL_TICK_MS and charges the tick to the
+ * region the loop is in. Regions are set around the calls known to block
+ * for seconds (association, DNS, NTP replies, HTTP requests); anything else
+ * is STALL_LOOP. The loop calls stall_checkin() on every pass and every
+ * idle wait slice; a check-in that comes more than STALL_BUDGET_MS after
+ * the previous one closes a stall, and each region charged during it
+ * counts one stall of that many ms.
+ *
+ * The interrupt only bumps a counter, so the monitor stays on in
+ * production. It takes timer1: analogWrite(), tone() and Servo are not
+ * available alongside it.
+ *
+ * Counts and longest stalls per region are added to the metrics ring
+ * (METRIC_STALL) before each telemetry upload, and the console's metrics
+ * command prints them.
+ */
+
+#define STALL_TICK_MS 50
+//Longest the loop may go without checking in
+#define STALL_BUDGET_MS 1000
+
+// Ids are decoded by the schedule server and the trace decoder: only ever add to the end
+enum stall_region {
+	STALL_LOOP,         // none of the below
+	STALL_WIFI,         // association (waitForConnectResult) and disconnect
+	STALL_DNS,          // hostByName()
+	STALL_NTP,          // waiting for NTP replies
+	STALL_SCHEDULE,     // schedule GET
+	STALL_CALENDAR,     // calendar GET
+	STALL_TELEMETRY,    // telemetry POST
+	STALL_UPDATE,       // firmware download
+	STALL_OTA,          // ArduinoOTA.handle() during an update window
+	STALL_MQTT,         // MQTT keepalive and reconnect
+	STALL_REGIONS
+};
+
+// Packed into METRIC_STALL's a field
+#define STALL_METRIC_A(region, count) (((region) & 0x0F) | ((count) > 15 ? 0xF0 : (count) << 4))
+#define STALL_REGION_OF(a) ((a) & 0x0F)
+#define STALL_COUNT_OF(a) ((a) >> 4)
+
+void stall_init(void);
+void stall_checkin(void);
+uint8_t stall_enter(uint8_t region);
+void stall_leave(uint8_t previous);
+void stall_record_metrics(void);
+void stall_print(void);
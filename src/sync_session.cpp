@@ -0,0 +1,794 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>
+#include <ESP8266httpUpdate.h>
+#include <Updater.h>
+#include <WiFiUdp.h>
+#include <TimeLib.h>
+#include "wake_schedule.h"
+#include "schedule_store.h"
+#include "schedule_stream.h"
+#include "heatshrink.h"
+#include "http_fetch.h"
+#include "delta_patch.h"
+#include "calendar.h"
+#include "metrics.h"
+#include "mqtt_link.h"
+#include "stall.h"
+#include "wifi_link.h"
+#include "config.h"
+#include "trace.h"
+#include "sync_session.h"
+
+#define NTP_PACKET_SIZE 48
+// Unix time starts on Jan 1 1970. In seconds since Jan 1 1900 that's:
+#define NTP_UNIX_OFFSET 2208988800UL
+
+static const char *stage_names[SYNC_STAGES] = {
+	"associate", "dns", "time", "schedule", "calendar", "telemetry", "update", "disconnect"
+};
+
+// For the calendar and firmware pulls, which are rare enough to stay on HTTPClient
+static WiFiClient _client;
+static HTTPClient _http;
+static WiFiUDP _udp;
+static bool _udp_started = false;
+
+static IPAddress _ntp_ip;
+static uint32_t _ntp_resolved_ms = 0;
+static bool _ntp_ip_valid = false;
+static bool _time_valid = false;
+static uint32_t _time_synced_ms = 0;
+
+static sync_hook _on_associated = NULL;
+static sync_clock _local_time = NULL;
+static sync_hook _on_wait = NULL;
+
+static struct sync_report _report;
+static uint32_t _session_start_ms = 0;
+static uint32_t _stage_start_ms = 0;
+static uint8_t _stall_previous = STALL_LOOP;
+static bool _connected = false;
+
+// Firmware update flagged by the last schedule response
+static enum sync_update _update = SYNC_UPDATE_NONE;
+static char _update_url[SYNC_UPDATE_URL_MAX];
+
+// Telemetry body, built without touching the heap
+static uint8_t _telemetry[TELEMETRY_MAX_BYTES];
+
+// Decoder and parser live outside the stack; both are only used during a fetch
+static struct hs_decoder _decoder;
+static struct sched_stream _parser;
+static struct delta_patch _delta;
+
+static void feed_parser(void *ctx, const uint8_t *buf, size_t len) {
+	sched_stream_feed((struct sched_stream *)ctx, buf, len);
+}
+
+// Schedule and telemetry requests, run by the loop between calls to the wait
+// hook; the connection is kept open from one to the next
+static struct http_fetch _fetch;
+
+// Stages are timed for the report and charged to a stall region (see stall.h)
+static void stage_begin(uint8_t region) {
+	_stage_start_ms = millis();
+	_stall_previous = stall_enter(region);
+}
+
+static bool stage_end(enum sync_stage stage, uint8_t status) {
+	stall_leave(_stall_previous);
+	_report.stage_ms[stage] = millis() - _stage_start_ms;
+	_report.status[stage] = status;
+	return status != SYNC_FAILED;
+}
+
+/** @brief Set up the session hooks.
+ *
+ * @param on_associated: called once the link is up
+ * @param local_time: local time, for the calendar's year
+ * @param on_wait: called every SYNC_WAIT_SLICE_MS while the schedule
+ *        downloads, so the loop can keep the lights and console going
+ */
+void sync_session_init(sync_hook on_associated, sync_clock local_time, sync_hook on_wait) {
+	_on_associated = on_associated;
+	_local_time = local_time;
+	_on_wait = on_wait;
+	_http.setReuse(true);
+}
+
+/*
+ * DNS
+ */
+
+// Copy the host name out of the configured server ("http://host[:port]")
+// and return its port
+static uint16_t server_host(char *host, size_t len) {
+	const char *server = config_text(CONFIG_SERVER);
+	const char *p = strstr(server, "://");
+	p = p ? p + 3 : server;
+	size_t n = strcspn(p, ":/");
+	if (n >= len) {
+		n = len - 1;
+	}
+	memcpy(host, p, n);
+	host[n] = '\0';
+	return (p[n] == ':') ? atoi(p + n + 1) : 80;
+}
+
+// A path on the configured schedule server
+static const char *server_url(char *url, size_t len, const char *path) {
+	snprintf(url, len, "%s%s", config_text(CONFIG_SERVER), path);
+	return url;
+}
+
+static uint8_t resolve(void) {
+	// The schedule server answer lands in lwIP's DNS table, which the HTTP
+	// stages then hit when they connect by name
+	char host[64];
+	IPAddress server_ip;
+	server_host(host, sizeof(host));
+	bool ok = WiFi.hostByName(host, server_ip);
+
+	if (!_ntp_ip_valid || (millis() - _ntp_resolved_ms > SYNC_DNS_CACHE_S * 1000UL)) {
+		//get a random server from the pool
+		if (WiFi.hostByName(config_text(CONFIG_NTP_SERVER), _ntp_ip)) {
+			_ntp_ip_valid = true;
+			_ntp_resolved_ms = millis();
+		} else {
+			ok = false;
+		}
+	}
+	return ok ? SYNC_OK : SYNC_FAILED;
+}
+
+/*
+ * Time
+ */
+
+// send an NTP request to the time server at the given address
+static void send_ntp_packet(IPAddress &address, uint8_t *packet) {
+	memset(packet, 0, NTP_PACKET_SIZE);
+	// Initialize values needed to form NTP request
+	packet[0] = 0b11100011;   // LI, Version, Mode
+	packet[1] = 0;            // Stratum, or type of clock
+	packet[2] = 6;            // Polling Interval
+	packet[3] = 0xEC;         // Peer Clock Precision
+	// 8 bytes of zero for Root Delay & Root Dispersion
+	packet[12] = 49;
+	packet[13] = 0x4E;
+	packet[14] = 49;
+	packet[15] = 52;
+
+	_udp.beginPacket(address, 123); //NTP requests are to port 123
+	_udp.write(packet, NTP_PACKET_SIZE);
+	_udp.endPacket();
+}
+
+/** @brief Ask the cached NTP server for the time.
+ *
+ * Waits at most NTP_TIMEOUT_MS for the reply instead of a fixed delay, so a
+ * fast answer keeps the radio-on time short.
+ *
+ * @return Unix time, or 0 if no reply arrived
+ */
+static unsigned long get_utc(void) {
+	uint8_t packet[NTP_PACKET_SIZE];
+
+	// Each call drops the previous packet, clearing stale replies from an earlier attempt
+	while (_udp.parsePacket()) {
+	}
+	Serial.println("sending NTP packet...");
+	send_ntp_packet(_ntp_ip, packet);
+
+	uint32_t start = millis();
+	while (millis() - start < NTP_TIMEOUT_MS) {
+		int cb = _udp.parsePacket();
+		if (cb >= NTP_PACKET_SIZE) {
+			_udp.read(packet, NTP_PACKET_SIZE);
+			//the timestamp starts at byte 40 of the received packet and is four bytes
+			unsigned long secsSince1900 = ((unsigned long)packet[40] << 24) | ((unsigned long)packet[41] << 16) |
+			                              ((unsigned long)packet[42] << 8) | packet[43];
+			unsigned long epoch = secsSince1900 - NTP_UNIX_OFFSET;
+			printf("NTP reply after %lu ms, Unix time = %lu\n", (unsigned long)(millis() - start), epoch);
+			return epoch;
+		}
+		delay(10);
+	}
+	Serial.println("no packet yet");
+	return 0;
+}
+
+/** @brief Set the clock from NTP using a bounded number of requests.
+ *
+ * When no reply arrives the clock keeps running from the last known time
+ * (compile time on a cold boot) so the stored schedule is still followed.
+ */
+static uint8_t sync_time(void) {
+	if (_time_valid && (millis() - _time_synced_ms < SYNC_TIME_INTERVAL_S * 1000UL)) {
+		return SYNC_SKIPPED;
+	}
+	if (!_ntp_ip_valid) {
+		return SYNC_FAILED;
+	}
+	if (!_udp_started) {
+		_udp.begin(NTP_LOCAL_PORT);
+		_udp_started = true;
+	}
+	for (uint8_t i = 0; i < NTP_ATTEMPTS; i++) {
+		unsigned long utc = get_utc();
+		if (utc != 0) {
+			int32_t correction = (int32_t)(utc - now());
+			correction = constrain(correction, INT16_MIN, INT16_MAX);
+			metrics_record(METRIC_NTP, i + 1, (uint16_t)(int16_t)correction);
+			setTime(utc);
+			trace_event(TRACE_CLOCK, i + 1);
+			_time_valid = true;
+			_time_synced_ms = millis();
+			return SYNC_OK;
+		}
+		Serial.println("Retrying...");
+	}
+	Serial.println("NTP unavailable, running on last known time");
+	return SYNC_FAILED;
+}
+
+/*
+ * Schedule and calendar
+ */
+
+/** @brief Note a firmware update flagged by the schedule server.
+ *
+ * @param value: X-OTW-Update header, "window" or an http:// URL, optionally
+ *        followed by the MD5 of the new image
+ */
+static void update_hint(const char *value) {
+	char target[SYNC_UPDATE_URL_MAX];
+	char md5[33] = "";
+	_update = SYNC_UPDATE_NONE;
+	// Field widths follow SYNC_UPDATE_URL_MAX and the 32 hex digit MD5
+	if (sscanf(value, "%127s %32s", target, md5) < 1) {
+		return;
+	}
+	if (md5[0] && ESP.getSketchMD5().equalsIgnoreCase(md5)) {
+		Serial.println("Flagged firmware is already running");
+		return;
+	}
+	if (strcmp(target, "window") == 0) {
+		_update = SYNC_UPDATE_WINDOW;
+	} else if (strncmp(target, "http://", 7) == 0) {
+		strcpy(_update_url, target);
+		_update = SYNC_UPDATE_PULL;
+	} else {
+		printf("Ignoring firmware update hint: %s\n", value);
+		return;
+	}
+	printf("Firmware update pending: %s\n", target);
+}
+
+// Response headers the schedule stage acts on, kept until the body is in
+struct schedule_hints {
+	bool compressed;
+	bool corrupt;
+	char cache_control[48];
+	char retry_after[16];
+	char etag[STORE_ETAG_LEN];
+};
+
+static void copy_hint(char *dst, size_t len, const char *value) {
+	strncpy(dst, value, len - 1);
+	dst[len - 1] = '\0';
+}
+
+static void schedule_header(void *ctx, const char *name, const char *value) {
+	struct schedule_hints *hints = (struct schedule_hints *)ctx;
+	if (!strcasecmp(name, "Content-Encoding")) {
+		hints->compressed = !strcmp(value, HS_CONTENT_ENCODING);
+	} else if (!strcasecmp(name, "Cache-Control")) {
+		copy_hint(hints->cache_control, sizeof(hints->cache_control), value);
+	} else if (!strcasecmp(name, "Retry-After")) {
+		copy_hint(hints->retry_after, sizeof(hints->retry_after), value);
+	} else if (!strcasecmp(name, "ETag")) {
+		// A cut-off ETag would never match; leave it empty instead
+		if (strlen(value) < sizeof(hints->etag)) {
+			strcpy(hints->etag, value);
+		}
+	} else if (!strcasecmp(name, "X-OTW-Update")) {
+		update_hint(value);
+	} else if (!strcasecmp(name, "X-OTW-Config") && config_apply(value)) {
+		// A new NTP server is looked up on the next session
+		_ntp_ip_valid = false;
+	}
+}
+
+static int schedule_body(void *ctx, const uint8_t *buf, size_t len) {
+	struct schedule_hints *hints = (struct schedule_hints *)ctx;
+	if (_fetch.response.status != 200) {
+		return 0;
+	}
+	if (!hints->compressed) {
+		sched_stream_feed(&_parser, buf, len);
+	} else if (hs_decoder_feed(&_decoder, buf, len, feed_parser, &_parser)) {
+		// No point downloading the rest
+		hints->corrupt = true;
+		return -1;
+	}
+	return 0;
+}
+
+// Set once the server has no per-device schedule, until the next reboot
+static bool _shared_schedule = false;
+
+// Run a request on _fetch, calling the wait hook until it is over
+static void fetch_run(const struct http_request *req) {
+	if (!http_fetch_start(&_fetch, req)) {
+		while (!http_fetch_poll(&_fetch)) {
+			if (_on_wait) {
+				_on_wait();
+			}
+			delay(SYNC_WAIT_SLICE_MS);
+		}
+	}
+}
+
+// Run one GET of a schedule path
+static void schedule_get(const char *host, uint16_t port, IPAddress ip, const char *path,
+                         struct schedule_hints *hints) {
+	char headers[48 + STORE_ETAG_LEN];
+	const char *etag = store_schedule_etag(get_schedule_crc());
+	snprintf(headers, sizeof(headers), "Accept-Encoding: " HS_CONTENT_ENCODING "\r\n%s%s%s",
+	         etag ? "If-None-Match: " : "", etag ? etag : "", etag ? "\r\n" : "");
+	printf("GET %s%s\n", path, etag ? " (If-None-Match)" : "");
+
+	memset(hints, 0, sizeof(*hints));
+	struct http_request req = {};
+	req.ip = ip;
+	req.port = port;
+	req.host = host;
+	req.path = path;
+	req.headers = headers;
+	req.keep_alive = true;
+	req.max_body = SYNC_SCHEDULE_MAX_BYTES;
+	req.connect_timeout_ms = HTTP_FETCH_CONNECT_TIMEOUT_MS;
+	req.read_timeout_ms = HTTP_FETCH_READ_TIMEOUT_MS;
+	req.on_header = schedule_header;
+	req.on_body = schedule_body;
+	req.ctx = hints;
+	hs_decoder_init(&_decoder);
+	sched_stream_init(&_parser);
+	fetch_run(&req);
+}
+
+/** @brief Download the schedule and parse it as it arrives.
+ *
+ * Asks for this clock's own document (SCHEDULE_PATH_DEVICE) and falls back
+ * to the shared SCHEDULE_PATH_JSON if the server has none, as a plain file
+ * server would. The ETag of the last applied download goes out as
+ * If-None-Match, so an unchanged schedule costs a header-only 304.
+ *
+ * Asks for a heatshrink compressed body. Either way the body goes straight
+ * from the socket into the streaming parser (via the 256 byte decoder window
+ * when compressed), so the document is never held in RAM. The download runs
+ * on http_fetch.h, calling the wait hook in between, so the lights and
+ * console keep going however slow the server is.
+ *
+ * @return 0 on success or 304, -1 on a transfer or parse error
+ */
+static int fetch_schedule(struct poll_policy *poll) {
+	char host[64];
+	char path[48];
+	IPAddress server_ip;
+	uint16_t port = server_host(host, sizeof(host));
+	// Answered from lwIP's DNS table after the DNS stage
+	if (!WiFi.hostByName(host, server_ip)) {
+		printf("Could not resolve %s\n", host);
+		return -1;
+	}
+
+	struct schedule_hints hints;
+	if (!_shared_schedule) {
+		snprintf(path, sizeof(path), SCHEDULE_PATH_DEVICE, ESP.getChipId());
+		schedule_get(host, port, server_ip, path, &hints);
+		if ((_fetch.state == HTTP_FETCH_DONE) && (_fetch.response.status == 404)) {
+			Serial.println("No per-device schedule, using the shared one");
+			_shared_schedule = true;
+		}
+	}
+	if (_shared_schedule) {
+		schedule_get(host, port, server_ip, SCHEDULE_PATH_JSON, &hints);
+	}
+
+	int status = _fetch.response.status;
+	Serial.print("response code:");
+	Serial.println(status);
+	if (poll && _fetch.response.headers) {
+		poll_policy_server_hint(poll, hints.cache_control, hints.retry_after);
+	}
+	if (hints.corrupt) {
+		Serial.println("Corrupt compressed schedule");
+		return -1;
+	}
+	if (_fetch.state != HTTP_FETCH_DONE) {
+		printf("Schedule download failed: %s\n", http_fetch_error_str(&_fetch));
+		return -1;
+	}
+	if (status == 304) {
+		Serial.println("Schedule not modified");
+		return 0;
+	}
+	if (status != 200) {
+		return -1;
+	}
+	printf("Received %u bytes (%s)\n", _fetch.response.body_len, hints.compressed ? HS_CONTENT_ENCODING : "identity");
+	if (ingest_schedule_stream(&_parser)) {
+		return -1;
+	}
+	store_set_schedule_etag(hints.etag, get_schedule_crc());
+	return 0;
+}
+
+static uint8_t check_for_new_schedule(struct poll_policy *poll) {
+	Serial.println("Checking server for schedule:");
+	uint32_t crc = get_schedule_crc();
+	if (fetch_schedule(poll)) {
+		printf("Error processing received schedule\n");
+		return SYNC_FAILED;
+	}
+	bool changed = (get_schedule_crc() != crc);
+	if (changed) {
+		trace_event(TRACE_SCHEDULE, get_schedule_crc() & 0xFF);
+	}
+	poll_policy_result(poll, changed);
+	return SYNC_OK;
+}
+
+// The exception calendar is fetched once per year and cached in EEPROM
+static uint8_t check_for_calendar(void) {
+	if (!_time_valid || calendar_has_year(year(_local_time()))) {
+		return SYNC_SKIPPED;
+	}
+	Serial.println("Checking server for exception calendar:");
+	char url[SYNC_URL_MAX];
+	Serial.println(server_url(url, sizeof(url), SCHEDULE_PATH_CALENDAR));
+	_http.begin(_client, url);
+	int httpResponseCode = _http.GET();
+	Serial.print("response code:");
+	Serial.println(httpResponseCode);
+	int err = -1;
+	if (httpResponseCode == 200) {
+		String payload = _http.getString();
+		Serial.println(payload);
+		err = ingest_calendar(payload.c_str(), payload.length());
+	}
+	_http.end();
+	if (err) {
+		printf("Error processing received calendar\n");
+		return SYNC_FAILED;
+	}
+	return SYNC_OK;
+}
+
+/*
+ * Telemetry
+ */
+
+/** @brief Upload the metrics ring in one binary POST.
+ *
+ * Goes out on the connection the schedule download left open, so it costs
+ * no extra TCP handshake, and asks the server to close it after. Records
+ * are only dropped once the server accepts them.
+ */
+static uint8_t send_telemetry(void) {
+	stall_record_metrics();
+	metrics_record(METRIC_HEAP, ESP.getHeapFragmentation(), min(ESP.getFreeHeap(), (uint32_t)UINT16_MAX));
+	size_t len = metrics_encode(_telemetry, sizeof(_telemetry), ESP.getChipId(), get_schedule_crc());
+	if (len == 0) {
+		return SYNC_FAILED;
+	}
+
+	char host[64];
+	IPAddress server_ip;
+	uint16_t port = server_host(host, sizeof(host));
+	if (!WiFi.hostByName(host, server_ip)) {
+		printf("Could not resolve %s\n", host);
+		return SYNC_FAILED;
+	}
+	struct http_request req = {};
+	req.ip = server_ip;
+	req.port = port;
+	req.method = "POST";
+	req.host = host;
+	req.path = TELEMETRY_PATH;
+	req.headers = "Content-Type: application/octet-stream\r\n";
+	req.body = _telemetry;
+	req.body_len = len;
+	// The last request of the session
+	req.keep_alive = false;
+	req.max_body = 0;
+	req.connect_timeout_ms = HTTP_FETCH_CONNECT_TIMEOUT_MS;
+	req.read_timeout_ms = HTTP_FETCH_READ_TIMEOUT_MS;
+	fetch_run(&req);
+	int status = _fetch.response.status;
+	printf("Telemetry: %u bytes, response code %d%s\n", len, status, _fetch.reused ? " (kept connection)" : "");
+	if (_fetch.state != HTTP_FETCH_DONE) {
+		printf("Telemetry upload failed: %s\n", http_fetch_error_str(&_fetch));
+		return SYNC_FAILED;
+	}
+	if ((status < 200) || (status >= 300)) {
+		return SYNC_FAILED;
+	}
+	metrics_ack();
+	return SYNC_OK;
+}
+
+/*
+ * Firmware update
+ */
+
+// The running image is the old side of a patch; the new one goes to the OTA partition
+static int flash_begin(void *ctx, uint32_t old_size, uint32_t new_size) {
+	if (old_size != ESP.getSketchSize()) {
+		printf("Patch is for a %u byte image, running %u bytes\n", old_size, ESP.getSketchSize());
+		return -1;
+	}
+	return Update.begin(new_size) ? 0 : -1;
+}
+
+static int flash_read_old(void *ctx, uint32_t offset, uint8_t *buf, size_t len) {
+	return ESP.flashRead(offset, buf, len) ? 0 : -1;
+}
+
+static int flash_write_new(void *ctx, const uint8_t *buf, size_t len) {
+	// Long unchanged stretches are copied in one go; keep the watchdog fed
+	yield();
+	return (Update.write((uint8_t *)buf, len) == len) ? 0 : -1;
+}
+
+static const struct delta_io flash_io = { flash_begin, flash_read_old, flash_write_new, NULL };
+
+static void feed_delta(void *ctx, const uint8_t *buf, size_t len) {
+	bool *failed = (bool *)ctx;
+	if (!*failed && delta_patch_feed(&_delta, buf, len)) {
+		*failed = true;
+	}
+}
+
+// Receives a patch from HTTPClient::writeToStream() and applies it as it arrives
+class DeltaSink : public Stream {
+public:
+	bool compressed = false;
+	bool failed = false;
+
+	size_t write(uint8_t c) override {
+		return write(&c, 1);
+	}
+	size_t write(const uint8_t *buf, size_t len) override {
+		if (!compressed) {
+			feed_delta(&failed, buf, len);
+		} else if (hs_decoder_feed(&_decoder, buf, len, feed_delta, &failed)) {
+			failed = true;
+		}
+		// Stop the transfer once the patch is refused
+		return failed ? 0 : len;
+	}
+	int available() override { return 0; }
+	int read() override { return -1; }
+	int peek() override { return -1; }
+};
+
+/** @brief Download a delta patch and apply it to the running image.
+ *
+ * Only a patch made against exactly this image is accepted. The new image
+ * is rebuilt into the OTA partition as the patch arrives and only committed
+ * once it matches its CRC.
+ */
+static uint8_t pull_delta(void) {
+	_http.begin(_client, _update_url);
+	_http.addHeader("Accept-Encoding", HS_CONTENT_ENCODING);
+	const char *patch_headers[] = { "Content-Encoding" };
+	_http.collectHeaders(patch_headers, 1);
+	int httpResponseCode = _http.GET();
+	printf("Patch response code: %d\n", httpResponseCode);
+	if (httpResponseCode != 200) {
+		_http.end();
+		return SYNC_FAILED;
+	}
+
+	DeltaSink sink;
+	sink.compressed = (_http.header("Content-Encoding") == HS_CONTENT_ENCODING);
+	hs_decoder_init(&_decoder);
+	delta_patch_init(&_delta, &flash_io);
+	int written = _http.writeToStream(&sink);
+	_http.end();
+	if (sink.failed || (written < 0) || delta_patch_finish(&_delta)) {
+		if (_delta.error) {
+			printf("Patch not applied: %s\n", _delta.error);
+		} else if (sink.failed) {
+			Serial.println("Patch not applied: corrupt compressed patch");
+		} else {
+			printf("Patch download failed: %s\n", HTTPClient::errorToString(written).c_str());
+		}
+		// Unfinished, so this discards the partial image
+		Update.end();
+		return SYNC_FAILED;
+	}
+	if (!Update.end()) {
+		printf("Update failed: %s\n", Update.getErrorString().c_str());
+		return SYNC_FAILED;
+	}
+	printf("Patched %u byte image, rebooting\n", _delta.new_size);
+	ESP.restart();
+	return SYNC_OK;
+}
+
+/** @brief Pull a flagged firmware image or patch over HTTP.
+ *
+ * Runs after telemetry so the records are uploaded first. URLs ending in
+ * DELTA_PATCH_SUFFIX are applied as delta patches, anything else is a full
+ * image for ESP8266httpUpdate. On success the clock reboots into the new
+ * image and this never returns.
+ */
+static uint8_t pull_update(void) {
+	if (_update != SYNC_UPDATE_PULL) {
+		return SYNC_SKIPPED;
+	}
+	printf("Pulling firmware from %s\n", _update_url);
+	// The image may live on another host than the kept-alive schedule server
+	http_fetch_close(&_fetch);
+	_client.stop();
+	size_t url_len = strlen(_update_url);
+	size_t suffix_len = strlen(DELTA_PATCH_SUFFIX);
+	if ((url_len > suffix_len) && !strcmp(_update_url + url_len - suffix_len, DELTA_PATCH_SUFFIX)) {
+		return pull_delta();
+	}
+	ESPhttpUpdate.rebootOnUpdate(true);
+	t_httpUpdate_return ret = ESPhttpUpdate.update(_client, _update_url);
+	if (ret == HTTP_UPDATE_NO_UPDATES) {
+		Serial.println("Server has no newer firmware");
+		return SYNC_OK;
+	}
+	printf("Firmware update failed (%d): %s\n", ESPhttpUpdate.getLastError(),
+	       ESPhttpUpdate.getLastErrorString().c_str());
+	return SYNC_FAILED;
+}
+
+/*
+ * Session
+ */
+
+// Recorded for the next upload, since the session is over by now
+static void session_done(void) {
+	uint8_t failed = 0;
+	for (uint8_t i = 0; i < SYNC_STAGES; i++) {
+		if (_report.status[i] == SYNC_FAILED) {
+			failed |= (1 << i);
+		}
+	}
+	_report.total_ms = millis() - _session_start_ms;
+	metrics_record(METRIC_SESSION, failed, min(_report.total_ms / METRICS_SESSION_UNIT_MS, (uint32_t)UINT16_MAX));
+	trace_event(TRACE_SYNC_DONE, failed);
+	sync_session_report();
+}
+
+/** @brief Run every network stage for one radio wake.
+ *
+ * A link that is already up (MQTT listening) is reused rather than
+ * associated again. The link is left up when the server asked for an OTA
+ * window (see sync_session_update()); the caller then ends the session
+ * with sync_session_disconnect().
+ *
+ * @param poll: schedule poll policy, updated from the server's response
+ *
+ * @return false if no access point could be reached
+ */
+bool sync_session_run(struct poll_policy *poll) {
+	memset(&_report, 0, sizeof(_report));
+	_session_start_ms = millis();
+	_update = SYNC_UPDATE_NONE;
+	trace_event(TRACE_SYNC_START, 0);
+
+	// While MQTT listens the link is already up, and the session rides it
+	stage_begin(STALL_WIFI);
+	bool reused = wifi_link_is_up() && (WiFi.status() == WL_CONNECTED);
+#ifdef OTW_USE_MQTT
+	if (reused) {
+		mqtt_link_pause();
+	}
+#endif
+	bool associated = reused || wifi_link_up();
+	stage_end(SYNC_ASSOCIATE, reused ? SYNC_SKIPPED : (associated ? SYNC_OK : SYNC_FAILED));
+	uint8_t rssi = associated ? (uint8_t)(-WiFi.RSSI()) : 0;
+	metrics_record(METRIC_WIFI, rssi, min(_report.stage_ms[SYNC_ASSOCIATE], (uint32_t)UINT16_MAX));
+	if (!associated) {
+		session_done();
+		return false;
+	}
+	_connected = true;
+	if (_on_associated) {
+		_on_associated();
+	}
+
+	stage_begin(STALL_DNS);
+	stage_end(SYNC_DNS, resolve());
+
+	stage_begin(STALL_NTP);
+	stage_end(SYNC_TIME, sync_time());
+
+	stage_begin(STALL_SCHEDULE);
+	stage_end(SYNC_SCHEDULE, check_for_new_schedule(poll));
+
+	stage_begin(STALL_CALENDAR);
+	stage_end(SYNC_CALENDAR, check_for_calendar());
+
+	stage_begin(STALL_TELEMETRY);
+	stage_end(SYNC_TELEMETRY, send_telemetry());
+
+	if (_update != SYNC_UPDATE_NONE) {
+		trace_event(TRACE_UPDATE, _update);
+	}
+	stage_begin(STALL_UPDATE);
+	if (!stage_end(SYNC_UPDATE, pull_update())) {
+		trace_event(TRACE_ERROR, TRACE_ERR_UPDATE);
+	}
+
+	if (_update != SYNC_UPDATE_WINDOW) {
+		sync_session_disconnect();
+	}
+	return true;
+}
+
+// Put the radio in its idle state once network work is done
+void sync_session_disconnect(void) {
+	if (!_connected) {
+		return;
+	}
+	_connected = false;
+	stage_begin(STALL_WIFI);
+	http_fetch_close(&_fetch);
+	_client.stop();
+#ifdef OTW_USE_MQTT
+	//Stay associated in modem sleep so pushed schedules arrive in seconds
+	if (mqtt_link_listen()) {
+		Serial.println("\nListening for schedule updates in modem sleep");
+		stage_end(SYNC_DISCONNECT, SYNC_SKIPPED);
+		session_done();
+		return;
+	}
+#endif
+	Serial.println("\nTurning WiFi off to save energy");
+	wifi_link_down();
+	stage_end(SYNC_DISCONNECT, SYNC_OK);
+	session_done();
+}
+
+// Firmware update flagged by the schedule server during the last session
+enum sync_update sync_session_update(void) {
+	return _update;
+}
+
+bool sync_session_time_valid(void) {
+	return _time_valid;
+}
+
+const struct sync_report *sync_session_last(void) {
+	return &_report;
+}
+
+void sync_session_report(void) {
+	static const char status_chars[] = { '-', '+', '!' };
+	char line[160];
+	size_t used = 0;
+	for (uint8_t i = 0; i < SYNC_STAGES; i++) {
+		used += snprintf(line + used, sizeof(line) - used, "%s%c%lu ",
+		                 stage_names[i], status_chars[_report.status[i]],
+		                 (unsigned long)_report.stage_ms[i]);
+		if (used >= sizeof(line)) {
+			break;
+		}
+	}
+	printf("Sync session: %s(ms, + ok, - skipped, ! failed)\n", line);
+	printf("Sync session radio-on: %lu ms\n", (unsigned long)_report.total_ms);
+	wifi_link_report();
+}
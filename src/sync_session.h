@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "poll_policy.h"
+
+/*
+ * All network work for one radio wake, run as a single pass:
+ *
+ *   associate -> DNS -> time -> schedule -> calendar -> telemetry -> update -> disconnect
+ *
+ * Resolved addresses are cached between sessions, the schedule downloads
+ * on the event-driven client (http_fetch.h) while the caller's wait hook
+ * keeps the lights and console going, telemetry goes out on the connection
+ * the schedule left open, and stages with nothing to do are skipped. Each
+ * stage is timed so the radio-on cost of a session can be reported.
+ */
+
+//Default NTP server, until one is set in the config store (see config.h)
+#define NTP_SERVER_NAME "2.north-america.pool.ntp.org"
+#define NTP_LOCAL_PORT 2390
+//How many NTP requests to make before running on the last known time
+#define NTP_ATTEMPTS 5
+//How long to wait for each NTP reply
+#define NTP_TIMEOUT_MS 1000
+//Resync the clock from NTP at most this often
+#define SYNC_TIME_INTERVAL_S 86400
+//Reuse a resolved NTP server address for this long
+#define SYNC_DNS_CACHE_S 86400
+//Longest schedule server URL built from the configured server and a path
+#define SYNC_URL_MAX 128
+//Longest firmware URL accepted from the X-OTW-Update header
+#define SYNC_UPDATE_URL_MAX 128
+//Largest schedule body accepted (the example schedule is 2.4 kB uncompressed)
+#define SYNC_SCHEDULE_MAX_BYTES 16384
+//How often the wait hook runs while the schedule downloads
+#define SYNC_WAIT_SLICE_MS 10
+
+/*
+ * The schedule server flags a pending firmware update with a header on the
+ * schedule response:
+ *
+ *   X-OTW-Update: window [md5]      keep the link up for an ArduinoOTA window
+ *   X-OTW-Update: http://... [md5]  pull the image with ESP8266httpUpdate, or
+ *                                   apply it as a patch if it ends in .otwd
+ *
+ * The flag is ignored when md5 matches the running sketch, so it can be left
+ * set until every clock has updated. Without it the radio goes off as soon
+ * as the session is done.
+ */
+enum sync_update {
+	SYNC_UPDATE_NONE,
+	SYNC_UPDATE_WINDOW,
+	SYNC_UPDATE_PULL
+};
+
+enum sync_stage {
+	SYNC_ASSOCIATE,
+	SYNC_DNS,
+	SYNC_TIME,
+	SYNC_SCHEDULE,
+	SYNC_CALENDAR,
+	SYNC_TELEMETRY,
+	SYNC_UPDATE,
+	SYNC_DISCONNECT,
+	SYNC_STAGES
+};
+
+enum sync_status {
+	SYNC_SKIPPED,
+	SYNC_OK,
+	SYNC_FAILED
+};
+
+struct sync_report {
+	uint32_t stage_ms[SYNC_STAGES];
+	uint8_t status[SYNC_STAGES];
+	uint32_t total_ms;          // radio-on time for the session
+};
+
+typedef void (*sync_hook)(void);
+typedef time_t (*sync_clock)(void);
+
+void sync_session_init(sync_hook on_associated, sync_clock local_time, sync_hook on_wait);
+bool sync_session_run(struct poll_policy *poll);
+void sync_session_disconnect(void);
+enum sync_update sync_session_update(void);
+bool sync_session_time_valid(void);
+const struct sync_report *sync_session_last(void);
+void sync_session_report(void);
@@ -0,0 +1,68 @@
+#include <Arduino.h>
+#include <TimeLib.h>
+#include "trace.h"
+
+// RTC user memory block 0, as addressed by ESP.rtcUserMemoryRead()
+#define RTC_USER_WORDS ((volatile uint32_t *)0x60001200)
+
+// RTC user memory is 128 blocks of 4 bytes
+static_assert(TRACE_RTC_BLOCK + TRACE_RTC_WORDS <= 128, "trace ring does not fit RTC user memory");
+
+static volatile uint32_t *const _rtc = RTC_USER_WORDS + TRACE_RTC_BLOCK;
+static uint8_t _head = 0;
+static uint8_t _count = 0;
+static uint32_t _last = 0;
+
+// One store for the record and one for the header, each a whole word
+static void put(uint32_t record) {
+	uint8_t slot = _head + _count;
+	if (slot >= TRACE_RECORDS) {
+		slot -= TRACE_RECORDS;
+	}
+	_rtc[1 + slot] = record;
+	if (_count < TRACE_RECORDS) {
+		_count++;
+	} else if (++_head == TRACE_RECORDS) {
+		_head = 0;
+	}
+	_rtc[0] = TRACE_HEADER(_head, _count);
+}
+
+/** @brief Pick up the ring left in RTC memory and record the boot.
+ *
+ * After a power cycle RTC memory holds garbage; the header check catches
+ * that and the ring starts empty.
+ */
+void trace_init(void) {
+	uint32_t header = _rtc[0];
+	if (TRACE_VALID(header)) {
+		_head = TRACE_HEAD_OF(header);
+		_count = TRACE_COUNT_OF(header);
+	} else {
+		_head = 0;
+		_count = 0;
+	}
+	_last = 0;
+	struct rst_info *reset = ESP.getResetInfoPtr();
+	trace_event(TRACE_BOOT, reset ? reset->reason : 0);
+}
+
+void trace_event(uint8_t id, uint8_t arg) {
+	uint32_t t = now();
+	// First event since boot, a new high half, or the clock went back
+	if (!_last || ((t ^ _last) >> 16) || (t < _last)) {
+		put(TRACE_RECORD(t >> 16, TRACE_TIME, 0));
+	}
+	_last = t;
+	put(TRACE_RECORD(t, id, arg));
+}
+
+// The raw ring, oldest record first, for utility/otw_trace_decode.cpp
+void trace_dump(void) {
+	printf("TRACE %08x", _rtc[0]);
+	for (uint8_t i = 0; i < _count; i++) {
+		uint8_t slot = (_head + i) % TRACE_RECORDS;
+		printf("%s%08x", ((i + 1) % 8) ? " " : "\nTRACE ", _rtc[1 + slot]);
+	}
+	printf("\n%u trace records, decode with utility/otw_trace_decode.cpp\n", _count);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Event trace in RTC memory, for working out in the morning what a clock
+ * did overnight.
+ *
+ * Each event is one 32 bit word written straight to RTC user memory, so
+ * recording one costs a few stores and the trace stays on in production.
+ * RTC memory survives soft resets, watchdog resets and deep sleep (not a
+ * power cycle). The ring holds TRACE_RECORDS events, about a day of
+ * hourly polling; the oldest are overwritten.
+ *
+ * Record:  bits 0..15 UTC seconds (low half), 16..23 event id, 24..31 arg
+ * Header:  bits 0..7 count, 8..15 index of the oldest record, 16..31 magic
+ *
+ * A TRACE_TIME record carries the high half of the UTC time instead, and
+ * is written whenever the high half changes or the clock is set, so the
+ * decoder can rebuild full timestamps. Events before the clock is set from
+ * NTP carry the time the clock was started from (its build time).
+ *
+ * The console's trace command prints the ring as TRACE lines, which
+ * utility/otw_trace_decode.cpp turns into a timeline.
+ *
+ * RTC user memory blocks 80..127 (after the metrics ring, see metrics.h).
+ */
+
+#define TRACE_RTC_BLOCK 80
+#define TRACE_RTC_WORDS 48
+#define TRACE_RECORDS (TRACE_RTC_WORDS - 1)
+#define TRACE_MAGIC 0x5254 // "TR"
+
+#define TRACE_RECORD(time, id, arg) \
+	(((uint32_t)(time) & 0xFFFF) | ((uint32_t)(id) << 16) | ((uint32_t)(arg) << 24))
+#define TRACE_TIME_OF(r) ((r) & 0xFFFF)
+#define TRACE_ID_OF(r) (((r) >> 16) & 0xFF)
+#define TRACE_ARG_OF(r) ((r) >> 24)
+
+#define TRACE_HEADER(head, count) (((uint32_t)TRACE_MAGIC << 16) | ((uint32_t)(head) << 8) | (count))
+#define TRACE_HEAD_OF(h) (((h) >> 8) & 0xFF)
+#define TRACE_COUNT_OF(h) ((h) & 0xFF)
+#define TRACE_VALID(h) \
+	((((h) >> 16) == TRACE_MAGIC) && (TRACE_HEAD_OF(h) < TRACE_RECORDS) && (TRACE_COUNT_OF(h) <= TRACE_RECORDS))
+
+// Ids are decoded by utility/otw_trace_decode.cpp: only ever add to the end
+enum trace_id {
+	TRACE_TIME,         // time field: high half of the UTC time
+	TRACE_BOOT,         // arg: reset reason (rst_info.reason)
+	TRACE_STATE,        // arg: new light state (sched_events)
+	TRACE_FORCED,       // arg: state forced from the console, E_UNKNOWN when released
+	TRACE_DAY,          // arg: day of week (0 = monday), bit 7 set for a calendar exception
+	TRACE_SYNC_START,
+	TRACE_SYNC_DONE,    // arg: mask of failed sync stages (1 << sync_stage)
+	TRACE_CLOCK,        // arg: NTP requests sent; the clock was set
+	TRACE_SCHEDULE,     // arg: low byte of the new schedule's CRC
+	TRACE_UPDATE,       // arg: sync_update about to be applied
+	TRACE_ERROR,        // arg: trace_error
+	TRACE_STALL,        // arg: stall_region that held the loop longest
+	TRACE_IDS
+};
+
+enum trace_error {
+	TRACE_ERR_CONFIG,   // config store unreadable, running on defaults
+	TRACE_ERR_UPDATE,   // firmware update failed
+	TRACE_ERRORS
+};
+
+void trace_init(void);
+void trace_event(uint8_t id, uint8_t arg);
+void trace_dump(void);
@@ -7,11 +7,22 @@
 #include <CRC32.h>
 #include "cJSON.h"
 #include "wake_schedule.h"
+#include "schedule_store.h"
+#include "calendar.h"
+#include "schedule_stream.h"
+#include "default_schedule.h"
 
 char payload[] = "# Start with Monday\n# Format: blue, green, off, red\n# example: 0600|0615|0645|0700\n0600|0615|0645|0700\n0600|0615|0645|0700\n0600|0615|0645|0700\n0600|0615|0645|0700\n0600|0615|0645|0700\n0615|0630|0700|1900\n0615|0630|0700|1900";
 
 struct otw_week _otw_week_schedule;
 
+// Schedule in effect for the date chosen by otw_select_date()
+struct otw_week _otw_date_week;
+struct otw_week *_otw_effective = &_otw_week_schedule;
+int _otw_date_dow = -1;
+int16_t _otw_date_offset = 0;
+int _otw_date_key = -1;
+
 const char *otw_event_str[E_MAX] = {
     DOZE_STR,
     WAKE_STR,
@@ -20,47 +31,106 @@ const char *otw_event_str[E_MAX] = {
     UNKNOWN_STR
 };
 
-void write_week_to_eeprom(struct otw_week *w) {
-	EEPROM.put(0, *w);
-	EEPROM.commit();
-}
-
 uint32_t calc_week_crc(struct otw_week *w) {
 	return CRC32::calculate((uint8_t *)&(w->dow), sizeof(w->dow));
 }
 
 void load_from_eeprom(struct otw_week *w) {
-	EEPROM.begin(64);
-	EEPROM.get(0, *w);
-	uint32_t crc = calc_week_crc(w);
-
-	if (crc != w->crc) {
+	if (store_load_profile(store_active_slot(), w)) {
 		Serial.println("CRC mismatch, restoring default schedule in EEPROM");
 		use_default_week(w);
-		write_week_to_eeprom(w);
+		store_save_profile(store_active_name(), w);
 	} else {
-		Serial.println("Loaded schedule from EEPROM");
+		printf("Loaded schedule profile '%s' from EEPROM\n", store_active_name());
 	}
 	print_schedule_struct(w);
+	otw_reselect_date();
+}
+
+// Look up today's calendar exception again on the next otw_select_date()
+void otw_reselect_date(void) {
+	_otw_date_key = -1;
 }
 
 void otw_init(void) {
+	store_init();
 	load_from_eeprom(&_otw_week_schedule);
+	calendar_init();
 }
 
-void use_default_week(struct otw_week *sched) {
-	for (uint8_t i = 0; i<7; i++) {
-		sched->dow[i].doze.hour = DEFAULT_DOZE_H;
-		sched->dow[i].doze.minute = DEFAULT_DOZE_M;
-		sched->dow[i].wake.hour = DEFAULT_WAKE_H;
-		sched->dow[i].wake.minute = DEFAULT_WAKE_M;
-		sched->dow[i].day.hour = DEFAULT_OFF_H;
-		sched->dow[i].day.minute = DEFAULT_OFF_M;
-		sched->dow[i].sleep.hour = DEFAULT_SLEEP_H;
-		sched->dow[i].sleep.minute = DEFAULT_SLEEP_M;
+/** @brief Apply any exception calendar entry for today's date.
+ *
+ * Called every pass through the main loop; the calendar is only consulted
+ * when the date changes. An override either swaps in another stored profile
+ * for the day, shifts the morning (doze, wake, day) times, or both.
+ *
+ * @param year: local calendar year
+ * @param doy: zero-based day of the year
+ * @param dow: day of the week [0..6] beginning with Monday
+ */
+// The offset moves doze, wake and day but not sleep
+static bool day_offset_fits(const struct otw_day *d, int offset) {
+	int doze = (d->doze.hour * 60) + d->doze.minute + offset;
+	int day = (d->day.hour * 60) + d->day.minute + offset;
+	return (doze >= 0) && (day <= (d->sleep.hour * 60) + d->sleep.minute);
+}
+
+/** @brief Whether a calendar offset keeps doze after midnight and day before sleep.
+ *
+ * @param profile: profile the exception names, "" for the active one. One
+ *        not stored yet passes; its offset is checked once it is selected.
+ * @param dow: day of the week the exception falls on, Monday 0
+ */
+bool otw_offset_fits(const char *profile, int dow, int offset) {
+	if ((offset < -24 * 60) || (offset > 24 * 60)) {
+		return false;
+	}
+	const struct otw_week *w = &_otw_week_schedule;
+	struct otw_week stored;
+	int slot = profile[0] ? store_find_profile(profile) : -1;
+	if (profile[0] && (slot < 0)) {
+		return true;
+	}
+	if ((slot >= 0) && (slot != store_active_slot()) && (store_load_profile(slot, &stored) == 0)) {
+		w = &stored;
+	}
+	return day_offset_fits(&w->dow[dow], offset);
+}
+
+void otw_select_date(int year, int doy, int dow) {
+	int key = (year * 400) + doy;
+	if (key == _otw_date_key) {
+		return;
+	}
+	_otw_date_key = key;
+	_otw_date_dow = dow;
+	_otw_date_offset = 0;
+	_otw_effective = &_otw_week_schedule;
+
+	const struct cal_override *ov = calendar_lookup(year, doy);
+	if (ov == NULL) {
+		return;
 	}
+	int slot = ov->profile[0] ? store_find_profile(ov->profile) : -1;
+	if ((slot >= 0) && (slot != store_active_slot())) {
+		if (store_load_profile(slot, &_otw_date_week) == 0) {
+			_otw_effective = &_otw_date_week;
+		}
+	}
+	// Checked when the calendar was stored, unless its profile came later
+	if (!day_offset_fits(&_otw_effective->dow[dow], ov->offset)) {
+		printf("Calendar offset %d does not fit today's schedule, ignoring it\n", ov->offset);
+	} else {
+		_otw_date_offset = ov->offset;
+	}
+	printf("Calendar exception today: profile '%s' offset %d\n",
+	       store_profile_name((_otw_effective == &_otw_date_week) ? slot : store_active_slot()),
+	       _otw_date_offset);
+}
 
-	sched->crc = calc_week_crc(sched);
+// Copy the schedule compiled in at build time, CRC included
+void use_default_week(struct otw_week *sched) {
+	memcpy_P(sched, &default_schedule, sizeof(*sched));
 }
 
 int validate_time(char tens, char ones, uint8_t max) {
@@ -124,9 +194,7 @@ void print_schedule(void) {
 const char *json_week[7] = { JSON_MON, JSON_TUE, JSON_WED, JSON_THU, JSON_FRI, JSON_SAT, JSON_SUN };
 const char *json_event[4] = { JSON_DOZE, JSON_WAKE, JSON_DAY, JSON_SLEEP };
 
-int parse_schedule_json(struct otw_week *w, const char *payload, uint16_t len) {
-    cJSON *sched_json = cJSON_Parse(payload);
-
+static int parse_week_json(struct otw_week *w, const cJSON *sched_json) {
     const cJSON *day;
     const cJSON *event;
     const cJSON *hour;
@@ -158,6 +226,10 @@ int parse_schedule_json(struct otw_week *w, const char *payload, uint16_t len) {
 			hour = cJSON_GetObjectItemCaseSensitive(event, JSON_HOURS);
 			minute = cJSON_GetObjectItemCaseSensitive(event, JSON_MINUTES);
 
+			if (!cJSON_IsNumber(hour) || !cJSON_IsNumber(minute)) {
+				Serial.println("Failed to parse");
+				return -1;
+			}
 			ts->hour = hour->valueint;
 			ts->minute = minute->valueint;
 		}
@@ -166,44 +238,131 @@ int parse_schedule_json(struct otw_week *w, const char *payload, uint16_t len) {
 	return 0;
 }
 
+int parse_schedule_json(struct otw_week *w, const char *payload, uint16_t len) {
+	cJSON *sched_json = cJSON_ParseWithLength(payload, len);
+	int err = parse_week_json(w, sched_json);
+	cJSON_Delete(sched_json);
+	return err;
+}
+
+/** @brief Switch the active schedule to a stored profile.
+ *
+ * @return 0 on success, -1 if no profile has that name
+ */
+int select_schedule_profile(const char *name)
+{
+	int slot = store_find_profile(name);
+	if (slot < 0) {
+		printf("Unknown profile: %s\n", name);
+		return -1;
+	}
+	if (slot == store_active_slot()) {
+		Serial.println("Requested profile is already active.");
+		return 0;
+	}
+	printf("Switching to schedule profile '%s'\n", name);
+	store_select_profile(name);
+	load_from_eeprom(&_otw_week_schedule);
+	return 0;
+}
+
+/** @brief Process a schedule document from the server.
+ *
+ * The document may be:
+ *  - a full week, stored in the active profile
+ *  - a full week plus "profile": name, stored under that name and made
+ *    active unless "activate" is false
+ *  - only "profile": name, a command switching to an already stored profile
+ */
 int ingest_schedule(const char *payload, uint16_t len)
 {
-	struct otw_week new_week;
-	int err = parse_schedule_json(&new_week, payload, len);
-	
-	if (err) {
-		return err;
-	}
-		
-	new_week.crc = calc_week_crc(&new_week);
-	if (new_week.crc != _otw_week_schedule.crc) {
-		Serial.println("Saving new schedule to EEPROM");
-		write_week_to_eeprom(&new_week);	
-		load_from_eeprom(&_otw_week_schedule);
-	} else {
+	struct sched_stream s;
+	sched_stream_init(&s);
+	sched_stream_feed(&s, (const uint8_t *)payload, len);
+	return ingest_schedule_stream(&s);
+}
+
+/** @brief Act on a schedule document fed through sched_stream_feed().
+ *
+ * Same rules as ingest_schedule(), for callers that parse the download as
+ * it arrives.
+ */
+int ingest_schedule_stream(struct sched_stream *s)
+{
+	int kind = sched_stream_finish(s);
+	if (kind == SCHED_STREAM_ERROR) {
+		Serial.println("Failed to parse");
+		return -1;
+	}
+
+	// Copied, as store_active_name() follows the active slot
+	char name[STORE_NAME_LEN];
+	const char *requested = (s->profile[0] != '\0') ? s->profile : store_active_name();
+	if (!store_valid_name(requested)) {
+		printf("Bad profile name, 1 to %u characters\n", STORE_NAME_LEN - 1);
+		return -1;
+	}
+	strcpy(name, requested);
+
+	if (kind == SCHED_STREAM_COMMAND) {
+		return select_schedule_profile(name);
+	}
+	Serial.println("Successfully processed JSON schedule");
+
+	struct otw_week *new_week = &s->week;
+	bool make_active = (s->activate != 0);
+
+	new_week->crc = calc_week_crc(new_week);
+	struct otw_week stored_week;
+	bool changed = true;
+	int slot = store_find_profile(name);
+	if ((slot >= 0) && (store_load_profile(slot, &stored_week) == 0) &&
+	    (stored_week.crc == new_week->crc)) {
 		Serial.println("Received schedule matches stored schedule.");
+		changed = false;
+	} else {
+		printf("Saving new schedule to EEPROM as profile '%s'\n", name);
+		if (store_save_profile(name, new_week) < 0) {
+			return -1;
+		}
+		// Today's exception may name this profile
+		otw_reselect_date();
 	}
 
+	if (strcmp(name, store_active_name()) != 0) {
+		return make_active ? select_schedule_profile(name) : 0;
+	}
+	if (changed) {
+		load_from_eeprom(&_otw_week_schedule);
+	}
 	return 0;
 }
 
 int sched_to_big_time(int dow, enum sched_events ev)
 {
+  // Exceptions only apply to the date selected by otw_select_date()
+  struct otw_week *w = &_otw_week_schedule;
+  int offset = 0;
+  if (dow == _otw_date_dow) {
+    w = _otw_effective;
+    offset = _otw_date_offset;
+  }
+
   switch(ev) {
     case E_DOZE:
-        return (_otw_week_schedule.dow[dow].doze.hour*60) + _otw_week_schedule.dow[dow].doze.minute;
+        return (w->dow[dow].doze.hour*60) + w->dow[dow].doze.minute + offset;
         break;
 
     case E_WAKE:
-        return (_otw_week_schedule.dow[dow].wake.hour*60) + _otw_week_schedule.dow[dow].wake.minute;
+        return (w->dow[dow].wake.hour*60) + w->dow[dow].wake.minute + offset;
         break;
 
     case E_DAY:
-        return (_otw_week_schedule.dow[dow].day.hour*60) + _otw_week_schedule.dow[dow].day.minute;
+        return (w->dow[dow].day.hour*60) + w->dow[dow].day.minute + offset;
         break;
 
     case E_SLEEP:
-        return (_otw_week_schedule.dow[dow].sleep.hour*60) + _otw_week_schedule.dow[dow].sleep.minute;
+        return (w->dow[dow].sleep.hour*60) + w->dow[dow].sleep.minute;
         break;
     default:
         //FIXME: This should never happen, but if it does it's an unhandled exception
@@ -212,6 +371,65 @@ int sched_to_big_time(int dow, enum sched_events ev)
   return 0;
 }
 
+/** @brief Choose the light state for a time of day.
+ *
+ * @param dow: day of the week (0-6, Monday first)
+ * @param rn: minutes since midnight
+ * @param current: state to keep when no window matches
+ */
+enum sched_events sched_state_at(int dow, int rn, enum sched_events current)
+{
+  int doze = sched_to_big_time(dow, E_DOZE);
+  int wake = sched_to_big_time(dow, E_WAKE);
+  int day = sched_to_big_time(dow, E_DAY);
+  int sleep = sched_to_big_time(dow, E_SLEEP);
+
+  //Day = <Sleep and >Day
+  //FIXME: Ths assumes E_SLEEP will start at night and not in the early morning (eg: 00:12 for 12:12am would trip this up)
+  if ((rn >= day) && (rn < sleep)) {
+    return E_DAY;
+  }
+  //Doze = <Wake and >=Doze
+  if ((rn >= doze) && (rn < wake)) {
+    return E_DOZE;
+  }
+  //Wake = <Day and >=Wake
+  if ((rn >= wake) && (rn < day)) {
+    return E_WAKE;
+  }
+  //Sleep = <Doze and >=Sleep
+  if ((rn >= sleep) || (rn < doze)) {
+    return E_SLEEP;
+  }
+  return current;
+}
+
+/** @brief Find the night around a time, from the sleep event to the next wake.
+ *
+ * Both ends are in seconds from the given day's midnight, so start_s is
+ * negative after midnight and end_s is past 86400 before it. The other
+ * day's times come from the weekly schedule without calendar exceptions;
+ * those apply once that day is selected with otw_select_date().
+ *
+ * @param dow: day of the week (0-6, Monday first)
+ * @param now_s: seconds since midnight
+ */
+void sched_night_span(int dow, int32_t now_s, int32_t *start_s, int32_t *end_s)
+{
+  int32_t sleep_s = (int32_t)sched_to_big_time(dow, E_SLEEP) * 60;
+  if (now_s >= sleep_s) {
+    *start_s = sleep_s;
+    *end_s = ((int32_t)sched_to_big_time((dow + 1) % 7, E_WAKE) + (24 * 60)) * 60;
+  } else {
+    *start_s = ((int32_t)sched_to_big_time((dow + 6) % 7, E_SLEEP) - (24 * 60)) * 60;
+    *end_s = (int32_t)sched_to_big_time(dow, E_WAKE) * 60;
+  }
+}
+
+uint32_t get_schedule_crc(void) {
+    return _otw_week_schedule.crc;
+}
+
 const char *get_event_str(uint8_t idx) {
     if (idx >= E_MAX) {
         return otw_event_str[E_UNKNOWN];
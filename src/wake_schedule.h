@@ -1,8 +1,16 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
-#define SCHEDULE_SERVER_PATH_JSON "http://192.168.1.105/download/okay_to_wake.json"
+//Default server, until one is set in the config store (see config.h)
+//Override with -D SCHEDULE_SERVER_HOST='"http://host:port"' in build_flags
+#ifndef SCHEDULE_SERVER_HOST
+#define SCHEDULE_SERVER_HOST "http://192.168.1.105"
+#endif
+#define SCHEDULE_PATH_JSON "/download/okay_to_wake.json"
+//Each clock asks for its own document by chip ID first (see sync_session.cpp)
+#define SCHEDULE_PATH_DEVICE "/download/%06x/okay_to_wake.json"
 
 struct otw_time {
 	uint8_t hour;
@@ -21,14 +29,7 @@ struct otw_week {
     uint32_t crc;
 };
 
-#define DEFAULT_DOZE_H 6
-#define DEFAULT_DOZE_M 15
-#define DEFAULT_WAKE_H 6
-#define DEFAULT_WAKE_M 30
-#define DEFAULT_OFF_H 7
-#define DEFAULT_OFF_M 0
-#define DEFAULT_SLEEP_H 18
-#define DEFAULT_SLEEP_M 45
+// The fallback schedule is compiled into default_schedule.h by utility/embed_schedule.py
 
 enum sched_events {
     E_DOZE,
@@ -39,6 +40,12 @@ enum sched_events {
     E_MAX
 };
 
+struct sched_stream;
+
+// Top-level and per-day JSON keys, indexed by day [0..6] and sched_events
+extern const char *json_week[7];
+extern const char *json_event[4];
+
 #define DOZE_STR "Doze"
 #define WAKE_STR "Wake"
 #define DAY_STR "Day"
@@ -46,11 +53,21 @@ enum sched_events {
 #define UNKNOWN_STR "State Out-of-Bounds"
 
 int parse_schedule(struct otw_week *w, const char *payload, uint16_t len);
+int parse_schedule_json(struct otw_week *w, const char *payload, uint16_t len);
 int ingest_schedule(const char *payload, uint16_t len);
+int ingest_schedule_stream(struct sched_stream *s);
+int select_schedule_profile(const char *name);
+uint32_t calc_week_crc(struct otw_week *w);
 void use_default_week(struct otw_week *sched);
 void print_schedule_struct(struct otw_week *w);
 void print_schedule(void);
 int sched_to_big_time(int day, enum sched_events ev);
+enum sched_events sched_state_at(int dow, int rn, enum sched_events current);
+void sched_night_span(int dow, int32_t now_s, int32_t *start_s, int32_t *end_s);
 const char *get_event_str(uint8_t idx);
+uint32_t get_schedule_crc(void);
 void otw_init(void);
+void otw_select_date(int year, int doy, int dow);
+void otw_reselect_date(void);
+bool otw_offset_fits(const char *profile, int dow, int offset);
 void load_from_eeprom(struct otw_week *w);
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include <ESP8266WiFiMulti.h>
+#include "credentials.h"
+#include "energy.h"
+#include "wifi_link.h"
+
+// Declare object for multi WiFi access point connection
+ESP8266WiFiMulti wifiMulti;
+
+static bool _radio_awake = true;
+static bool _link_up = false;
+static uint32_t _radio_wake_ms = 0;
+static uint32_t _radio_on_total_ms = 0;
+static uint32_t _radio_on_outage_ms = 0;
+static uint8_t _failed_rounds = 0;
+
+static void radio_sleep(bool connected) {
+	uint32_t elapsed = millis() - _radio_wake_ms;
+	_radio_on_total_ms += elapsed;
+	if (!connected) {
+		_radio_on_outage_ms += elapsed;
+	}
+	WiFi.forceSleepBegin();
+	energy_set_radio(&device_energy, millis(), ENERGY_RADIO_OFF);
+	_radio_awake = false;
+	_link_up = false;
+}
+
+void wifi_link_init(void) {
+	/* Explicitly set the ESP8266 to be a WiFi-client, otherwise, it by default,
+	   would try to act as both a client and an access-point and could cause
+	   network-issues with your other WiFi-devices on your WiFi-network. */
+	WiFi.mode(WIFI_STA);
+
+	wifiMulti.addAP(STASSID1, STAPSK1);
+	wifiMulti.addAP(STASSID2, STAPSK2);
+
+	_radio_awake = true;
+	_radio_wake_ms = millis();
+}
+
+/** @brief Bring the WiFi link up using a bounded number of attempts.
+ *
+ * If no access point answers after WIFI_CONNECT_ATTEMPTS tries the radio is
+ * put to sleep immediately and the backoff used by wifi_link_retry_minutes()
+ * is doubled. The caller is expected to keep running from the last known time
+ * and stored schedule until the next retry.
+ *
+ * @return true if connected, false if the radio was put back to sleep
+ */
+bool wifi_link_up(void) {
+	if (!_radio_awake) {
+		WiFi.forceSleepWake();
+		energy_set_radio(&device_energy, millis(), ENERGY_RADIO_ACTIVE);
+		_radio_awake = true;
+		_radio_wake_ms = millis();
+	}
+
+	Serial.print("\nConnecting to WiFi...");
+	for (uint8_t i = 0; i < WIFI_CONNECT_ATTEMPTS; i++) {
+		if (wifiMulti.run(WIFI_CONNECT_TIMEOUT_MS) == WL_CONNECTED) {
+			WiFi.hostname("Okay-to-Wake");
+			Serial.println("");
+			Serial.println("WiFi connected");
+			Serial.println("IP address: ");
+			Serial.println(WiFi.localIP());
+			_link_up = true;
+			_failed_rounds = 0;
+			return true;
+		}
+		Serial.print(".");
+	}
+
+	Serial.println("\nWiFi unavailable, sleeping radio until next retry");
+	if (_failed_rounds < 16) {
+		_failed_rounds++;
+	}
+	radio_sleep(false);
+	wifi_link_report();
+	return false;
+}
+
+void wifi_link_down(void) {
+	if (!_radio_awake) {
+		return;
+	}
+	radio_sleep(_link_up);
+}
+
+bool wifi_link_is_up(void) {
+	return _link_up;
+}
+
+/** @brief Minutes to wait before the next connection attempt.
+ *
+ * Doubles with every consecutive failed round starting at
+ * WIFI_BACKOFF_MIN_MINUTES and is capped at WIFI_BACKOFF_MAX_MINUTES.
+ */
+uint32_t wifi_link_retry_minutes(void) {
+	uint32_t minutes = WIFI_BACKOFF_MIN_MINUTES;
+	for (uint8_t i = 1; i < _failed_rounds; i++) {
+		minutes *= 2;
+		if (minutes >= WIFI_BACKOFF_MAX_MINUTES) {
+			return WIFI_BACKOFF_MAX_MINUTES;
+		}
+	}
+	return minutes;
+}
+
+uint32_t wifi_link_radio_on_ms(void) {
+	if (_radio_awake) {
+		return _radio_on_total_ms + (millis() - _radio_wake_ms);
+	}
+	return _radio_on_total_ms;
+}
+
+uint32_t wifi_link_outage_ms(void) {
+	return _radio_on_outage_ms;
+}
+
+void wifi_link_report(void) {
+	Serial.printf("Radio-on time: %lu ms total, %lu ms during outages\n",
+	              (unsigned long)wifi_link_radio_on_ms(),
+	              (unsigned long)wifi_link_outage_ms());
+}
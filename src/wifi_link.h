@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//How long a single wifiMulti.run() attempt may block
+#define WIFI_CONNECT_TIMEOUT_MS 10000
+//How many attempts are made before the radio is put back to sleep
+#define WIFI_CONNECT_ATTEMPTS 3
+//Backoff between failed connection rounds, doubling up to the max
+#define WIFI_BACKOFF_MIN_MINUTES 1
+#define WIFI_BACKOFF_MAX_MINUTES 240
+
+void wifi_link_init(void);
+bool wifi_link_up(void);
+void wifi_link_down(void);
+bool wifi_link_is_up(void);
+uint32_t wifi_link_retry_minutes(void);
+uint32_t wifi_link_radio_on_ms(void);
+uint32_t wifi_link_outage_ms(void);
+void wifi_link_report(void);
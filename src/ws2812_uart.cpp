@@ -0,0 +1,29 @@
+#include "ws2812_uart.h"
+
+// Indexed by two WS2812 bits, first bit sent in bit 1. Data bits go out LSB
+// first and inverted: 1 holds the line low, 0 holds it high.
+static const uint8_t bit_pairs[4] = {
+	0x37, // 0 0: H L L L  H L L L
+	0x07, // 0 1: H L L L  H H H L
+	0x34, // 1 0: H H H L  H L L L
+	0x04  // 1 1: H H H L  H H H L
+};
+
+/** @brief Expand bytes into UART bytes that draw their WS2812 waveform.
+ *
+ * @param data: bytes in strip order (eg: GRB per pixel), MSB sent first
+ * @param out: room for len * WS2812_UART_EXPAND bytes
+ *
+ * @return bytes written to out
+ */
+size_t ws2812_uart_encode(const uint8_t *data, size_t len, uint8_t *out) {
+	uint8_t *p = out;
+	for (size_t i = 0; i < len; i++) {
+		uint8_t b = data[i];
+		*p++ = bit_pairs[(b >> 6) & 3];
+		*p++ = bit_pairs[(b >> 4) & 3];
+		*p++ = bit_pairs[(b >> 2) & 3];
+		*p++ = bit_pairs[b & 3];
+	}
+	return p - out;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * WS2812 bitstream encoding for a UART.
+ *
+ * With the TX line inverted and 6N1 framing at 3.2 Mbaud, one UART byte is
+ * eight 312.5 ns slots (start, six data bits, stop) and carries two WS2812
+ * bits: each starts with a high slot and ends with a low one, and the data
+ * bits in between stretch the high part for a 1. A 0 is 312 ns high and
+ * 938 ns low; a 1 is 938 ns high and 312 ns low.
+ *
+ * Portable: no Arduino dependencies, so host tools can check the timing.
+ */
+
+#define WS2812_UART_BAUD 3200000
+// UART bytes per data byte (two WS2812 bits each)
+#define WS2812_UART_EXPAND 4
+// Low time that latches a frame; newer WS2812B parts need more than 280 us
+#define WS2812_RESET_US 300
+
+size_t ws2812_uart_encode(const uint8_t *data, size_t len, uint8_t *out);
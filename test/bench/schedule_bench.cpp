@@ -0,0 +1,366 @@
+/*
+    Micro-benchmarks for the scheduling core
+
+    Times the code every loop pass, LED frame and schedule download goes
+    through and counts its heap allocations, then compares both against the
+    checked-in baseline. A regression is an operation more than --threshold
+    percent slower than its baseline, or one that allocates more.
+
+    Each operation runs in --runs batches and the fastest batch is reported:
+    interruptions and frequency changes only ever add time, so the minimum
+    is the most repeatable figure. Serial output is sent to
+    /dev/null while timing so print_schedule_struct() measures formatting
+    rather than the terminal.
+
+    Build and run on the host (from the repository root):
+
+        pio run -e native-bench -t exec
+
+    which compares against test/bench/baseline.txt. After an intended
+    change, or on a new machine, record a new baseline with:
+
+        .pio/build/native-bench/program --write-baseline
+
+    Options:
+        --baseline FILE     baseline to compare with or write (test/bench/baseline.txt)
+        --write-baseline    save the results as the new baseline
+        --threshold PCT     allowed slowdown in percent (25)
+        --runs N            batches per operation (11)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include <Timezone.h>
+#include "cJSON.h"
+#include "led_limit.h"
+#include "wake_schedule.h"
+
+using steady = std::chrono::steady_clock;
+
+struct options {
+	const char *baseline = "test/bench/baseline.txt";
+	bool write_baseline = false;
+	int threshold = 25;
+	int runs = 11;
+};
+
+static options opt;
+
+// Results are accumulated here so the timed loops are not optimized away
+static volatile uint32_t sink_total;
+
+// Heap allocations made by cJSON (through its hooks) and by operator new
+static size_t allocations;
+
+static void *count_malloc(size_t size) {
+	allocations++;
+	return malloc(size);
+}
+
+void *operator new(size_t size) {
+	allocations++;
+	void *p = malloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+static const char schedule_doc[] =
+	"{\"monday\":{\"doze\":{\"hours\":5,\"minutes\":45},\"wake\":{\"hours\":6,\"minutes\":0},"
+	"\"day\":{\"hours\":6,\"minutes\":15},\"sleep\":{\"hours\":19,\"minutes\":15}},"
+	"\"tuesday\":{\"doze\":{\"hours\":5,\"minutes\":45},\"wake\":{\"hours\":6,\"minutes\":0},"
+	"\"day\":{\"hours\":6,\"minutes\":15},\"sleep\":{\"hours\":19,\"minutes\":15}},"
+	"\"wednesday\":{\"doze\":{\"hours\":5,\"minutes\":45},\"wake\":{\"hours\":6,\"minutes\":0},"
+	"\"day\":{\"hours\":6,\"minutes\":15},\"sleep\":{\"hours\":19,\"minutes\":15}},"
+	"\"thursday\":{\"doze\":{\"hours\":5,\"minutes\":45},\"wake\":{\"hours\":6,\"minutes\":0},"
+	"\"day\":{\"hours\":6,\"minutes\":15},\"sleep\":{\"hours\":19,\"minutes\":15}},"
+	"\"friday\":{\"doze\":{\"hours\":5,\"minutes\":45},\"wake\":{\"hours\":6,\"minutes\":0},"
+	"\"day\":{\"hours\":6,\"minutes\":15},\"sleep\":{\"hours\":19,\"minutes\":15}},"
+	"\"saturday\":{\"doze\":{\"hours\":6,\"minutes\":30},\"wake\":{\"hours\":7,\"minutes\":0},"
+	"\"day\":{\"hours\":7,\"minutes\":30},\"sleep\":{\"hours\":19,\"minutes\":30}},"
+	"\"sunday\":{\"doze\":{\"hours\":6,\"minutes\":30},\"wake\":{\"hours\":7,\"minutes\":0},"
+	"\"day\":{\"hours\":7,\"minutes\":30},\"sleep\":{\"hours\":19,\"minutes\":15}}}";
+
+// Same rules as main.cpp
+static TimeChangeRule CENTRAL_DST = {"CDT", Second, Sun, Mar, 2, -300};
+static TimeChangeRule CENTRAL_STD = {"CST", First, Sun, Nov, 2, -360};
+static Timezone bench_tz(CENTRAL_DST, CENTRAL_STD);
+
+#define WEEK_MINUTES (7 * 24 * 60)
+// 2024-01-01 00:00 UTC
+#define BENCH_EPOCH 1704067200UL
+
+static struct otw_week bench_week;
+
+static void op_parse_schedule_json(void) {
+	struct otw_week w;
+	parse_schedule_json(&w, schedule_doc, sizeof(schedule_doc) - 1);
+	sink_total += w.dow[6].sleep.minute;
+}
+
+// Unchanged schedule: the steady state of every poll that downloads a body
+static void op_ingest_schedule(void) {
+	sink_total += ingest_schedule(schedule_doc, sizeof(schedule_doc) - 1);
+}
+
+static void op_calc_week_crc(void) {
+	sink_total += calc_week_crc(&bench_week);
+}
+
+// Every event for every minute of the week
+static void op_sched_to_big_time(void) {
+	for (int m = 0; m < WEEK_MINUTES; m++) {
+		int dow = m / (24 * 60);
+		for (int ev = E_DOZE; ev <= E_SLEEP; ev++) {
+			sink_total += sched_to_big_time(dow, (enum sched_events)ev);
+		}
+	}
+}
+
+// One conversion per hour across a year, crossing both DST changes
+static void op_to_local(void) {
+	for (uint32_t h = 0; h < 365 * 24; h++) {
+		sink_total += bench_tz.toLocal(BENCH_EPOCH + (h * 3600UL));
+	}
+}
+
+static void op_print_schedule_struct(void) {
+	print_schedule_struct(&bench_week);
+}
+
+// The state selection from loop(), for every minute of the week
+static void op_sched_state_at(void) {
+	enum sched_events state = E_UNKNOWN;
+	for (int m = 0; m < WEEK_MINUTES; m++) {
+		state = sched_state_at(m / (24 * 60), m % (24 * 60), state);
+		sink_total += state;
+	}
+}
+
+// Current limit for a long strip that has to be dimmed, run on every commit
+#define BENCH_STRIP 300
+static uint32_t bench_strip[BENCH_STRIP];
+
+static void op_led_limit_brightness(void) {
+	sink_total += led_limit_brightness(bench_strip, BENCH_STRIP, 255, (uint32_t)LED_BUDGET_MA * 1000);
+}
+
+struct bench_op {
+	const char *name;
+	void (*body)(void);
+	uint32_t iterations;  // calls per batch
+	uint32_t per_call;    // operations inside one call
+};
+
+static const struct bench_op bench_ops[] = {
+	{ "parse_schedule_json", op_parse_schedule_json, 2000, 1 },
+	{ "ingest_schedule", op_ingest_schedule, 2000, 1 },
+	{ "calc_week_crc", op_calc_week_crc, 100000, 1 },
+	{ "sched_to_big_time", op_sched_to_big_time, 200, WEEK_MINUTES * 4 },
+	{ "toLocal", op_to_local, 20, 365 * 24 },
+	{ "print_schedule_struct", op_print_schedule_struct, 20000, 1 },
+	{ "sched_state_at", op_sched_state_at, 200, WEEK_MINUTES },
+	{ "led_limit_brightness", op_led_limit_brightness, 2000, 1 },
+};
+
+#define BENCH_OPS (sizeof(bench_ops) / sizeof(bench_ops[0]))
+
+struct bench_result {
+	std::string name;
+	double ns;
+	double allocs;
+};
+
+static int quiet_fd = -1;
+static int stdout_fd = -1;
+
+static void quiet_begin(void) {
+	fflush(stdout);
+	dup2(quiet_fd, STDOUT_FILENO);
+}
+
+static void quiet_end(void) {
+	fflush(stdout);
+	dup2(stdout_fd, STDOUT_FILENO);
+}
+
+static struct bench_result run_op(const struct bench_op *op) {
+	std::vector<double> batches;
+	size_t allocs = 0;
+
+	quiet_begin();
+	op->body();  // warm up caches and any one-time work
+	for (int r = 0; r < opt.runs; r++) {
+		size_t before = allocations;
+		auto start = steady::now();
+		for (uint32_t i = 0; i < op->iterations; i++) {
+			op->body();
+		}
+		auto ns = std::chrono::duration<double, std::nano>(steady::now() - start).count();
+		allocs = allocations - before;
+		batches.push_back(ns / ((double)op->iterations * op->per_call));
+	}
+	quiet_end();
+
+	struct bench_result res;
+	res.name = op->name;
+	res.ns = *std::min_element(batches.begin(), batches.end());
+	res.allocs = (double)allocs / ((double)op->iterations * op->per_call);
+	return res;
+}
+
+static bool read_baseline(const char *path, std::vector<struct bench_result> &out) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		return false;
+	}
+	char line[128];
+	while (fgets(line, sizeof(line), f)) {
+		char name[64];
+		struct bench_result res;
+		if ((line[0] == '#') || (sscanf(line, "%63s %lf %lf", name, &res.ns, &res.allocs) != 3)) {
+			continue;
+		}
+		res.name = name;
+		out.push_back(res);
+	}
+	fclose(f);
+	return true;
+}
+
+static int write_baseline(const char *path, const std::vector<struct bench_result> &results) {
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "Cannot write %s\n", path);
+		return -1;
+	}
+	fprintf(f, "# operation ns/op allocs/op (written by schedule_bench --write-baseline)\n");
+	for (const auto &res : results) {
+		fprintf(f, "%s %.1f %.2f\n", res.name.c_str(), res.ns, res.allocs);
+	}
+	fclose(f);
+	printf("Baseline written to %s\n", path);
+	return 0;
+}
+
+static const struct bench_result *find_result(const std::vector<struct bench_result> &list, const std::string &name) {
+	for (const auto &res : list) {
+		if (res.name == name) {
+			return &res;
+		}
+	}
+	return NULL;
+}
+
+static void parse_args(int argc, char **argv) {
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (!strcmp(arg, "--write-baseline")) {
+			opt.write_baseline = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "Missing value for %s\n", arg);
+			exit(1);
+		}
+		const char *val = argv[++i];
+		if (!strcmp(arg, "--baseline")) opt.baseline = val;
+		else if (!strcmp(arg, "--threshold")) opt.threshold = atoi(val);
+		else if (!strcmp(arg, "--runs")) opt.runs = atoi(val);
+		else {
+			fprintf(stderr, "Unknown option %s\n", arg);
+			exit(1);
+		}
+	}
+	if ((opt.runs <= 0) || (opt.threshold < 0)) {
+		fprintf(stderr, "Invalid options\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv) {
+	parse_args(argc, argv);
+
+	cJSON_Hooks hooks = { count_malloc, free };
+	cJSON_InitHooks(&hooks);
+
+	quiet_fd = open("/dev/null", O_WRONLY);
+	stdout_fd = dup(STDOUT_FILENO);
+	if ((quiet_fd < 0) || (stdout_fd < 0)) {
+		fprintf(stderr, "Cannot redirect output\n");
+		return 1;
+	}
+
+	quiet_begin();
+	otw_init();
+	ingest_schedule(schedule_doc, sizeof(schedule_doc) - 1);
+	otw_select_date(2024, 1, 0);
+	parse_schedule_json(&bench_week, schedule_doc, sizeof(schedule_doc) - 1);
+	quiet_end();
+
+	led_limit_init();
+	for (int i = 0; i < BENCH_STRIP; i++) {
+		bench_strip[i] = (i & 1) ? 0xFFFFFF : 0xFF8000;
+	}
+
+	std::vector<struct bench_result> results;
+	for (size_t i = 0; i < BENCH_OPS; i++) {
+		results.push_back(run_op(&bench_ops[i]));
+	}
+
+	if (opt.write_baseline) {
+		for (const auto &res : results) {
+			printf("%-24s %10.1f ns/op %8.2f allocs/op\n", res.name.c_str(), res.ns, res.allocs);
+		}
+		return write_baseline(opt.baseline, results) ? 1 : 0;
+	}
+
+	std::vector<struct bench_result> baseline;
+	if (!read_baseline(opt.baseline, baseline)) {
+		printf("No baseline at %s, nothing to compare\n", opt.baseline);
+	}
+
+	int regressions = 0;
+	printf("%-24s %10s %10s %8s %10s\n", "operation", "ns/op", "baseline", "change", "allocs/op");
+	for (const auto &res : results) {
+		const struct bench_result *base = find_result(baseline, res.name);
+		if (!base) {
+			printf("%-24s %10.1f %10s %8s %10.2f\n", res.name.c_str(), res.ns, "-", "-", res.allocs);
+			continue;
+		}
+		double change = base->ns ? ((res.ns - base->ns) * 100.0 / base->ns) : 0;
+		bool slower = change > opt.threshold;
+		// Allocation counts are deterministic, so any increase counts
+		bool allocs = res.allocs > base->allocs + 0.005;
+		printf("%-24s %10.1f %10.1f %+7.1f%% %10.2f%s%s\n", res.name.c_str(), res.ns, base->ns, change,
+		       res.allocs, slower ? "  SLOWER" : "", allocs ? "  MORE ALLOCS" : "");
+		if (slower || allocs) {
+			regressions++;
+		}
+	}
+
+	if (regressions) {
+		printf("%d regression(s) beyond %d%% or in allocations\n", regressions, opt.threshold);
+		return 1;
+	}
+	return 0;
+}
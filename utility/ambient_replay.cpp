@@ -0,0 +1,177 @@
+/*
+    Ambient brightness trace replay
+
+    Feeds ADC traces through the firmware's ambient filter (src/ambient.cpp)
+    one sample per AMBIENT_SAMPLE_MS and reports every brightness step
+    change. With no arguments it replays a set of synthetic traces (dusk,
+    a lamp switched on, readings sitting on a step boundary, lamp flicker,
+    passing headlights) and checks how many times the strip would be
+    updated and where it settles; exits non-zero if any check fails.
+
+    Build (from the repository root):
+
+        g++ -O2 -std=gnu++17 -Isrc utility/ambient_replay.cpp \
+            src/ambient.cpp -o ambient_replay
+
+    Examples:
+
+        ./ambient_replay
+        ./ambient_replay --trace samples.txt    # one ADC reading per line
+
+    Options:
+        --trace FILE        replay a recorded trace instead of the synthetic ones
+        --verbose           print every step change
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "ambient.h"
+
+struct trace {
+	const char *name;
+	std::vector<uint16_t> samples;
+	int max_changes;        // strip updates allowed, -1 to skip the check
+	int final_step;         // -1 to skip the check
+};
+
+static bool verbose;
+
+static uint16_t clamp_adc(int v) {
+	return (v < 0) ? 0 : ((v > 1023) ? 1023 : v);
+}
+
+// Deterministic noise in [-amp, amp]
+static int noise(int amp) {
+	return amp ? ((rand() % (2 * amp + 1)) - amp) : 0;
+}
+
+/** @brief Replay one trace.
+ *
+ * @return true if the trace met its expectations
+ */
+static bool replay(const struct trace &t) {
+	struct ambient_filter f;
+	ambient_init(&f);
+	int changes = 0;
+	int first = -1;
+
+	for (size_t i = 0; i < t.samples.size(); i++) {
+		if (ambient_feed(&f, t.samples[i])) {
+			// The boot sample picks the starting step; it is not an update
+			if (i == 0) {
+				first = f.step;
+				continue;
+			}
+			changes++;
+			if (verbose) {
+				printf("  %6.0f s  reading %4u  level %4u  -> step %u (brightness %u)\n",
+				       i * (AMBIENT_SAMPLE_MS / 1000.0), t.samples[i], ambient_level(&f), f.step,
+				       ambient_brightness(&f));
+			}
+		}
+	}
+	if (first < 0) {
+		first = AMBIENT_STEPS - 1;
+	}
+
+	bool ok = ((t.max_changes < 0) || (changes <= t.max_changes)) &&
+	          ((t.final_step < 0) || (f.step == t.final_step));
+	printf("%-16s %6zu samples  start step %d  %3d updates  final step %u%s\n", t.name,
+	       t.samples.size(), first, changes, f.step, ok ? "" : "  FAIL");
+	return ok;
+}
+
+static std::vector<struct trace> synthetic_traces(void) {
+	std::vector<struct trace> traces;
+	srand(1);
+
+	// Daylight fading to a dark room over two hours: one update per step
+	struct trace dusk = { "dusk", {}, AMBIENT_STEPS - 1, 0 };
+	for (int i = 0; i < 7200; i++) {
+		dusk.samples.push_back(clamp_adc(800 - (790 * i / 7200) + noise(6)));
+	}
+	traces.push_back(dusk);
+
+	// Dark room, then the ceiling light comes on: the filter steps up within seconds
+	struct trace lamp = { "lamp on", {}, AMBIENT_STEPS - 1, AMBIENT_STEPS - 1 };
+	for (int i = 0; i < 120; i++) {
+		lamp.samples.push_back(clamp_adc((i < 60 ? 20 : 700) + noise(4)));
+	}
+	traces.push_back(lamp);
+
+	// Readings sitting right on a step boundary for an hour
+	struct trace edge = { "on a boundary", {}, 1, -1 };
+	for (int i = 0; i < 3600; i++) {
+		edge.samples.push_back(clamp_adc(120 + noise(10)));
+	}
+	traces.push_back(edge);
+
+	// Mains flicker aliased into alternate samples around a boundary
+	struct trace flicker = { "lamp flicker", {}, 1, -1 };
+	for (int i = 0; i < 3600; i++) {
+		flicker.samples.push_back(clamp_adc(300 + ((i & 1) ? 150 : -150)));
+	}
+	traces.push_back(flicker);
+
+	// Dark room with a car's headlights sweeping past every ten minutes: at
+	// most one step up and back per car
+	struct trace cars = { "headlights", {}, 6, 0 };
+	for (int i = 0; i < 1800; i++) {
+		bool car = (i % 600) == 300;
+		cars.samples.push_back(clamp_adc((car ? 900 : 15) + noise(3)));
+	}
+	traces.push_back(cars);
+
+	return traces;
+}
+
+static bool load_trace(const char *path, struct trace &t) {
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "Cannot read %s\n", path);
+		return false;
+	}
+	int v;
+	while (fscanf(fp, "%d", &v) == 1) {
+		t.samples.push_back(clamp_adc(v));
+	}
+	fclose(fp);
+	return !t.samples.empty();
+}
+
+int main(int argc, char **argv) {
+	const char *path = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--trace") && (i + 1 < argc)) {
+			path = argv[++i];
+		} else if (!strcmp(argv[i], "--verbose")) {
+			verbose = true;
+		} else {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (path) {
+		struct trace t = { path, {}, -1, -1 };
+		verbose = true;
+		if (!load_trace(path, t)) {
+			return 1;
+		}
+		replay(t);
+		return 0;
+	}
+
+	int failed = 0;
+	for (const auto &t : synthetic_traces()) {
+		failed += !replay(t);
+	}
+	if (failed) {
+		printf("%d trace(s) failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
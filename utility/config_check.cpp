@@ -0,0 +1,321 @@
+/*
+    Config store power-loss check
+
+    Runs the firmware's config store (src/config_store.cpp) on simulated NOR
+    flash: writes can only clear bits, must be whole aligned words, and only
+    an erase sets a sector back to 0xFF. Power is cut in the middle of
+    writes and erases, leaving part of the data written or part of the
+    sector erased, and the store is then loaded again as it would be after
+    the reset.
+
+    Checks that:
+      * reads always match a model of the values set, across reloads
+      * after a cut while changing a key, it holds either its old or its
+        new value, and every other key is unchanged
+      * the store keeps working after a cut (the torn log is compacted away)
+
+    Also reports how many sector erases a run of updates costs. Exits
+    non-zero if any check fails.
+
+    Build (from the repository root):
+
+        g++ -O2 -std=gnu++17 -Isrc -Iutility/host utility/config_check.cpp \
+            src/config_store.cpp -o config_check
+
+    Example:
+
+        ./config_check
+        ./config_check --updates 100000 --cuts 20000 --seed 7
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "config_store.h"
+
+#define KEYS CONFIG_STORE_KEYS
+
+struct nor_flash {
+	uint8_t data[2 * CONFIG_SECTOR_SIZE];
+	uint32_t erases[2];
+	uint32_t bytes_written;
+	int32_t ops_left;       // cut the power when this reaches 0, -1 never
+	bool dead;
+	uint32_t rng;
+};
+
+struct options {
+	uint32_t updates = 20000;
+	uint32_t cuts = 5000;
+	uint32_t seed = 1;
+};
+
+static int failures = 0;
+
+static uint32_t next_random(uint32_t *x) {
+	*x ^= *x << 13;
+	*x ^= *x >> 17;
+	*x ^= *x << 5;
+	return *x;
+}
+
+enum power {
+	POWER_ON,
+	POWER_CUT,      // goes during this operation
+	POWER_OFF
+};
+
+static enum power power_state(struct nor_flash *f) {
+	if (f->dead) {
+		return POWER_OFF;
+	}
+	if ((f->ops_left >= 0) && (f->ops_left-- == 0)) {
+		f->dead = true;
+		return POWER_CUT;
+	}
+	return POWER_ON;
+}
+
+static int nor_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+	struct nor_flash *f = (struct nor_flash *)ctx;
+	if (f->dead || (offset + len > sizeof(f->data))) {
+		return -1;
+	}
+	memcpy(buf, f->data + offset, len);
+	return 0;
+}
+
+static int nor_write(void *ctx, uint32_t offset, const void *buf, size_t len) {
+	struct nor_flash *f = (struct nor_flash *)ctx;
+	if ((offset % 4) || (len % 4) || (offset + len > sizeof(f->data))) {
+		printf("FAIL: unaligned or out of range write at %u, %zu bytes\n", offset, len);
+		failures++;
+		return -1;
+	}
+	enum power power = power_state(f);
+	size_t n = len;
+	if (power == POWER_CUT) {
+		// Part of the data makes it, and the last byte may be half programmed
+		n = next_random(&f->rng) % (len + 1);
+	} else if (power == POWER_OFF) {
+		n = 0;
+	}
+	const uint8_t *in = (const uint8_t *)buf;
+	for (size_t i = 0; i < n; i++) {
+		uint8_t b = in[i];
+		if ((power == POWER_CUT) && (i == n - 1)) {
+			b |= next_random(&f->rng) & 0xFF;
+		}
+		f->data[offset + i] &= b;
+	}
+	f->bytes_written += n;
+	return (power == POWER_ON) ? 0 : -1;
+}
+
+static int nor_erase(void *ctx, uint8_t sector) {
+	struct nor_flash *f = (struct nor_flash *)ctx;
+	if (sector > 1) {
+		return -1;
+	}
+	enum power power = power_state(f);
+	if (power == POWER_OFF) {
+		return -1;
+	}
+	size_t n = (power == POWER_CUT) ? next_random(&f->rng) % (CONFIG_SECTOR_SIZE + 1) : CONFIG_SECTOR_SIZE;
+	memset(f->data + (sector * CONFIG_SECTOR_SIZE), 0xFF, n);
+	f->erases[sector]++;
+	return (power == POWER_ON) ? 0 : -1;
+}
+
+static void flash_reset(struct nor_flash *f, uint32_t seed) {
+	memset(f, 0, sizeof(*f));
+	memset(f->data, 0xFF, sizeof(f->data));
+	f->ops_left = -1;
+	f->rng = seed | 1;
+}
+
+static std::string random_value(uint32_t *rng) {
+	std::string v;
+	size_t len = next_random(rng) % (CONFIG_VALUE_MAX + 1);
+	for (size_t i = 0; i < len; i++) {
+		v.push_back((char)next_random(rng));
+	}
+	return v;
+}
+
+// Empty strings stand for unset keys, as a length 0 set deletes
+static bool matches(const struct config_store *s, uint8_t key, const std::string &want) {
+	uint8_t buf[CONFIG_VALUE_MAX];
+	int len = config_store_get(s, key, buf, sizeof(buf));
+	if (want.empty()) {
+		return len < 0;
+	}
+	return (len == (int)want.size()) && !memcmp(buf, want.data(), len);
+}
+
+static bool check_all(const struct config_store *s, const std::string *model, const char *when, uint32_t n) {
+	for (uint8_t key = 0; key < KEYS; key++) {
+		if (!matches(s, key, model[key])) {
+			printf("FAIL: key %u differs from the model %s %u\n", key, when, n);
+			failures++;
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool load(struct config_store *s, struct nor_flash *f) {
+	struct config_flash io = { nor_read, nor_write, nor_erase, f };
+	if (config_store_init(s, &io)) {
+		printf("FAIL: store did not load\n");
+		failures++;
+		return false;
+	}
+	return true;
+}
+
+// Random sets and deletes with a reload now and then, without power loss
+static void check_updates(const struct options *opt) {
+	static struct nor_flash f;
+	struct config_store s;
+	std::string model[KEYS];
+	uint32_t rng = opt->seed * 2654435761UL | 1;
+	uint32_t compactions = 0;
+
+	flash_reset(&f, opt->seed);
+	if (!load(&s, &f)) {
+		return;
+	}
+	for (uint32_t n = 0; n < opt->updates; n++) {
+		// Most updates go to a few keys, as they do on the clock
+		uint8_t key = (next_random(&rng) % 4) ? next_random(&rng) % 4 : next_random(&rng) % KEYS;
+		std::string v = (next_random(&rng) % 8) ? random_value(&rng) : std::string();
+		if (config_store_set(&s, key, v.data(), v.size())) {
+			printf("FAIL: set %u failed\n", n);
+			failures++;
+			return;
+		}
+		model[key] = v;
+		if (!check_all(&s, model, "after update", n)) {
+			return;
+		}
+		if ((n % 997) == 0) {
+			compactions += s.compactions;
+			if (!load(&s, &f) || !check_all(&s, model, "after reload", n)) {
+				return;
+			}
+		}
+	}
+	compactions += s.compactions;
+	printf("%u updates: ok, %u compactions, erases %u/%u, %u bytes written (%.1f per update)\n", opt->updates,
+	       compactions, f.erases[0], f.erases[1], f.bytes_written, (double)f.bytes_written / opt->updates);
+}
+
+// Cut the power during one update, then reload and check what survived
+static void check_cuts(const struct options *opt) {
+	static struct nor_flash f;
+	struct config_store s;
+	std::string model[KEYS];
+	uint32_t rng = opt->seed * 40503UL | 1;
+	uint32_t during_compaction = 0;
+	uint32_t got_old = 0;
+	uint32_t got_new = 0;
+
+	flash_reset(&f, opt->seed);
+	if (!load(&s, &f)) {
+		return;
+	}
+	for (uint32_t n = 0; n < opt->cuts;) {
+		// Some updates between cuts so they land anywhere in the log
+		uint32_t fill = next_random(&rng) % 64;
+		for (uint32_t i = 0; i < fill; i++) {
+			uint8_t key = next_random(&rng) % KEYS;
+			std::string v = random_value(&rng);
+			if (config_store_set(&s, key, v.data(), v.size())) {
+				printf("FAIL: set failed after %u cuts\n", n);
+				failures++;
+				return;
+			}
+			model[key] = v;
+		}
+
+		uint8_t key = next_random(&rng) % KEYS;
+		std::string v = (next_random(&rng) % 8) ? random_value(&rng) : std::string();
+		bool compacting = s.dirty || (s.end + 4 + ((v.size() + 3) & ~3) > CONFIG_SECTOR_SIZE);
+		// An append is one write, a compaction an erase and up to KEYS + 2
+		f.ops_left = (next_random(&rng) % 2) ? 0 : next_random(&rng) % (KEYS + 3);
+		f.dead = false;
+		int err = config_store_set(&s, key, v.data(), v.size());
+		bool cut = f.dead;
+		f.ops_left = -1;
+		f.dead = false;
+		if (!cut) {
+			if (err) {
+				printf("FAIL: set failed without a power cut\n");
+				failures++;
+				return;
+			}
+			model[key] = v;
+			continue;
+		}
+		n++;
+		if (compacting) {
+			during_compaction++;
+		}
+
+		if (!load(&s, &f)) {
+			return;
+		}
+		std::string old = model[key];
+		if (matches(&s, key, v)) {
+			model[key] = v;
+			got_new++;
+		} else if (matches(&s, key, old)) {
+			got_old++;
+		} else {
+			printf("FAIL: cut %u left key %u with neither its old nor its new value\n", n, key);
+			failures++;
+			return;
+		}
+		if (!check_all(&s, model, "after cut", n)) {
+			return;
+		}
+	}
+	printf("%u power cuts: ok, %u during a compaction, kept %u old and %u new values\n", opt->cuts,
+	       during_compaction, got_old, got_new);
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "usage: %s [--updates N] [--cuts N] [--seed N]\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	struct options opt;
+	for (int i = 1; i < argc; i++) {
+		const char *a = argv[i];
+		if ((i + 1 >= argc) || (strncmp(a, "--", 2) != 0)) {
+			usage(argv[0]);
+		}
+		uint32_t v = strtoul(argv[++i], NULL, 10);
+		if (!strcmp(a, "--updates")) {
+			opt.updates = v;
+		} else if (!strcmp(a, "--cuts")) {
+			opt.cuts = v;
+		} else if (!strcmp(a, "--seed")) {
+			opt.seed = v ? v : 1;
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	check_updates(&opt);
+	check_cuts(&opt);
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
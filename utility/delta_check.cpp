@@ -0,0 +1,251 @@
+/*
+    Delta patch apply check
+
+    Applies patches the way the clock does: the patch is heatshrink
+    compressed as the schedule server would send it, fed in uneven chunks
+    through the firmware's decoder (src/heatshrink.cpp) into the firmware's
+    applier (src/delta_patch.cpp), and the rebuilt image is compared with the
+    expected one. Old image reads are checked against the applier's window
+    size.
+
+    With no arguments it runs synthetic firmware images through typical
+    changes (a few bytes edited, code inserted so later addresses shift, code
+    removed, an unrelated image) and checks that patches made for another
+    image, corrupted, or cut short are refused without the writer ever
+    receiving a complete image. Exits non-zero if any check fails.
+
+    Build (from the repository root):
+
+        g++ -O2 -std=gnu++17 -Isrc -Iutility/host utility/delta_check.cpp \
+            src/delta_patch.cpp src/heatshrink.cpp -o delta_check
+
+    Examples:
+
+        ./delta_check
+        ./delta_check old/firmware.bin schedules/firmware.otwd .pio/build/nodemcuv2/firmware.bin
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "delta_encoder.h"
+#include "heatshrink_encoder.h"
+#include "heatshrink.h"
+
+// Where the image is mapped on the ESP8266, for synthetic pointers
+#define IMAGE_BASE 0x40200000UL
+
+struct target {
+	const std::string *old;
+	std::string out;
+	size_t max_read = 0;
+	bool began = false;
+};
+
+struct apply_result {
+	bool ok;
+	const char *error;
+	size_t written;
+	size_t max_read;
+};
+
+static int io_begin(void *ctx, uint32_t old_size, uint32_t /* new_size */) {
+	struct target *t = (struct target *)ctx;
+	t->began = true;
+	return (old_size == t->old->size()) ? 0 : -1;
+}
+
+static int io_read_old(void *ctx, uint32_t offset, uint8_t *buf, size_t len) {
+	struct target *t = (struct target *)ctx;
+	if ((offset + len > t->old->size())) {
+		return -1;
+	}
+	if (len > t->max_read) {
+		t->max_read = len;
+	}
+	memcpy(buf, t->old->data() + offset, len);
+	return 0;
+}
+
+static int io_write_new(void *ctx, const uint8_t *buf, size_t len) {
+	((struct target *)ctx)->out.append((const char *)buf, len);
+	return 0;
+}
+
+struct feed_ctx {
+	struct delta_patch *patch;
+	bool failed;
+};
+
+static void feed_patch(void *ctx, const uint8_t *buf, size_t len) {
+	struct feed_ctx *f = (struct feed_ctx *)ctx;
+	if (!f->failed && delta_patch_feed(f->patch, buf, len)) {
+		f->failed = true;
+	}
+}
+
+/** @brief Apply a compressed patch in random sized chunks.
+ *
+ * @param out: rebuilt image, as far as the writer received it
+ */
+static struct apply_result apply(const std::string &old, const std::string &compressed, std::string &out) {
+	static struct delta_patch patch;
+	static struct hs_decoder decoder;
+	struct target t;
+	t.old = &old;
+	struct delta_io io = { io_begin, io_read_old, io_write_new, &t };
+	delta_patch_init(&patch, &io);
+	hs_decoder_init(&decoder);
+
+	struct feed_ctx f = { &patch, false };
+	size_t pos = 0;
+	while ((pos < compressed.size()) && !f.failed) {
+		size_t n = 1 + (rand() % 1460);
+		if (n > compressed.size() - pos) {
+			n = compressed.size() - pos;
+		}
+		if (hs_decoder_feed(&decoder, (const uint8_t *)compressed.data() + pos, n, feed_patch, &f)) {
+			f.failed = true;
+		}
+		pos += n;
+	}
+	bool ok = !f.failed && !delta_patch_finish(&patch);
+	out = t.out;
+	return { ok, patch.error, t.out.size(), t.max_read };
+}
+
+// Random bytes with a sprinkling of pointers into the image, like code and literal pools
+static std::string synthetic_image(size_t len, unsigned seed) {
+	srand(seed);
+	std::string img(len, '\0');
+	for (size_t i = 0; i + 4 <= len; i += 4) {
+		uint32_t word = ((rand() % 4) == 0) ? (IMAGE_BASE + (rand() % len)) : (uint32_t)(rand() & 0x00FFFFFF);
+		memcpy(&img[i], &word, 4);
+	}
+	return img;
+}
+
+// Insert (or remove) bytes at pos and move every pointer past it, as a relink would
+static std::string relink(const std::string &img, size_t pos, const std::string &insert, size_t remove) {
+	std::string out = img.substr(0, pos) + insert + img.substr(pos + remove);
+	int64_t shift = (int64_t)insert.size() - (int64_t)remove;
+	for (size_t i = 0; i + 4 <= out.size(); i += 4) {
+		uint32_t word;
+		memcpy(&word, &out[i], 4);
+		if ((word >= IMAGE_BASE + pos) && (word < IMAGE_BASE + img.size())) {
+			word += shift;
+			memcpy(&out[i], &word, 4);
+		}
+	}
+	return out;
+}
+
+/** @brief Make, apply and compare a patch.
+ *
+ * @return true if the rebuilt image matches
+ */
+static bool check_case(const char *name, const std::string &old, const std::string &nw) {
+	std::string patch = delta_encode(old, nw);
+	std::string compressed = hs_encode(patch);
+	size_t image_hs = hs_encode(nw).size();
+	std::string out;
+	struct apply_result r = apply(old, compressed, out);
+	bool ok = r.ok && (out == nw) && (r.max_read <= DELTA_WINDOW_BYTES);
+	printf("%-18s %7zu -> %7zu bytes  patch %7zu  sent %7zu (%5.1f%% of image)  %s\n", name, old.size(),
+	       nw.size(), patch.size(), compressed.size(), 100.0 * compressed.size() / image_hs,
+	       ok ? "ok" : (r.error ? r.error : "FAIL: output differs"));
+	return ok;
+}
+
+/** @brief Apply a bad patch and check it is refused.
+ *
+ * @return true if the applier failed and the writer never got a whole image
+ */
+static bool check_refused(const char *name, const std::string &old, const std::string &patch,
+                          size_t new_size) {
+	std::string out;
+	struct apply_result r = apply(old, hs_encode(patch), out);
+	bool ok = !r.ok && (r.written < new_size);
+	printf("%-18s refused: %-34s %7zu of %7zu bytes written  %s\n", name, r.error ? r.error : "no",
+	       r.written, new_size, ok ? "ok" : "FAIL");
+	return ok;
+}
+
+static int synthetic_checks(void) {
+	const size_t len = 300 * 1024;
+	std::string base = synthetic_image(len, 1);
+	int failed = 0;
+
+	failed += !check_case("identical", base, base);
+
+	std::string edited = base;
+	for (int i = 0; i < 16; i++) {
+		edited[rand() % len] ^= 0x5A;
+	}
+	failed += !check_case("bytes edited", base, edited);
+
+	std::string inserted = relink(base, len / 3, synthetic_image(600, 2), 0);
+	failed += !check_case("code inserted", base, inserted);
+
+	std::string removed = relink(base, len / 2, "", 2048);
+	failed += !check_case("code removed", base, removed);
+
+	failed += !check_case("unrelated", base, synthetic_image(len, 3));
+
+	// Refusals
+	std::string patch = delta_encode(base, inserted);
+	failed += !check_refused("other old image", edited, patch, inserted.size());
+
+	std::string corrupt = patch;
+	corrupt[corrupt.size() / 2] ^= 0x01;
+	failed += !check_refused("corrupted", base, corrupt, inserted.size());
+
+	failed += !check_refused("truncated", base, patch.substr(0, patch.size() - 100), inserted.size());
+
+	printf("Applier state: %zu bytes, heatshrink decoder: %zu bytes\n", sizeof(struct delta_patch),
+	       sizeof(struct hs_decoder));
+	return failed;
+}
+
+static bool read_file(const char *path, std::string &out) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Cannot read %s\n", path);
+		return false;
+	}
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		out.append(buf, n);
+	}
+	fclose(f);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	srand(1);
+	if (argc == 4) {
+		std::string old_image, patch, new_image, out;
+		if (!read_file(argv[1], old_image) || !read_file(argv[2], patch) || !read_file(argv[3], new_image)) {
+			return 1;
+		}
+		struct apply_result r = apply(old_image, hs_encode(patch), out);
+		bool ok = r.ok && (out == new_image);
+		printf("%s: %zu bytes rebuilt, largest old image read %zu bytes: %s\n", argv[2], r.written,
+		       r.max_read, ok ? "ok" : (r.error ? r.error : "output differs"));
+		return ok ? 0 : 1;
+	}
+	if (argc != 1) {
+		fprintf(stderr, "Usage: %s [OLD PATCH NEW]\n", argv[0]);
+		return 1;
+	}
+
+	int failed = synthetic_checks();
+	if (failed) {
+		printf("%d check(s) failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
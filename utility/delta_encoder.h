@@ -0,0 +1,205 @@
+#pragma once
+
+/*
+    Host-side delta patch encoder
+
+    Produces the patch format read by src/delta_patch.cpp. The scan is
+    bsdiff's: matches are extended forwards and backwards while more than
+    half their bytes agree, so code that only moved (and whose addresses
+    shifted) becomes a diff run of mostly zeros, which are run-length coded. The
+    exact-match search uses a hash index of DELTA_KEY_BYTES long keys rather
+    than a suffix array. Used by otw_delta and delta_check; not built for
+    the clock.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "CRC32.h"
+#include "delta_patch.h"
+
+#define DELTA_KEY_BYTES 8
+// Candidates tried per key; long runs of padding would otherwise dominate
+#define DELTA_MAX_CANDIDATES 32
+
+struct delta_index {
+	const std::string &old;
+	std::unordered_map<uint64_t, std::vector<uint32_t>> keys;
+
+	explicit delta_index(const std::string &o) : old(o) {
+		for (size_t i = 0; i + DELTA_KEY_BYTES <= old.size(); i++) {
+			std::vector<uint32_t> &v = keys[key(old.data() + i)];
+			if (v.size() < DELTA_MAX_CANDIDATES) {
+				v.push_back(i);
+			}
+		}
+	}
+
+	static uint64_t key(const char *p) {
+		uint64_t k;
+		memcpy(&k, p, sizeof(k));
+		return k;
+	}
+
+	// Longest exact match for new[pos..] anywhere in the old image
+	size_t search(const std::string &nw, size_t pos, size_t *old_pos) const {
+		if (pos + DELTA_KEY_BYTES > nw.size()) {
+			return 0;
+		}
+		auto it = keys.find(key(nw.data() + pos));
+		if (it == keys.end()) {
+			return 0;
+		}
+		size_t best = 0;
+		for (uint32_t o : it->second) {
+			size_t n = 0;
+			while ((o + n < old.size()) && (pos + n < nw.size()) && (old[o + n] == nw[pos + n])) {
+				n++;
+			}
+			if (n > best) {
+				best = n;
+				*old_pos = o;
+			}
+		}
+		return best;
+	}
+};
+
+static inline void delta_put_le32(std::string &out, uint32_t v) {
+	for (int i = 0; i < 4; i++) {
+		out.push_back((char)(v >> (8 * i)));
+	}
+}
+
+static inline void delta_put_varint(std::string &out, uint32_t v) {
+	while (v >= 0x80) {
+		out.push_back((char)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((char)v);
+}
+
+static inline void delta_put_record(std::string &out, const std::string &old, const std::string &nw,
+                                    size_t new_pos, size_t old_pos, size_t diff, size_t extra, int64_t seek) {
+	delta_put_varint(out, diff);
+	delta_put_varint(out, extra);
+	delta_put_varint(out, (uint32_t)((seek << 1) ^ (seek >> 63)));
+	for (size_t i = 0; i < diff;) {
+		char d = nw[new_pos + i] - old[old_pos + i];
+		if (d) {
+			out.push_back(d);
+			i++;
+			continue;
+		}
+		// Zeros go as a run: 0 then a varint of the run length - 1
+		size_t run = 1;
+		while ((i + run < diff) && (nw[new_pos + i + run] == old[old_pos + i + run])) {
+			run++;
+		}
+		out.push_back(0);
+		delta_put_varint(out, run - 1);
+		i += run;
+	}
+	out.append(nw, new_pos + diff, extra);
+}
+
+static inline std::string delta_encode(const std::string &old, const std::string &nw) {
+	std::string out = DELTA_MAGIC;
+	delta_put_le32(out, old.size());
+	delta_put_le32(out, CRC32::calculate((const uint8_t *)old.data(), old.size()));
+	delta_put_le32(out, nw.size());
+	delta_put_le32(out, CRC32::calculate((const uint8_t *)nw.data(), nw.size()));
+
+	delta_index index(old);
+	const int64_t old_size = old.size();
+	const int64_t new_size = nw.size();
+	int64_t scan = 0, len = 0, pos = 0;
+	int64_t last_scan = 0, last_pos = 0, last_offset = 0;
+
+	while (scan < new_size) {
+		int64_t old_score = 0;
+		int64_t scsc = scan += len;
+		for (; scan < new_size; scan++) {
+			size_t match_pos = 0;
+			len = index.search(nw, scan, &match_pos);
+			pos = match_pos;
+			// Bytes the current alignment already gets right over the same span
+			for (; scsc < scan + len; scsc++) {
+				if ((scsc + last_offset < old_size) && (old[scsc + last_offset] == nw[scsc])) {
+					old_score++;
+				}
+			}
+			if (((len == old_score) && (len != 0)) || (len > old_score + 8)) {
+				break;
+			}
+			if ((scan + last_offset < old_size) && (old[scan + last_offset] == nw[scan])) {
+				old_score--;
+			}
+		}
+
+		if ((len == old_score) && (scan != new_size)) {
+			continue;
+		}
+
+		// Extend the previous match forwards while it is mostly right
+		int64_t s = 0, best = 0, len_f = 0;
+		for (int64_t i = 0; (last_scan + i < scan) && (last_pos + i < old_size);) {
+			if (old[last_pos + i] == nw[last_scan + i]) {
+				s++;
+			}
+			i++;
+			if (s * 2 - i > best * 2 - len_f) {
+				best = s;
+				len_f = i;
+			}
+		}
+
+		// And the new match backwards
+		int64_t len_b = 0;
+		if (scan < new_size) {
+			s = 0;
+			best = 0;
+			for (int64_t i = 1; (scan >= last_scan + i) && (pos >= i); i++) {
+				if (old[pos - i] == nw[scan - i]) {
+					s++;
+				}
+				if (s * 2 - i > best * 2 - len_b) {
+					best = s;
+					len_b = i;
+				}
+			}
+		}
+
+		// Split any overlap where the two agree best
+		if (last_scan + len_f > scan - len_b) {
+			int64_t overlap = (last_scan + len_f) - (scan - len_b);
+			int64_t lens = 0;
+			s = 0;
+			best = 0;
+			for (int64_t i = 0; i < overlap; i++) {
+				if (nw[last_scan + len_f - overlap + i] == old[last_pos + len_f - overlap + i]) {
+					s++;
+				}
+				if (nw[scan - len_b + i] == old[pos - len_b + i]) {
+					s--;
+				}
+				if (s > best) {
+					best = s;
+					lens = i + 1;
+				}
+			}
+			len_f += lens - overlap;
+			len_b -= lens;
+		}
+
+		int64_t extra = (scan - len_b) - (last_scan + len_f);
+		int64_t seek = (pos - len_b) - (last_pos + len_f);
+		delta_put_record(out, old, nw, last_scan, last_pos, len_f, extra, seek);
+		last_scan = scan - len_b;
+		last_pos = pos - len_b;
+		last_offset = pos - scan;
+	}
+	return out;
+}
@@ -0,0 +1,115 @@
+"""
+Compile a schedule JSON file into src/default_schedule.h
+
+The clock falls back to this schedule on first boot, after a factory reset,
+or when the EEPROM copy fails its CRC. The header holds the finished
+otw_week, CRC included, as a constant in flash, so the fallback is one copy
+with nothing to parse or compute.
+
+Runs before every PlatformIO build (extra_scripts in platformio.ini) using
+the file named by `custom_default_schedule`, and only rewrites the header
+when its contents change. It can also be run by hand:
+
+    python3 utility/embed_schedule.py utility/example_sched.json src/default_schedule.h
+"""
+
+import json
+import os
+import sys
+import zlib
+
+WEEK = ["monday", "tuesday", "wednesday", "thursday", "friday", "saturday", "sunday"]
+EVENTS = ["doze", "wake", "day", "sleep"]
+
+DEFAULT_SOURCE = "utility/example_sched.json"
+DEFAULT_OUTPUT = "src/default_schedule.h"
+
+
+def load_week(path):
+    with open(path) as f:
+        doc = json.load(f)
+
+    week = []
+    for day in WEEK:
+        if day not in doc:
+            raise ValueError("%s: missing %s" % (path, day))
+        times = []
+        for event in EVENTS:
+            entry = doc[day].get(event)
+            if entry is None:
+                raise ValueError("%s: missing %s.%s" % (path, day, event))
+            hours, minutes = entry.get("hours"), entry.get("minutes")
+            if not (isinstance(hours, int) and 0 <= hours < 24):
+                raise ValueError("%s: bad hours in %s.%s" % (path, day, event))
+            if not (isinstance(minutes, int) and 0 <= minutes < 60):
+                raise ValueError("%s: bad minutes in %s.%s" % (path, day, event))
+            times.append((hours, minutes))
+        week.append(times)
+    return week
+
+
+def render(week, source):
+    # Same bytes calc_week_crc() covers: otw_week.dow, hour then minute
+    raw = bytes(v for day in week for t in day for v in t)
+    crc = zlib.crc32(raw) & 0xFFFFFFFF
+
+    lines = [
+        "#pragma once",
+        "",
+        "// Generated by utility/embed_schedule.py from %s; do not edit" % source,
+        "",
+        "#include \"wake_schedule.h\"",
+        "",
+        "#define DEFAULT_SCHEDULE_CRC 0x%08XUL" % crc,
+        "",
+        "// doze, wake, day, sleep as {hour, minute}",
+        "static const struct otw_week default_schedule PROGMEM = {",
+        "\t{",
+    ]
+    for name, day in zip(WEEK, week):
+        times = ", ".join("{%d, %d}" % t for t in day)
+        lines.append("\t\t{%s}, // %s" % (times, name))
+    lines += [
+        "\t},",
+        "\tDEFAULT_SCHEDULE_CRC",
+        "};",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def embed(source, output):
+    text = render(load_week(source), source.replace(os.sep, "/"))
+    try:
+        with open(output) as f:
+            if f.read() == text:
+                return False
+    except OSError:
+        pass
+    with open(output, "w") as f:
+        f.write(text)
+    return True
+
+
+def main(argv):
+    source = argv[1] if len(argv) > 1 else DEFAULT_SOURCE
+    output = argv[2] if len(argv) > 2 else DEFAULT_OUTPUT
+    try:
+        changed = embed(source, output)
+    except (OSError, ValueError) as e:
+        print("embed_schedule: %s" % e, file=sys.stderr)
+        return 1
+    print("%s %s" % ("Wrote" if changed else "Unchanged", output))
+    return 0
+
+
+try:
+    Import("env")  # noqa: F821 (provided by PlatformIO)
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main(sys.argv))
+else:
+    os.chdir(env.subst("$PROJECT_DIR"))  # noqa: F821
+    source = env.GetProjectOption("custom_default_schedule", DEFAULT_SOURCE)  # noqa: F821
+    if main(["embed_schedule", source, DEFAULT_OUTPUT]):
+        env.Exit(1)  # noqa: F821
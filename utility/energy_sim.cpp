@@ -0,0 +1,265 @@
+/*
+    Energy simulator for an okay-to-wake clock
+
+    Runs the firmware's energy accountant (src/energy.cpp) over simulated
+    days: the lights follow a schedule file the same way loop() does, the
+    CPU works for --work-ms of every 10 second pass, and the radio is on
+    for --session-ms at boot and at every schedule check, plus an OTA
+    window after boot if --ota-minutes is set. Prints estimated mAh per day, so schedules, poll intervals and
+    sleep modes can be compared before trying them on a clock.
+
+    Build (from the repository root):
+
+        gcc -O2 -c src/cJSON.c -o cJSON.o
+        g++ -O2 -std=gnu++17 -Isrc -Iutility/host \
+            utility/energy_sim.cpp utility/host/host_shim.cpp src/energy.cpp \
+            src/led_limit.cpp src/wake_schedule.cpp src/schedule_store.cpp \
+            src/calendar.cpp src/schedule_stream.cpp src/progress_bar.cpp cJSON.o \
+            -o energy_sim
+
+    Example, hourly polling against push updates in modem sleep:
+
+        ./energy_sim --schedule utility/example_sched.json --poll 3600
+        ./energy_sim --schedule utility/example_sched.json --mqtt
+
+    Options:
+        --schedule FILE     schedule JSON (built-in default week)
+        --days N            days to simulate, starting Monday 00:00 (7)
+        --poll S            seconds between schedule checks (3600)
+        --session-ms MS     radio-on time of one sync session (2500)
+        --ota-minutes M     OTA window after the boot session, as when an update is flagged (0)
+        --mqtt              listen in modem sleep instead of polling
+        --brightness B      LED brightness 0-255 (255)
+        --work-ms MS        CPU work per 10 second loop pass (20)
+        --light-sleep       light sleep between passes instead of delay()
+        --solid-night       full strip during sleep and doze (no progress bar)
+        --battery MAH       also print runtime on a battery of this size
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "Arduino.h"
+#include "config.h"
+#include "energy.h"
+#include "led_limit.h"
+#include "progress_bar.h"
+#include "wake_schedule.h"
+
+#define PASS_MS 10000
+#define LED_COUNT 3
+
+// Default colors from config.h, then the boot color in main.cpp
+static const uint32_t state_colors[5] = {
+	DOZE_COLOR,
+	WAKE_COLOR,
+	DAY_COLOR,
+	SLEEP_COLOR,
+	0x525252
+};
+
+struct options {
+	const char *schedule = NULL;
+	int days = 7;
+	uint32_t poll_s = 3600;
+	uint32_t session_ms = 2500;
+	uint32_t ota_minutes = 0;
+	bool mqtt = false;
+	int brightness = 255;
+	uint32_t work_ms = 20;
+	bool light_sleep = false;
+	bool solid_night = false;
+	uint32_t battery_mah = 0;
+};
+
+static options opt;
+
+static int minutes(const struct otw_time &t) {
+	return (t.hour * 60) + t.minute;
+}
+
+// Same state selection as loop()
+static uint8_t light_state(const struct otw_week &w, int dow, int rn) {
+	const struct otw_day &d = w.dow[dow];
+	if ((rn >= minutes(d.day)) && (rn < minutes(d.sleep))) {
+		return E_DAY;
+	}
+	if ((rn >= minutes(d.doze)) && (rn < minutes(d.wake))) {
+		return E_DOZE;
+	}
+	if ((rn >= minutes(d.wake)) && (rn < minutes(d.day))) {
+		return E_WAKE;
+	}
+	return E_SLEEP;
+}
+
+// Strip current as led_render_commit() estimates it, budget limiter included
+static uint32_t led_ua(uint8_t state, uint16_t lit) {
+	uint32_t colors[LED_COUNT];
+	for (int i = 0; i < LED_COUNT; i++) {
+		colors[i] = (i < lit) ? state_colors[state] : 0;
+	}
+	uint8_t brightness = led_limit_brightness(colors, LED_COUNT, opt.brightness, (uint32_t)LED_BUDGET_MA * 1000);
+	return led_limit_frame_ua(colors, LED_COUNT, brightness) + ((uint32_t)LED_COUNT * LED_PIXEL_IDLE_UA);
+}
+
+static bool led_lit(uint32_t ua) {
+	return ua > (uint32_t)LED_COUNT * LED_PIXEL_IDLE_UA;
+}
+
+// Pixels lit by the night progress bar, as draw_night_progress() in main.cpp
+static uint16_t night_lit(const struct otw_week &w, int dow, int32_t now_s) {
+	int32_t sleep_s = minutes(w.dow[dow].sleep) * 60;
+	int32_t start_s, end_s;
+	if (now_s >= sleep_s) {
+		start_s = sleep_s;
+		end_s = (minutes(w.dow[(dow + 1) % 7].wake) + (24 * 60)) * 60;
+	} else {
+		start_s = (minutes(w.dow[(dow + 6) % 7].sleep) - (24 * 60)) * 60;
+		end_s = minutes(w.dow[dow].wake) * 60;
+	}
+	return progress_lit(now_s, start_s, end_s, LED_COUNT);
+}
+
+static bool load_schedule(struct otw_week *w) {
+	if (!opt.schedule) {
+		use_default_week(w);
+		return true;
+	}
+	FILE *f = fopen(opt.schedule, "rb");
+	if (!f) {
+		fprintf(stderr, "Cannot read %s\n", opt.schedule);
+		return false;
+	}
+	std::string doc;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		doc.append(buf, n);
+	}
+	fclose(f);
+	if (parse_schedule_json(w, doc.c_str(), doc.size())) {
+		fprintf(stderr, "%s is not a schedule\n", opt.schedule);
+		return false;
+	}
+	return true;
+}
+
+static void parse_args(int argc, char **argv) {
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (!strcmp(arg, "--mqtt")) {
+			opt.mqtt = true;
+			continue;
+		}
+		if (!strcmp(arg, "--light-sleep")) {
+			opt.light_sleep = true;
+			continue;
+		}
+		if (!strcmp(arg, "--solid-night")) {
+			opt.solid_night = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "Missing value for %s\n", arg);
+			exit(1);
+		}
+		const char *val = argv[++i];
+		if (!strcmp(arg, "--schedule")) opt.schedule = val;
+		else if (!strcmp(arg, "--days")) opt.days = atoi(val);
+		else if (!strcmp(arg, "--poll")) opt.poll_s = atoi(val);
+		else if (!strcmp(arg, "--session-ms")) opt.session_ms = atoi(val);
+		else if (!strcmp(arg, "--ota-minutes")) opt.ota_minutes = atoi(val);
+		else if (!strcmp(arg, "--brightness")) opt.brightness = atoi(val);
+		else if (!strcmp(arg, "--work-ms")) opt.work_ms = atoi(val);
+		else if (!strcmp(arg, "--battery")) opt.battery_mah = atoi(val);
+		else {
+			fprintf(stderr, "Unknown option %s\n", arg);
+			exit(1);
+		}
+	}
+	if ((opt.days <= 0) || (opt.poll_s == 0) || (opt.work_ms >= PASS_MS)) {
+		fprintf(stderr, "Invalid options\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv) {
+	host_serial_echo = false;
+	parse_args(argc, argv);
+
+	struct otw_week week;
+	if (!load_schedule(&week)) {
+		return 1;
+	}
+
+	struct energy_account e;
+	energy_init(&e, 0);
+	led_limit_init();
+	uint32_t boot_ua = led_ua(4, LED_COUNT);
+	energy_set_leds(&e, 0, boot_ua, led_lit(boot_ua));
+
+	uint64_t end_ms = (uint64_t)opt.days * ENERGY_DAY_MS;
+	// The radio is on from boot until the first session, and any OTA window, is done
+	uint64_t radio_off_at = opt.session_ms + ((uint64_t)opt.ota_minutes * 60000);
+	uint64_t next_poll_ms = radio_off_at + ((uint64_t)opt.poll_s * 1000);
+	enum energy_radio idle_radio = opt.mqtt ? ENERGY_RADIO_LISTEN : ENERGY_RADIO_OFF;
+	int64_t leds = -1;
+	uint64_t total_uah = 0;
+	char report[256];
+
+	// Events are applied in time order; the accountant only moves forward
+	for (uint64_t t = 0; t < end_ms; t += PASS_MS) {
+		if (radio_off_at && (radio_off_at <= t)) {
+			energy_set_radio(&e, radio_off_at, idle_radio);
+			radio_off_at = 0;
+		}
+		if (!opt.mqtt && (t >= next_poll_ms)) {
+			energy_set_radio(&e, t, ENERGY_RADIO_ACTIVE);
+			radio_off_at = t + opt.session_ms;
+			next_poll_ms += (uint64_t)opt.poll_s * 1000;
+		}
+
+		uint32_t minute_of_week = t / 60000 % (7 * 24 * 60);
+		int dow = minute_of_week / (24 * 60);
+		uint8_t s = light_state(week, dow, minute_of_week % (24 * 60));
+		uint16_t lit = LED_COUNT;
+		if (!opt.solid_night && ((s == E_SLEEP) || (s == E_DOZE))) {
+			lit = night_lit(week, dow, (t / 1000) % (24 * 60 * 60));
+		}
+		uint32_t ua = led_ua(s, lit);
+		if (ua != leds) {
+			energy_set_leds(&e, t, ua, led_lit(ua));
+			leds = ua;
+		}
+
+		uint64_t work_done = t + opt.work_ms;
+		energy_set_cpu(&e, t, ENERGY_CPU_ACTIVE);
+		if (radio_off_at && (radio_off_at < work_done)) {
+			energy_set_radio(&e, radio_off_at, idle_radio);
+			radio_off_at = 0;
+		}
+		energy_set_cpu(&e, work_done, opt.light_sleep ? ENERGY_CPU_SLEEP : ENERGY_CPU_IDLE);
+		if (radio_off_at && (radio_off_at < t + PASS_MS)) {
+			energy_set_radio(&e, radio_off_at, idle_radio);
+			radio_off_at = 0;
+		}
+
+		if ((t + PASS_MS) % ENERGY_DAY_MS == 0) {
+			energy_update(&e, t + PASS_MS);
+			energy_format(&e, report, sizeof(report));
+			printf("Day %llu. %s", (unsigned long long)((t + PASS_MS) / ENERGY_DAY_MS), report);
+			total_uah += energy_total_uah_per_day(&e);
+			energy_reset_window(&e);
+		}
+	}
+
+	uint32_t average = total_uah / opt.days;
+	printf("Average %u.%u mAh/day over %d days\n", average / 1000, (average % 1000) / 100, opt.days);
+	if (opt.battery_mah) {
+		printf("Runtime on %u mAh: %.1f days\n", opt.battery_mah, opt.battery_mah * 1000.0 / average);
+	}
+	return 0;
+}
@@ -0,0 +1,468 @@
+/*
+    Fleet load generator for the okay-to-wake schedule server
+
+    Simulates many clocks polling a schedule server and reports the request
+    rate, latency percentiles, and signs of server saturation. Each simulated
+    clock makes the firmware's request: its own path by chip ID (the shared
+    one after a 404), Accept-Encoding: heatshrink, and the ETag of its last
+    download as If-None-Match. A 304 leaves its schedule as it was; a full
+    response runs through the firmware's heatshrink decoder, streaming
+    parser and calc_week_crc() to decide whether the schedule changed, just
+    as fetch_schedule() does on the device.
+
+    Build (from the repository root):
+
+        gcc -O2 -c src/cJSON.c -o cJSON.o
+        g++ -O2 -std=gnu++17 -pthread -Isrc -Iutility/host \
+            utility/fleet_load.cpp utility/host/host_shim.cpp \
+            src/wake_schedule.cpp src/schedule_store.cpp src/calendar.cpp \
+            src/schedule_stream.cpp src/heatshrink.cpp src/poll_policy.cpp \
+            cJSON.o -o fleet_load
+
+    Example, 5000 clocks booted within the same 10 seconds and polling once a
+    minute (time compressed from the firmware's 60 minutes):
+
+        ./fleet_load --clocks 5000 --threads 128 --period 60 --boot-spread 10
+
+    With --policy each clock instead follows poll_policy.cpp like the firmware
+    does: the server's Cache-Control max-age and Retry-After, chip ID jitter,
+    and backoff on unchanged schedules. Those intervals are in device seconds
+    and are divided by --time-scale to get real seconds.
+
+    Options:
+        --host ADDR         server IPv4 address (127.0.0.1)
+        --port N            server port (80)
+        --path PATH         request path, %06x is replaced by the chip ID
+                            (/download/%06x/okay_to_wake.json)
+        --shared PATH       path used after a 404 (/download/okay_to_wake.json)
+        --clocks N          simulated clocks (1000)
+        --threads N         worker threads issuing requests (64)
+        --period S          seconds between polls of each clock (60)
+        --boot-spread S     clocks boot uniformly within S seconds (0)
+        --duration S        length of the run in seconds (60)
+        --timeout MS        connect and read timeout (5000)
+        --server-pid PID    sample server CPU use from /proc
+        --policy            schedule polls with poll_policy.cpp
+        --time-scale X      device seconds per real second with --policy (60)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Arduino.h"
+#include "heatshrink.h"
+#include "poll_policy.h"
+#include "schedule_store.h"
+#include "schedule_stream.h"
+#include "wake_schedule.h"
+
+using steady = std::chrono::steady_clock;
+
+struct options {
+	const char *host = "127.0.0.1";
+	int port = 80;
+	const char *path = SCHEDULE_PATH_DEVICE;
+	const char *shared = SCHEDULE_PATH_JSON;
+	int clocks = 1000;
+	int threads = 64;
+	double period = 60;
+	double boot_spread = 0;
+	double duration = 60;
+	int timeout_ms = 5000;
+	int server_pid = 0;
+	bool policy = false;
+	double time_scale = 60;
+};
+
+struct sim_clock {
+	uint32_t chip_id;
+	uint32_t crc;
+	bool shared;            // the server had no document for this clock
+	std::string etag;       // of the last schedule applied
+	struct poll_policy poll;
+};
+
+struct http_result {
+	int status;
+	std::string body;
+	std::string cache_control;
+	std::string retry_after;
+	std::string etag;
+	std::string content_encoding;
+};
+
+struct due_entry {
+	steady::time_point due;
+	int clock;
+	bool operator>(const due_entry &o) const { return due > o.due; }
+};
+
+struct interval_stats {
+	std::vector<uint32_t> latency_us;
+	std::vector<uint32_t> lag_us;
+	uint64_t ok = 0;
+	uint64_t errors = 0;
+	uint64_t changed = 0;
+	uint64_t not_modified = 0;
+	uint64_t bytes = 0;
+};
+
+static options opt;
+static std::vector<sim_clock> clocks;
+static std::priority_queue<due_entry, std::vector<due_entry>, std::greater<due_entry>> due_queue;
+static std::mutex queue_lock;
+static std::condition_variable queue_cv;
+static std::mutex stats_lock;
+static interval_stats interval, total;
+static std::atomic<bool> running(true);
+static std::atomic<int> in_flight(0);
+
+static std::string header_value(const std::string &resp, size_t header_end, const char *name) {
+	std::string key = std::string("\r\n") + name + ":";
+	size_t pos = resp.find(key);
+	if ((pos == std::string::npos) || (pos > header_end)) {
+		return std::string();
+	}
+	pos += key.size();
+	while (resp[pos] == ' ') {
+		pos++;
+	}
+	size_t end = resp.find("\r\n", pos);
+	return resp.substr(pos, end - pos);
+}
+
+// One GET on its own connection; status -1 on a transfer error
+static void http_get(const char *path, const std::string &etag, http_result &r) {
+	r.status = -1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return;
+	}
+	struct timeval tv = { opt.timeout_ms / 1000, (opt.timeout_ms % 1000) * 1000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opt.port);
+	inet_pton(AF_INET, opt.host, &addr.sin_addr);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return;
+	}
+
+	// Same request as schedule_get() in sync_session.cpp, closing instead of
+	// keeping the connection for telemetry
+	char req[512];
+	int len = snprintf(req, sizeof(req),
+	                   "GET %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: close\r\n"
+	                   "Accept-Encoding: " HS_CONTENT_ENCODING "\r\n%s%s%s\r\n", path, opt.host, opt.port,
+	                   etag.empty() ? "" : "If-None-Match: ", etag.c_str(), etag.empty() ? "" : "\r\n");
+	if (send(fd, req, len, MSG_NOSIGNAL) != len) {
+		close(fd);
+		return;
+	}
+
+	std::string resp;
+	char buf[4096];
+	ssize_t n;
+	while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		resp.append(buf, n);
+	}
+	close(fd);
+	if (n < 0) {
+		return;
+	}
+
+	size_t header_end = resp.find("\r\n\r\n");
+	if ((header_end == std::string::npos) || (resp.compare(0, 5, "HTTP/") != 0)) {
+		return;
+	}
+	r.status = atoi(resp.c_str() + resp.find(' ') + 1);
+	r.cache_control = header_value(resp, header_end, "Cache-Control");
+	r.retry_after = header_value(resp, header_end, "Retry-After");
+	r.etag = header_value(resp, header_end, "ETag");
+	r.content_encoding = header_value(resp, header_end, "Content-Encoding");
+	r.body.assign(resp, header_end + 4, std::string::npos);
+}
+
+static void feed_parser(void *ctx, const uint8_t *buf, size_t len) {
+	sched_stream_feed((struct sched_stream *)ctx, buf, len);
+}
+
+// The device side of a 200: decode and parse the body as it would arrive
+static bool parse_body(const http_result &r, struct otw_week *week) {
+	static thread_local struct hs_decoder decoder;
+	static thread_local struct sched_stream parser;
+	sched_stream_init(&parser);
+	const uint8_t *buf = (const uint8_t *)r.body.data();
+	if (r.content_encoding == HS_CONTENT_ENCODING) {
+		hs_decoder_init(&decoder);
+		if (hs_decoder_feed(&decoder, buf, r.body.size(), feed_parser, &parser)) {
+			return false;
+		}
+	} else {
+		sched_stream_feed(&parser, buf, r.body.size());
+	}
+	if (sched_stream_finish(&parser) != SCHED_STREAM_WEEK) {
+		return false;
+	}
+	*week = parser.week;
+	return true;
+}
+
+
+// Returns the real seconds until this clock polls again
+static double poll_clock(int idx, steady::time_point due) {
+	sim_clock &c = clocks[idx];
+	char path[256];
+	steady::time_point start = steady::now();
+	http_result r;
+	if (!c.shared) {
+		snprintf(path, sizeof(path), opt.path, c.chip_id);
+		http_get(path, c.etag, r);
+		if (r.status == 404) {
+			c.shared = true;
+		}
+	}
+	if (c.shared) {
+		http_get(opt.shared, c.etag, r);
+	}
+	steady::time_point end = steady::now();
+
+	bool ok = false;
+	bool changed = false;
+	if (r.status == 304) {
+		ok = true;
+	} else if ((r.status == 200) && (r.body.size() < 65536)) {
+		// The device side of check_for_new_schedule()
+		struct otw_week week;
+		if (parse_body(r, &week)) {
+			ok = true;
+			uint32_t crc = calc_week_crc(&week);
+			changed = (crc != c.crc);
+			c.crc = crc;
+			c.etag = (r.etag.size() < STORE_ETAG_LEN) ? r.etag : std::string();
+		}
+	}
+
+	double next_s = opt.period;
+	if (opt.policy) {
+		if (r.status > 0) {
+			poll_policy_server_hint(&c.poll, r.cache_control.c_str(), r.retry_after.c_str());
+		}
+		if (ok) {
+			poll_policy_result(&c.poll, changed);
+		}
+		next_s = poll_policy_next_seconds(&c.poll) / opt.time_scale;
+	}
+
+	uint32_t latency = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	uint32_t lag = std::chrono::duration_cast<std::chrono::microseconds>(start - due).count();
+	std::lock_guard<std::mutex> guard(stats_lock);
+	if (ok) {
+		interval.ok++;
+		interval.latency_us.push_back(latency);
+		interval.changed += changed;
+		interval.not_modified += (r.status == 304);
+		interval.bytes += r.body.size();
+	} else {
+		interval.errors++;
+	}
+	interval.lag_us.push_back(lag);
+	return next_s;
+}
+
+static void worker(void) {
+	std::unique_lock<std::mutex> lock(queue_lock);
+	while (running) {
+		if (due_queue.empty()) {
+			queue_cv.wait(lock);
+			continue;
+		}
+		due_entry next = due_queue.top();
+		if (next.due > steady::now()) {
+			queue_cv.wait_until(lock, next.due);
+			continue;
+		}
+		due_queue.pop();
+		lock.unlock();
+
+		in_flight++;
+		double next_s = poll_clock(next.clock, next.due);
+		in_flight--;
+
+		lock.lock();
+		next.due += std::chrono::microseconds((int64_t)(next_s * 1e6));
+		due_queue.push(next);
+		queue_cv.notify_one();
+	}
+}
+
+static uint32_t percentile(std::vector<uint32_t> &v, double p) {
+	if (v.empty()) {
+		return 0;
+	}
+	size_t k = std::min(v.size() - 1, (size_t)(p * v.size()));
+	std::nth_element(v.begin(), v.begin() + k, v.end());
+	return v[k];
+}
+
+static double server_cpu_seconds(void) {
+	if (!opt.server_pid) {
+		return 0;
+	}
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", opt.server_pid);
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		return 0;
+	}
+	char buf[1024];
+	size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[n] = '\0';
+	// Fields after the command name: state is field 3, utime 14, stime 15
+	char *p = strrchr(buf, ')');
+	unsigned long utime = 0, stime = 0;
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+		return 0;
+	}
+	return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static void print_line(const char *label, interval_stats &s, double seconds, double cpu) {
+	uint64_t requests = s.ok + s.errors;
+	printf("%-8s %8.0f req/s %6llu err  p50 %7.2f ms  p90 %7.2f ms  p99 %7.2f ms  max %7.2f ms  "
+	       "lag p99 %7.2f ms  changed %llu  304 %llu",
+	       label, requests / seconds, (unsigned long long)s.errors,
+	       percentile(s.latency_us, 0.50) / 1000.0, percentile(s.latency_us, 0.90) / 1000.0,
+	       percentile(s.latency_us, 0.99) / 1000.0, percentile(s.latency_us, 1.0) / 1000.0,
+	       percentile(s.lag_us, 0.99) / 1000.0, (unsigned long long)s.changed,
+	       (unsigned long long)s.not_modified);
+	if (opt.server_pid) {
+		printf("  server cpu %5.1f%%", 100.0 * cpu / seconds);
+	}
+	printf("\n");
+}
+
+static void parse_args(int argc, char **argv) {
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (!strcmp(arg, "--policy")) {
+			opt.policy = true;
+			continue;
+		}
+		const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (val == NULL) {
+			fprintf(stderr, "Missing value for %s\n", arg);
+			exit(1);
+		}
+		if (!strcmp(arg, "--host")) opt.host = val;
+		else if (!strcmp(arg, "--port")) opt.port = atoi(val);
+		else if (!strcmp(arg, "--path")) opt.path = val;
+		else if (!strcmp(arg, "--shared")) opt.shared = val;
+		else if (!strcmp(arg, "--clocks")) opt.clocks = atoi(val);
+		else if (!strcmp(arg, "--threads")) opt.threads = atoi(val);
+		else if (!strcmp(arg, "--period")) opt.period = atof(val);
+		else if (!strcmp(arg, "--boot-spread")) opt.boot_spread = atof(val);
+		else if (!strcmp(arg, "--duration")) opt.duration = atof(val);
+		else if (!strcmp(arg, "--timeout")) opt.timeout_ms = atoi(val);
+		else if (!strcmp(arg, "--server-pid")) opt.server_pid = atoi(val);
+		else if (!strcmp(arg, "--time-scale")) opt.time_scale = atof(val);
+		else {
+			fprintf(stderr, "Unknown option %s\n", arg);
+			exit(1);
+		}
+		i++;
+	}
+}
+
+int main(int argc, char **argv) {
+	parse_args(argc, argv);
+	host_serial_echo = false;
+
+	std::mt19937 rng(12345);
+	std::uniform_real_distribution<double> boot(0, opt.boot_spread);
+	steady::time_point start = steady::now();
+	clocks.resize(opt.clocks);
+	for (int i = 0; i < opt.clocks; i++) {
+		clocks[i].chip_id = rng() & 0xFFFFFF;
+		clocks[i].crc = 0;
+		clocks[i].shared = false;
+		poll_policy_init(&clocks[i].poll, clocks[i].chip_id, (uint32_t)(opt.period * opt.time_scale));
+		due_queue.push({ start + std::chrono::microseconds((int64_t)(boot(rng) * 1e6)), i });
+	}
+
+	printf("%d clocks, %d threads, one poll per %.1f s each (offered %.0f req/s), boot spread %.1f s\n",
+	       opt.clocks, opt.threads, opt.period, opt.clocks / opt.period, opt.boot_spread);
+
+	std::vector<std::thread> pool;
+	for (int i = 0; i < opt.threads; i++) {
+		pool.emplace_back(worker);
+	}
+
+	double cpu_start = server_cpu_seconds();
+	double cpu_last = cpu_start;
+	steady::time_point last = start;
+	while (steady::now() - start < std::chrono::duration<double>(opt.duration)) {
+		std::this_thread::sleep_until(last + std::chrono::seconds(1));
+		steady::time_point t = steady::now();
+		interval_stats snap;
+		{
+			std::lock_guard<std::mutex> guard(stats_lock);
+			std::swap(snap, interval);
+		}
+		double cpu = server_cpu_seconds();
+		char label[16];
+		snprintf(label, sizeof(label), "%6.0fs", std::chrono::duration<double>(t - start).count());
+		print_line(label, snap, std::chrono::duration<double>(t - last).count(), cpu - cpu_last);
+		if (in_flight == opt.threads) {
+			printf("         all %d workers busy: client pool or server saturated\n", opt.threads);
+		}
+
+		total.ok += snap.ok;
+		total.errors += snap.errors;
+		total.changed += snap.changed;
+		total.not_modified += snap.not_modified;
+		total.bytes += snap.bytes;
+		total.latency_us.insert(total.latency_us.end(), snap.latency_us.begin(), snap.latency_us.end());
+		total.lag_us.insert(total.lag_us.end(), snap.lag_us.begin(), snap.lag_us.end());
+		cpu_last = cpu;
+		last = t;
+	}
+
+	running = false;
+	queue_cv.notify_all();
+	for (auto &t : pool) {
+		t.join();
+	}
+
+	double elapsed = std::chrono::duration<double>(last - start).count();
+	printf("\n");
+	print_line("total", total, elapsed, cpu_last - cpu_start);
+	printf("%llu bytes received, %.1f bytes per request\n", (unsigned long long)total.bytes,
+	       total.ok ? (double)total.bytes / total.ok : 0.0);
+	return 0;
+}
@@ -0,0 +1,211 @@
+/*
+    Compression benchmark for schedule documents
+
+    For each document: checks that heatshrink output decodes back to the
+    minified JSON and parses to the same week as cJSON, prints the size of
+    every encoding the server offers, and measures how fast the clock's
+    decoder and streaming parser run when fed in --chunk byte pieces like
+    the firmware's download loop.
+
+    Build (from the repository root):
+
+        gcc -O2 -c src/cJSON.c -o cJSON.o
+        g++ -O2 -std=gnu++17 -Isrc -Iutility/host \
+            utility/heatshrink_bench.cpp utility/host/host_shim.cpp \
+            src/heatshrink.cpp src/schedule_stream.cpp \
+            src/wake_schedule.cpp src/schedule_store.cpp src/calendar.cpp \
+            cJSON.o -lz -o heatshrink_bench
+
+    Example:
+
+        ./heatshrink_bench utility/example_sched.json
+
+    Options:
+        --iterations N      decode passes per measurement (20000)
+        --chunk N           bytes handed to the decoder at a time (64)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "cJSON.h"
+#include "heatshrink.h"
+#include "heatshrink_encoder.h"
+#include "schedule_stream.h"
+#include "wake_schedule.h"
+
+using steady = std::chrono::steady_clock;
+
+struct options {
+	int iterations = 20000;
+	size_t chunk = 64;
+};
+
+static options opt;
+// Results are accumulated here so the timed loops are not optimized away
+static volatile size_t sink_total;
+
+static bool read_file(const char *path, std::string &out) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return false;
+	}
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		out.append(buf, n);
+	}
+	fclose(f);
+	return true;
+}
+
+static size_t gzip_size(const std::string &in) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY);
+	std::string out(deflateBound(&zs, in.size()), '\0');
+	zs.next_in = (Bytef *)in.data();
+	zs.avail_in = in.size();
+	zs.next_out = (Bytef *)&out[0];
+	zs.avail_out = out.size();
+	deflate(&zs, Z_FINISH);
+	size_t n = zs.total_out;
+	deflateEnd(&zs);
+	return n;
+}
+
+static void append_sink(void *ctx, const uint8_t *buf, size_t len) {
+	((std::string *)ctx)->append((const char *)buf, len);
+}
+
+static void count_sink(void *ctx, const uint8_t * /* buf */, size_t len) {
+	*(size_t *)ctx += len;
+}
+
+static void parse_sink(void *ctx, const uint8_t *buf, size_t len) {
+	sched_stream_feed((struct sched_stream *)ctx, buf, len);
+}
+
+// Run body() --iterations times and return MB/s of `bytes` per pass
+template <typename F>
+static double throughput(size_t bytes, F body) {
+	auto start = steady::now();
+	for (int i = 0; i < opt.iterations; i++) {
+		body();
+	}
+	double s = std::chrono::duration<double>(steady::now() - start).count();
+	return (bytes * (double)opt.iterations) / s / 1e6;
+}
+
+static int bench_file(const char *path) {
+	std::string raw;
+	if (!read_file(path, raw)) {
+		fprintf(stderr, "%s: cannot read\n", path);
+		return -1;
+	}
+	std::string minified = raw;
+	cJSON_Minify(&minified[0]);
+	minified.resize(strlen(minified.c_str()));
+	std::string hs = hs_encode(minified);
+
+	// Round trip through the firmware decoder, fed in chunks
+	std::string decoded;
+	struct hs_decoder d;
+	hs_decoder_init(&d);
+	for (size_t i = 0; i < hs.size(); i += opt.chunk) {
+		size_t n = ((hs.size() - i) < opt.chunk) ? (hs.size() - i) : opt.chunk;
+		if (hs_decoder_feed(&d, (const uint8_t *)hs.data() + i, n, append_sink, &decoded)) {
+			fprintf(stderr, "%s: decoder error at %zu\n", path, i);
+			return -1;
+		}
+	}
+	if (decoded != minified) {
+		fprintf(stderr, "%s: round trip mismatch\n", path);
+		return -1;
+	}
+
+	struct sched_stream s;
+	sched_stream_init(&s);
+	sched_stream_feed(&s, (const uint8_t *)raw.data(), raw.size());
+	int kind = sched_stream_finish(&s);
+	if (kind == SCHED_STREAM_WEEK) {
+		struct otw_week week;
+		if ((parse_schedule_json(&week, raw.c_str(), raw.size()) != 0) ||
+		    (memcmp(week.dow, s.week.dow, sizeof(week.dow)) != 0)) {
+			fprintf(stderr, "%s: streaming parser disagrees with cJSON\n", path);
+			return -1;
+		}
+	}
+
+	printf("%s\n", path);
+	printf("  raw %zu, minified %zu, heatshrink %zu (%.0f%%), gzip %zu (%.0f%%)\n",
+	       raw.size(), minified.size(),
+	       hs.size(), 100.0 * hs.size() / minified.size(),
+	       gzip_size(minified), 100.0 * gzip_size(minified) / minified.size());
+	printf("  decoder RAM %zu bytes, parser RAM %zu bytes, read buffer %zu bytes\n",
+	       sizeof(struct hs_decoder), sizeof(struct sched_stream), opt.chunk);
+
+	size_t sum = 0;
+	double decode = throughput(minified.size(), [&]() {
+		struct hs_decoder d;
+		hs_decoder_init(&d);
+		for (size_t i = 0; i < hs.size(); i += opt.chunk) {
+			size_t n = ((hs.size() - i) < opt.chunk) ? (hs.size() - i) : opt.chunk;
+			hs_decoder_feed(&d, (const uint8_t *)hs.data() + i, n, count_sink, &sum);
+		}
+	});
+	double decode_parse = throughput(minified.size(), [&]() {
+		struct hs_decoder d;
+		struct sched_stream s;
+		hs_decoder_init(&d);
+		sched_stream_init(&s);
+		for (size_t i = 0; i < hs.size(); i += opt.chunk) {
+			size_t n = ((hs.size() - i) < opt.chunk) ? (hs.size() - i) : opt.chunk;
+			hs_decoder_feed(&d, (const uint8_t *)hs.data() + i, n, parse_sink, &s);
+		}
+		sum += s.have & 1;
+	});
+	double cjson = throughput(minified.size(), [&]() {
+		cJSON *json = cJSON_ParseWithLength(minified.data(), minified.size());
+		sum += (json != NULL);
+		cJSON_Delete(json);
+	});
+	printf("  decode %.1f MB/s, decode + stream parse %.1f MB/s, cJSON parse %.1f MB/s (output bytes)\n",
+	       decode, decode_parse, cjson);
+	sink_total = sum;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	std::vector<const char *> files;
+	host_serial_echo = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--iterations") && (i + 1 < argc)) {
+			opt.iterations = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--chunk") && (i + 1 < argc)) {
+			opt.chunk = atoi(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		} else {
+			files.push_back(argv[i]);
+		}
+	}
+	if (files.empty() || (opt.chunk == 0) || (opt.iterations <= 0)) {
+		fprintf(stderr, "Usage: %s [--iterations N] [--chunk N] FILE...\n", argv[0]);
+		return 1;
+	}
+
+	int err = 0;
+	for (const char *path : files) {
+		err |= bench_file(path);
+	}
+	return err ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+    Host-side heatshrink encoder
+
+    Greedy LZSS producing the bitstream read by src/heatshrink.cpp (the same
+    format as `heatshrink -e -w 8 -l 4`). Used by the schedule server to
+    pre-compress documents and by the benchmark; not built for the clock.
+*/
+
+#include <stdint.h>
+#include <string>
+#include "heatshrink.h"
+
+#define HS_MAX_MATCH (1 << HS_LOOKAHEAD_BITS)
+
+struct hs_bit_writer {
+	std::string out;
+	uint32_t bits = 0;
+	uint8_t count = 0;
+
+	void put(uint32_t value, uint8_t n) {
+		bits = (bits << n) | (value & ((1u << n) - 1));
+		count += n;
+		while (count >= 8) {
+			count -= 8;
+			out.push_back((char)(bits >> count));
+		}
+	}
+
+	void flush(void) {
+		if (count) {
+			out.push_back((char)(bits << (8 - count)));
+			count = 0;
+		}
+	}
+};
+
+static inline std::string hs_encode(const std::string &in) {
+	const uint8_t *p = (const uint8_t *)in.data();
+	size_t len = in.size();
+	hs_bit_writer w;
+
+	size_t i = 0;
+	while (i < len) {
+		size_t best_len = 0;
+		size_t best_dist = 0;
+		size_t max_dist = (i < HS_WINDOW_SIZE) ? i : HS_WINDOW_SIZE;
+		size_t max_len = ((len - i) < HS_MAX_MATCH) ? (len - i) : HS_MAX_MATCH;
+		for (size_t dist = 1; dist <= max_dist; dist++) {
+			size_t n = 0;
+			// Overlapping matches are fine: the decoder copies a byte at a time
+			while ((n < max_len) && (p[i - dist + n] == p[i + n])) {
+				n++;
+			}
+			if (n > best_len) {
+				best_len = n;
+				best_dist = dist;
+				if (n == max_len) {
+					break;
+				}
+			}
+		}
+
+		// A back-reference costs 13 bits, a literal 9
+		if (best_len >= 2) {
+			w.put(0, 1);
+			w.put(best_dist - 1, HS_WINDOW_BITS);
+			w.put(best_len - 1, HS_LOOKAHEAD_BITS);
+			i += best_len;
+		} else {
+			w.put(1, 1);
+			w.put(p[i], 8);
+			i++;
+		}
+	}
+	w.flush();
+	return w.out;
+}
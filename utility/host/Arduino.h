@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * Host stand-in for the parts of the Arduino core used by the portable
+ * firmware modules, so utility/ tools can run the real schedule code.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+// Flash and RAM share one address space on the host
+#define PROGMEM
+#define memcpy_P memcpy
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void yield(void);
+
+// Set to false to silence Serial output (eg: when simulating many clocks)
+extern bool host_serial_echo;
+
+class HardwareSerial {
+public:
+	void begin(unsigned long) {}
+	size_t print(const char *s) { return out("%s", s); }
+	size_t print(char c) { return out("%c", c); }
+	size_t print(int v) { return out("%d", v); }
+	size_t print(unsigned v) { return out("%u", v); }
+	size_t print(long v) { return out("%ld", v); }
+	size_t print(unsigned long v) { return out("%lu", v); }
+	size_t print(double v) { return out("%.2f", v); }
+	size_t println(void) { return out("\n"); }
+	template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+	size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+	size_t write(uint8_t c) { return out("%c", c); }
+	size_t write(const uint8_t *buf, size_t len);
+	int available(void) { return 0; }
+	int read(void) { return -1; }
+private:
+	size_t out(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,31 @@
+#pragma once
+
+// Host stand-in for bakercp/CRC32 (standard reflected CRC-32)
+
+#include <stdint.h>
+#include <stddef.h>
+
+class CRC32 {
+public:
+	void reset(void) { _state = 0xFFFFFFFFUL; }
+	void update(uint8_t data) {
+		_state ^= data;
+		for (uint8_t i = 0; i < 8; i++) {
+			_state = (_state >> 1) ^ (0xEDB88320UL & (0 - (_state & 1)));
+		}
+	}
+	template <typename Type> void update(const Type *data, size_t size) {
+		const uint8_t *p = (const uint8_t *)data;
+		for (size_t i = 0; i < size * sizeof(Type); i++) {
+			update(p[i]);
+		}
+	}
+	uint32_t finalize(void) const { return ~_state; }
+	template <typename Type> static uint32_t calculate(const Type *data, size_t size) {
+		CRC32 crc;
+		crc.update(data, size);
+		return crc.finalize();
+	}
+private:
+	uint32_t _state = 0xFFFFFFFFUL;
+};
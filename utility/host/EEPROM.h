@@ -0,0 +1,28 @@
+#pragma once
+
+// Host stand-in for the ESP8266 EEPROM emulation, backed by RAM
+
+#include <string.h>
+#include "Arduino.h"
+
+class EEPROMClass {
+public:
+	void begin(size_t size) { _size = (size <= sizeof(_data)) ? size : sizeof(_data); }
+	template <typename T> T &get(int address, T &t) {
+		memcpy(&t, _data + address, sizeof(T));
+		return t;
+	}
+	template <typename T> const T &put(int address, const T &t) {
+		memcpy(_data + address, &t, sizeof(T));
+		return t;
+	}
+	bool commit(void) { return true; }
+	uint8_t read(int address) { return _data[address]; }
+	void write(int address, uint8_t value) { _data[address] = value; }
+	size_t length(void) { return _size; }
+private:
+	uint8_t _data[4096];
+	size_t _size = 0;
+};
+
+extern EEPROMClass EEPROM;
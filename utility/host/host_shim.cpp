@@ -0,0 +1,58 @@
+#include <stdarg.h>
+#include <chrono>
+#include <thread>
+#include "Arduino.h"
+#include "EEPROM.h"
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+bool host_serial_echo = true;
+
+static const auto boot = std::chrono::steady_clock::now();
+
+unsigned long millis(void) {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - boot).count();
+}
+
+unsigned long micros(void) {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - boot).count();
+}
+
+void delay(unsigned long ms) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield(void) {
+	std::this_thread::yield();
+}
+
+size_t HardwareSerial::out(const char *fmt, ...) {
+	if (!host_serial_echo) {
+		return 0;
+	}
+	va_list args;
+	va_start(args, fmt);
+	int n = vprintf(fmt, args);
+	va_end(args);
+	return (n > 0) ? n : 0;
+}
+
+size_t HardwareSerial::printf(const char *fmt, ...) {
+	if (!host_serial_echo) {
+		return 0;
+	}
+	va_list args;
+	va_start(args, fmt);
+	int n = vprintf(fmt, args);
+	va_end(args);
+	return (n > 0) ? n : 0;
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+	if (!host_serial_echo) {
+		return len;
+	}
+	return fwrite(buf, 1, len, stdout);
+}
@@ -0,0 +1,187 @@
+/*
+    HTTP response parser check
+
+    Feeds canned responses through the firmware's parser
+    (src/http_response.cpp) the way the clock's socket delivers them: split
+    at every byte boundary, then in random uneven pieces. Each must give
+    the same status, headers and body whatever the split; responses that
+    are malformed, too large or cut short must fail with the right error.
+    Exits non-zero if any check fails.
+
+    Build (from the repository root):
+
+        g++ -O2 -std=gnu++17 -Isrc utility/http_check.cpp src/http_response.cpp -o http_check
+
+    Example:
+
+        ./http_check
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "http_response.h"
+
+struct result {
+	int status;
+	int err;
+	uint8_t error;
+	std::string headers;    // "name=value;" for each header
+	std::string body;
+};
+
+struct expect {
+	const char *name;
+	const char *response;
+	bool close;             // the connection closes after the response
+	uint32_t max_body;
+	int status;
+	uint8_t error;
+	const char *headers;    // NULL to skip the check
+	const char *body;
+};
+
+static void on_header(void *ctx, const char *name, const char *value) {
+	struct result *r = (struct result *)ctx;
+	r->headers += std::string(name) + "=" + value + ";";
+}
+
+static int on_body(void *ctx, const uint8_t *buf, size_t len) {
+	struct result *r = (struct result *)ctx;
+	r->body.append((const char *)buf, len);
+	// A body of "abort" is refused by the callback
+	return (r->body == "abort") ? -1 : 0;
+}
+
+static struct result run(const struct expect &e, const std::vector<size_t> &cuts) {
+	static struct http_response parser;
+	struct result r = {};
+	http_response_init(&parser, e.max_body, on_header, on_body, &r);
+	size_t len = strlen(e.response);
+	size_t pos = 0;
+	for (size_t i = 0; (i <= cuts.size()) && !r.err; i++) {
+		size_t end = (i < cuts.size()) ? cuts[i] : len;
+		r.err = http_response_feed(&parser, (const uint8_t *)e.response + pos, end - pos);
+		pos = end;
+	}
+	if (!r.err && e.close) {
+		r.err = http_response_finish(&parser);
+	} else if (!r.err && !http_response_done(&parser)) {
+		r.err = 1;
+	}
+	r.status = parser.status;
+	r.error = parser.error;
+	return r;
+}
+
+static bool check(const struct expect &e, const struct result &r, const char *how) {
+	bool ok = (r.error == e.error) && ((e.error != HTTP_ERR_NONE) || (!r.err && (r.status == e.status) &&
+	          (!e.headers || (r.headers == e.headers)) && (r.body == e.body)));
+	if (!ok) {
+		printf("FAIL %s (%s): status %d, error %s, err %d, headers \"%s\", body \"%s\"\n", e.name, how, r.status,
+		       http_response_error_str(r.error), r.err, r.headers.c_str(), r.body.c_str());
+	}
+	return ok;
+}
+
+static const struct expect cases[] = {
+	{ "content-length",
+	  "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nX-OTW-Update:  window  \r\n\r\nhello",
+	  false, 1024, 200, HTTP_ERR_NONE, "Content-Length=5;X-OTW-Update=window;", "hello" },
+	{ "bytes after the response are ignored",
+	  "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nhiHTTP/1.1 500 Oops\r\n\r\n",
+	  false, 1024, 200, HTTP_ERR_NONE, NULL, "hi" },
+	{ "chunked with extensions and trailers",
+	  "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip, Chunked\r\n\r\n"
+	  "4;name=x\r\nwiki\r\n5\r\npedia\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\nExpires: never\r\n\r\n",
+	  false, 1024, 200, HTTP_ERR_NONE, NULL, "wikipedia in\r\n\r\nchunks." },
+	{ "body until close, bare LF",
+	  "HTTP/1.0 200 OK\nServer: test\n\nuntil the end",
+	  true, 1024, 200, HTTP_ERR_NONE, "Server=test;", "until the end" },
+	{ "interim 100 skipped",
+	  "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 Created\r\nContent-Length: 3\r\n\r\nnew",
+	  false, 1024, 201, HTTP_ERR_NONE, NULL, "new" },
+	{ "304 has no body",
+	  "HTTP/1.1 304 Not Modified\r\nETag: \"abc\"\r\n\r\n",
+	  false, 1024, 304, HTTP_ERR_NONE, "ETag=\"abc\";", "" },
+	{ "empty body",
+	  "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n",
+	  false, 1024, 404, HTTP_ERR_NONE, NULL, "" },
+	{ "no reason phrase",
+	  "HTTP/1.1 200\r\nContent-Length: 1\r\n\r\nx",
+	  false, 1024, 200, HTTP_ERR_NONE, NULL, "x" },
+	{ "overlong header skipped",
+	  "HTTP/1.1 200 OK\r\nX-Long: "
+	  "................................................................................................"
+	  "................................................................................................"
+	  "................................................................................................"
+	  "................................................................................................"
+	  "................................................................................................"
+	  "................................................................................................"
+	  "\r\nContent-Length: 2\r\n\r\nok",
+	  false, 1024, 200, HTTP_ERR_NONE, "Content-Length=2;", "ok" },
+	{ "length over max_body",
+	  "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world",
+	  false, 10, 0, HTTP_ERR_TOO_LARGE, NULL, NULL },
+	{ "chunks over max_body",
+	  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n6\r\nhello \r\n5\r\nworld\r\n0\r\n\r\n",
+	  false, 10, 0, HTTP_ERR_TOO_LARGE, NULL, NULL },
+	{ "body until close over max_body",
+	  "HTTP/1.1 200 OK\r\n\r\nhello world",
+	  true, 10, 0, HTTP_ERR_TOO_LARGE, NULL, NULL },
+	{ "cut short",
+	  "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nhello",
+	  true, 1024, 0, HTTP_ERR_TRUNCATED, NULL, NULL },
+	{ "cut short in a chunk",
+	  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhel",
+	  true, 1024, 0, HTTP_ERR_TRUNCATED, NULL, NULL },
+	{ "cut short in the headers",
+	  "HTTP/1.1 200 OK\r\nContent-",
+	  true, 1024, 0, HTTP_ERR_TRUNCATED, NULL, NULL },
+	{ "not HTTP",
+	  "SSH-2.0-OpenSSH_9.6\r\n",
+	  false, 1024, 0, HTTP_ERR_PROTOCOL, NULL, NULL },
+	{ "bad length",
+	  "HTTP/1.1 200 OK\r\nContent-Length: 12x\r\n\r\n",
+	  false, 1024, 0, HTTP_ERR_PROTOCOL, NULL, NULL },
+	{ "bad chunk size",
+	  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+	  false, 1024, 0, HTTP_ERR_PROTOCOL, NULL, NULL },
+	{ "missing CRLF after chunk",
+	  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nokX\r\n0\r\n\r\n",
+	  false, 1024, 0, HTTP_ERR_PROTOCOL, NULL, NULL },
+	{ "refused by the body callback",
+	  "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nabort",
+	  false, 1024, 0, HTTP_ERR_ABORTED, NULL, NULL },
+};
+
+int main(void) {
+	int failed = 0;
+	int runs = 0;
+	srand(1);
+	for (const struct expect &e : cases) {
+		size_t len = strlen(e.response);
+		bool ok = check(e, run(e, {}), "whole");
+		for (size_t cut = 1; ok && (cut < len); cut++) {
+			char how[32];
+			snprintf(how, sizeof(how), "split at %zu", cut);
+			ok = check(e, run(e, { cut }), how);
+			runs++;
+		}
+		for (int i = 0; ok && (i < 200); i++) {
+			std::vector<size_t> cuts;
+			for (size_t pos = 1 + rand() % 8; pos < len; pos += 1 + rand() % 8) {
+				cuts.push_back(pos);
+			}
+			ok = check(e, run(e, cuts), "random pieces");
+			runs++;
+		}
+		printf("%-40s %s\n", e.name, ok ? "ok" : "FAILED");
+		failed += !ok;
+	}
+	printf("%d of %zu cases failed (%d runs)\n", failed, sizeof(cases) / sizeof(cases[0]), runs);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,749 @@
+/*
+    Local MQTT broker for okay-to-wake clocks
+
+    A stand-in for the broker the nodemcuv2-mqtt build listens to (see
+    src/mqtt_link.h), for testing push updates without a full MQTT
+    installation. It speaks the part of MQTT 3.1.1 the clock and a publishing
+    script need: CONNECT with clean or persistent sessions, SUBSCRIBE with
+    + and # wildcards, PUBLISH at QoS 0 and 1, retained messages, PINGREQ and
+    DISCONNECT. QoS 1 messages for a persistent session are queued while the
+    client is away and sent again, flagged DUP, until acknowledged. Clients
+    that stay silent for 1.5 keepalive periods are dropped. QoS 2 and will
+    messages are not supported.
+
+    With --dir, documents laid out like the schedule server's per-device
+    paths are published as retained QoS 1 messages on the clock's topics:
+
+        DIR/<chip id>/okay_to_wake.json           okay-to-wake/<chip id>/schedule
+        DIR/<chip id>/okay_to_wake_calendar.json  okay-to-wake/<chip id>/calendar
+
+    The files are checked every --scan seconds and published again when they
+    change, so editing one reaches a listening clock within seconds. JSON is
+    minified first; a message that still exceeds the clock's MQTT_MAX_PAYLOAD
+    buffer is published with a warning, as the clock will drop it.
+
+    Build (from the repository root):
+
+        gcc -O2 -c src/cJSON.c -o cJSON.o
+        g++ -O2 -std=gnu++17 -Isrc utility/mqtt_broker.cpp cJSON.o -o mqtt_broker
+
+    Example:
+
+        ./mqtt_broker --dir schedules --port 1883
+
+    Options:
+        --port N        listen port (1883)
+        --dir DIR       publish documents from DIR (none)
+        --scan S        check DIR for changed documents every S seconds (1)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cJSON.h"
+#include "mqtt_link.h"
+
+struct options {
+	int port = 1883;
+	const char *dir = NULL;
+	int scan = 1;
+};
+
+static options opt;
+
+// Packets larger than this close the connection
+#define MAX_PACKET (256 * 1024)
+
+enum packet_type {
+	CONNECT = 1,
+	CONNACK,
+	PUBLISH,
+	PUBACK,
+	PUBREC,
+	PUBREL,
+	PUBCOMP,
+	SUBSCRIBE,
+	SUBACK,
+	UNSUBSCRIBE,
+	UNSUBACK,
+	PINGREQ,
+	PINGRESP,
+	DISCONNECT
+};
+
+struct message {
+	std::string topic;
+	std::string payload;
+	uint8_t qos;
+};
+
+struct inflight {
+	uint16_t id;
+	message msg;
+	bool sent;
+};
+
+struct session {
+	bool clean = true;
+	int fd = -1;                            // -1 while the client is away
+	std::map<std::string, uint8_t> subs;    // filter -> granted QoS
+	std::deque<inflight> queue;             // QoS 1, not yet acknowledged
+	uint16_t next_id = 1;
+};
+
+struct connection {
+	std::string in;
+	std::string out;
+	std::string client_id;                  // empty until CONNECT
+	uint16_t keepalive = 0;
+	time_t last_rx = 0;
+	bool closing = false;                   // close once out is flushed
+};
+
+static std::map<int, connection> conns;
+static std::map<std::string, session> sessions;
+static std::map<std::string, std::string> retained;
+
+static double now_s(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Encoding
+ */
+
+static void put_u16(std::string &out, uint16_t v) {
+	out += (char)(v >> 8);
+	out += (char)(v & 0xFF);
+}
+
+static void put_string(std::string &out, const std::string &s) {
+	put_u16(out, s.size());
+	out += s;
+}
+
+static std::string packet(uint8_t first, const std::string &body) {
+	std::string out(1, (char)first);
+	size_t len = body.size();
+	do {
+		uint8_t b = len & 0x7F;
+		len >>= 7;
+		out += (char)(len ? (b | 0x80) : b);
+	} while (len);
+	return out + body;
+}
+
+static void send_publish(connection &c, const message &m, uint16_t id, bool dup, bool retain) {
+	std::string body;
+	put_string(body, m.topic);
+	if (m.qos) {
+		put_u16(body, id);
+	}
+	body += m.payload;
+	c.out += packet((PUBLISH << 4) | (dup ? 0x08 : 0) | (m.qos << 1) | (retain ? 1 : 0), body);
+}
+
+/*
+ * Decoding
+ */
+
+struct reader {
+	const std::string &buf;
+	size_t pos;
+	size_t end;
+	bool ok;
+
+	bool more(size_t n) {
+		ok = ok && (pos + n <= end);
+		return ok;
+	}
+	uint8_t u8(void) {
+		return more(1) ? (uint8_t)buf[pos++] : 0;
+	}
+	uint16_t u16(void) {
+		if (!more(2)) {
+			return 0;
+		}
+		uint16_t v = ((uint8_t)buf[pos] << 8) | (uint8_t)buf[pos + 1];
+		pos += 2;
+		return v;
+	}
+	std::string str(void) {
+		uint16_t n = u16();
+		if (!more(n)) {
+			return "";
+		}
+		pos += n;
+		return buf.substr(pos - n, n);
+	}
+};
+
+static std::vector<std::string> levels(const std::string &s) {
+	std::vector<std::string> out;
+	size_t start = 0, slash;
+	while ((slash = s.find('/', start)) != std::string::npos) {
+		out.push_back(s.substr(start, slash - start));
+		start = slash + 1;
+	}
+	out.push_back(s.substr(start));
+	return out;
+}
+
+// MQTT topic filter match: + is one level, # the rest (including none)
+static bool topic_matches(const std::string &filter, const std::string &topic) {
+	std::vector<std::string> f = levels(filter);
+	std::vector<std::string> t = levels(topic);
+	for (size_t i = 0; i < f.size(); i++) {
+		if (f[i] == "#") {
+			return true;
+		}
+		if ((i >= t.size()) || ((f[i] != "+") && (f[i] != t[i]))) {
+			return false;
+		}
+	}
+	return f.size() == t.size();
+}
+
+/*
+ * Routing
+ */
+
+// Send queued QoS 1 messages that have not gone out on this connection yet
+static void flush_queue(session &s) {
+	auto it = conns.find(s.fd);
+	if (it == conns.end()) {
+		return;
+	}
+	for (inflight &q : s.queue) {
+		if (!q.sent) {
+			send_publish(it->second, q.msg, q.id, false, false);
+			q.sent = true;
+		}
+	}
+}
+
+static void publish(const message &m, bool retain) {
+	if (retain) {
+		if (m.payload.empty()) {
+			retained.erase(m.topic);
+		} else {
+			retained[m.topic] = m.payload;
+		}
+	}
+	for (auto &entry : sessions) {
+		session &s = entry.second;
+		int qos = -1;
+		for (auto &sub : s.subs) {
+			if (topic_matches(sub.first, m.topic)) {
+				qos = std::max(qos, (int)sub.second);
+			}
+		}
+		if (qos < 0) {
+			continue;
+		}
+		message out = m;
+		out.qos = std::min((int)m.qos, qos);
+		if (out.qos == 0) {
+			auto it = conns.find(s.fd);
+			if (it != conns.end()) {
+				send_publish(it->second, out, 0, false, false);
+			}
+			continue;
+		}
+		s.queue.push_back({ s.next_id, out, false });
+		s.next_id = (s.next_id == 0xFFFF) ? 1 : s.next_id + 1;
+		flush_queue(s);
+	}
+}
+
+/*
+ * Packets
+ */
+
+// The connection on fd is gone: end a clean session, park a persistent one
+static void drop_session_link(int fd, connection &c) {
+	auto it = sessions.find(c.client_id);
+	if ((it == sessions.end()) || (it->second.fd != fd)) {
+		return;
+	}
+	if (it->second.clean) {
+		sessions.erase(it);
+	} else {
+		it->second.fd = -1;
+	}
+}
+
+static bool on_connect(int fd, connection &c, reader &r) {
+	std::string protocol = r.str();
+	uint8_t level = r.u8();
+	uint8_t flags = r.u8();
+	c.keepalive = r.u16();
+	std::string client_id = r.str();
+	if (flags & 0x04) {
+		r.str();    // will topic
+		r.str();    // will message
+	}
+	if (flags & 0x80) {
+		r.str();
+	}
+	if (flags & 0x40) {
+		r.str();
+	}
+	if (!r.ok || !c.client_id.empty()) {
+		return false;
+	}
+	if ((protocol != "MQTT") || (level != 4)) {
+		c.out += packet(CONNACK << 4, std::string("\0\x01", 2));
+		c.closing = true;
+		return true;
+	}
+	bool clean = flags & 0x02;
+	if (client_id.empty()) {
+		if (!clean) {
+			c.out += packet(CONNACK << 4, std::string("\0\x02", 2));
+			c.closing = true;
+			return true;
+		}
+		client_id = "anonymous-" + std::to_string(fd);
+	}
+
+	// A second connection with the same ID takes the session over
+	auto existing = sessions.find(client_id);
+	if ((existing != sessions.end()) && (existing->second.fd >= 0) && (existing->second.fd != fd)) {
+		printf("%s: taken over, closing the old connection\n", client_id.c_str());
+		int old_fd = existing->second.fd;
+		connection &old = conns[old_fd];
+		drop_session_link(old_fd, old);
+		old.client_id.clear();
+		old.closing = true;
+		old.out.clear();
+		existing = sessions.find(client_id);
+	}
+	if (clean && (existing != sessions.end())) {
+		sessions.erase(existing);
+		existing = sessions.end();
+	}
+	bool present = (existing != sessions.end());
+	session &s = sessions[client_id];
+	s.clean = clean;
+	s.fd = fd;
+	c.client_id = client_id;
+	c.out += packet(CONNACK << 4, std::string(1, present ? 1 : 0) + std::string(1, 0));
+	printf("%s: connected, %s session%s, keepalive %u s\n", client_id.c_str(), clean ? "clean" : "persistent",
+	       present ? " resumed" : "", c.keepalive);
+
+	// Unacknowledged messages go out again flagged as duplicates
+	for (inflight &q : s.queue) {
+		send_publish(c, q.msg, q.id, q.sent, false);
+		q.sent = true;
+	}
+	flush_queue(s);
+	return true;
+}
+
+static bool on_publish(connection &c, uint8_t flags, reader &r) {
+	message m;
+	m.qos = (flags >> 1) & 3;
+	m.topic = r.str();
+	uint16_t id = m.qos ? r.u16() : 0;
+	if (!r.ok || (m.qos > 1) || m.topic.empty()) {
+		return false;
+	}
+	m.payload = r.buf.substr(r.pos, r.end - r.pos);
+	if (m.qos) {
+		std::string body;
+		put_u16(body, id);
+		c.out += packet(PUBACK << 4, body);
+	}
+	printf("%s: publish %s (%zu bytes, QoS %u%s)\n", c.client_id.c_str(), m.topic.c_str(), m.payload.size(), m.qos,
+	       (flags & 1) ? ", retained" : "");
+	publish(m, flags & 1);
+	return true;
+}
+
+static bool on_puback(connection &c, reader &r) {
+	uint16_t id = r.u16();
+	auto it = sessions.find(c.client_id);
+	if (!r.ok || (it == sessions.end())) {
+		return false;
+	}
+	std::deque<inflight> &queue = it->second.queue;
+	for (auto q = queue.begin(); q != queue.end(); ++q) {
+		if (q->id == id) {
+			printf("%s: acknowledged %s\n", c.client_id.c_str(), q->msg.topic.c_str());
+			queue.erase(q);
+			break;
+		}
+	}
+	return true;
+}
+
+static bool on_subscribe(connection &c, reader &r) {
+	uint16_t id = r.u16();
+	std::string body;
+	put_u16(body, id);
+	session &s = sessions[c.client_id];
+	std::vector<std::string> filters;
+	while (r.ok && (r.pos < r.end)) {
+		std::string filter = r.str();
+		uint8_t qos = r.u8();
+		if (!r.ok || filter.empty()) {
+			return false;
+		}
+		uint8_t granted = std::min<uint8_t>(qos & 3, 1);
+		s.subs[filter] = granted;
+		body += (char)granted;
+		filters.push_back(filter);
+		printf("%s: subscribed to %s, QoS %u\n", c.client_id.c_str(), filter.c_str(), granted);
+	}
+	if (!r.ok || filters.empty()) {
+		return false;
+	}
+	c.out += packet(SUBACK << 4, body);
+
+	// Retained messages follow the SUBACK, flagged as retained
+	for (auto &ret : retained) {
+		for (const std::string &filter : filters) {
+			if (!topic_matches(filter, ret.first)) {
+				continue;
+			}
+			message m = { ret.first, ret.second, s.subs[filter] };
+			if (m.qos == 0) {
+				send_publish(c, m, 0, false, true);
+			} else {
+				s.queue.push_back({ s.next_id, m, true });
+				send_publish(c, m, s.next_id, false, true);
+				s.next_id = (s.next_id == 0xFFFF) ? 1 : s.next_id + 1;
+			}
+			break;
+		}
+	}
+	return true;
+}
+
+static bool on_unsubscribe(connection &c, reader &r) {
+	uint16_t id = r.u16();
+	session &s = sessions[c.client_id];
+	while (r.ok && (r.pos < r.end)) {
+		s.subs.erase(r.str());
+	}
+	if (!r.ok) {
+		return false;
+	}
+	std::string body;
+	put_u16(body, id);
+	c.out += packet(UNSUBACK << 4, body);
+	return true;
+}
+
+// Handle one complete packet; false closes the connection
+static bool handle_packet(int fd, connection &c, uint8_t first, size_t start, size_t len) {
+	reader r = { c.in, start, start + len, true };
+	uint8_t type = first >> 4;
+	if ((type != CONNECT) && c.client_id.empty()) {
+		return false;
+	}
+	switch (type) {
+	case CONNECT:
+		return on_connect(fd, c, r);
+	case PUBLISH:
+		return on_publish(c, first & 0x0F, r);
+	case PUBACK:
+		return on_puback(c, r);
+	case SUBSCRIBE:
+		return on_subscribe(c, r);
+	case UNSUBSCRIBE:
+		return on_unsubscribe(c, r);
+	case PINGREQ:
+		c.out += packet(PINGRESP << 4, "");
+		return true;
+	case DISCONNECT:
+		printf("%s: disconnected\n", c.client_id.c_str());
+		c.closing = true;
+		return true;
+	default:
+		printf("%s: unsupported packet type %u\n", c.client_id.c_str(), type);
+		return false;
+	}
+}
+
+// Handle every complete packet in the input buffer
+static bool handle_input(int fd, connection &c) {
+	size_t pos = 0;
+	while (!c.closing && (pos + 2 <= c.in.size())) {
+		uint8_t first = c.in[pos];
+		size_t len = 0;
+		size_t i = pos + 1;
+		int shift = 0;
+		bool complete = false;
+		while ((i < c.in.size()) && (shift <= 21)) {
+			uint8_t b = c.in[i++];
+			len |= (size_t)(b & 0x7F) << shift;
+			shift += 7;
+			if (!(b & 0x80)) {
+				complete = true;
+				break;
+			}
+		}
+		if (!complete) {
+			if (shift > 21) {
+				return false;
+			}
+			break;
+		}
+		if (len > MAX_PACKET) {
+			return false;
+		}
+		if (i + len > c.in.size()) {
+			break;
+		}
+		if (!handle_packet(fd, c, first, i, len)) {
+			return false;
+		}
+		pos = i + len;
+	}
+	c.in.erase(0, pos);
+	return true;
+}
+
+/*
+ * Documents
+ */
+
+struct watched {
+	std::string path;
+	std::string topic;
+	time_t mtime;
+	off_t size;
+};
+
+static std::map<std::string, watched> documents;
+
+static std::string read_document(const std::string &path) {
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f) {
+		return "";
+	}
+	std::string body;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		body.append(buf, n);
+	}
+	fclose(f);
+	cJSON *json = cJSON_ParseWithLength(body.data(), body.size());
+	if (json) {
+		char *min = cJSON_PrintUnformatted(json);
+		body = min;
+		free(min);
+		cJSON_Delete(json);
+	}
+	return body;
+}
+
+static void check_document(const std::string &path, const char *topic_format, uint32_t chip_id) {
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0) {
+		return;
+	}
+	watched &w = documents[path];
+	if ((w.mtime == st.st_mtime) && (w.size == st.st_size)) {
+		return;
+	}
+	char topic[64];
+	snprintf(topic, sizeof(topic), topic_format, chip_id);
+	w = { path, topic, st.st_mtime, st.st_size };
+	message m = { topic, read_document(path), 1 };
+	if (m.payload.empty()) {
+		return;
+	}
+	// PubSubClient's buffer holds the fixed header, topic and payload
+	if (m.payload.size() + m.topic.size() + 7 > MQTT_MAX_PAYLOAD) {
+		printf("Warning: %s is %zu bytes, over the clock's %d byte MQTT buffer\n", path.c_str(), m.payload.size(),
+		       MQTT_MAX_PAYLOAD);
+	}
+	printf("Publishing %s on %s (%zu bytes)\n", path.c_str(), topic, m.payload.size());
+	publish(m, true);
+}
+
+static void scan_documents(void) {
+	DIR *d = opendir(opt.dir);
+	if (!d) {
+		return;
+	}
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL) {
+		char *end;
+		uint32_t chip_id = strtoul(e->d_name, &end, 16);
+		if ((e->d_name[0] == '\0') || (*end != '\0') || (e->d_name[0] == '.')) {
+			continue;
+		}
+		std::string base = std::string(opt.dir) + "/" + e->d_name;
+		check_document(base + "/okay_to_wake.json", MQTT_TOPIC_SCHEDULE, chip_id);
+		check_document(base + "/okay_to_wake_calendar.json", MQTT_TOPIC_CALENDAR, chip_id);
+	}
+	closedir(d);
+}
+
+/*
+ * Event loop
+ */
+
+static int make_listener(void) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opt.port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+		perror("listen");
+		exit(1);
+	}
+	return fd;
+}
+
+static void close_connection(int fd) {
+	connection &c = conns[fd];
+	if (!c.client_id.empty()) {
+		printf("%s: connection closed\n", c.client_id.c_str());
+		drop_session_link(fd, c);
+	}
+	close(fd);
+	conns.erase(fd);
+}
+
+static void parse_args(int argc, char **argv) {
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const char *arg = argv[i];
+		const char *val = argv[i + 1];
+		if (!strcmp(arg, "--port")) opt.port = atoi(val);
+		else if (!strcmp(arg, "--dir")) opt.dir = val;
+		else if (!strcmp(arg, "--scan")) opt.scan = atoi(val);
+		else {
+			fprintf(stderr, "Unknown option %s\n", arg);
+			exit(1);
+		}
+	}
+	if (argc % 2 == 0) {
+		fprintf(stderr, "Missing value for %s\n", argv[argc - 1]);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv) {
+	parse_args(argc, argv);
+	signal(SIGPIPE, SIG_IGN);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	int listener = make_listener();
+	printf("Listening on port %d\n", opt.port);
+
+	double last_scan = 0;
+	char buf[16384];
+	while (true) {
+		if (opt.dir && (now_s() - last_scan >= opt.scan)) {
+			last_scan = now_s();
+			scan_documents();
+		}
+
+		std::vector<struct pollfd> fds;
+		fds.push_back({ listener, POLLIN, 0 });
+		for (auto &entry : conns) {
+			short events = POLLIN;
+			if (!entry.second.out.empty()) {
+				events |= POLLOUT;
+			}
+			fds.push_back({ entry.first, events, 0 });
+		}
+		poll(fds.data(), fds.size(), 250);
+
+		if (fds[0].revents & POLLIN) {
+			int cfd;
+			while ((cfd = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+				int one = 1;
+				setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				conns[cfd].last_rx = time(NULL);
+			}
+		}
+
+		std::vector<int> dead;
+		for (size_t i = 1; i < fds.size(); i++) {
+			int fd = fds[i].fd;
+			auto it = conns.find(fd);
+			if (it == conns.end()) {
+				continue;
+			}
+			connection &c = it->second;
+			bool closed = false;
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				ssize_t r;
+				while ((r = read(fd, buf, sizeof(buf))) > 0) {
+					c.in.append(buf, r);
+					c.last_rx = time(NULL);
+				}
+				if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+					closed = true;
+				}
+				if (!handle_input(fd, c)) {
+					printf("%s: protocol error\n", c.client_id.empty() ? "?" : c.client_id.c_str());
+					closed = true;
+				}
+			}
+			if (c.keepalive && (time(NULL) - c.last_rx > c.keepalive * 3 / 2)) {
+				printf("%s: keepalive expired\n", c.client_id.c_str());
+				closed = true;
+			}
+			if (closed) {
+				dead.push_back(fd);
+			}
+		}
+		for (int fd : dead) {
+			close_connection(fd);
+		}
+
+		// Publishing may have queued output on any connection
+		dead.clear();
+		for (auto &entry : conns) {
+			connection &c = entry.second;
+			while (!c.out.empty()) {
+				ssize_t w = write(entry.first, c.out.data(), c.out.size());
+				if (w <= 0) {
+					if ((w < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+						dead.push_back(entry.first);
+					}
+					break;
+				}
+				c.out.erase(0, w);
+			}
+			if (c.closing && c.out.empty()) {
+				dead.push_back(entry.first);
+			}
+		}
+		for (int fd : dead) {
+			if (conns.count(fd)) {
+				close_connection(fd);
+			}
+		}
+	}
+}
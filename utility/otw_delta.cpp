@@ -0,0 +1,77 @@
+/*
+    Delta patch generator for okay-to-wake firmware
+
+    Writes a patch that turns the firmware image the clocks are running into
+    a new one (format in src/delta_patch.h). Serve it from the schedule
+    server's directory with a .otwd name and flag it with a firmware_update
+    file; the clock then pulls it instead of the whole image and applies it
+    while streaming into the OTA partition. Prints the size of the patch as
+    it goes over the air (heatshrink compressed by the server) next to the
+    size of the full image.
+
+    Build (from the repository root):
+
+        g++ -O2 -std=gnu++17 -Isrc -Iutility/host utility/otw_delta.cpp -o otw_delta
+
+    Example:
+
+        ./otw_delta old/firmware.bin .pio/build/nodemcuv2/firmware.bin \
+            schedules/firmware.otwd
+
+    Keep the firmware.bin of every release; a patch only applies to the exact
+    image it was made from.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "delta_encoder.h"
+#include "heatshrink_encoder.h"
+
+static bool read_file(const char *path, std::string &out) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Cannot read %s\n", path);
+		return false;
+	}
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		out.append(buf, n);
+	}
+	fclose(f);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 4) {
+		fprintf(stderr, "Usage: %s OLD NEW PATCH\n", argv[0]);
+		return 1;
+	}
+	std::string old_image, new_image;
+	if (!read_file(argv[1], old_image) || !read_file(argv[2], new_image)) {
+		return 1;
+	}
+	if (new_image.empty()) {
+		fprintf(stderr, "%s is empty\n", argv[2]);
+		return 1;
+	}
+
+	std::string patch = delta_encode(old_image, new_image);
+	FILE *f = fopen(argv[3], "wb");
+	if (!f || (fwrite(patch.data(), 1, patch.size(), f) != patch.size())) {
+		fprintf(stderr, "Cannot write %s\n", argv[3]);
+		return 1;
+	}
+	fclose(f);
+
+	size_t patch_hs = hs_encode(patch).size();
+	size_t image_hs = hs_encode(new_image).size();
+	printf("old image  %8zu bytes\n", old_image.size());
+	printf("new image  %8zu bytes, %8zu heatshrink\n", new_image.size(), image_hs);
+	printf("patch      %8zu bytes, %8zu heatshrink (%.1f%% of the image)\n", patch.size(), patch_hs,
+	       100.0 * patch_hs / image_hs);
+	return 0;
+}
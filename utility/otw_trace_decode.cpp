@@ -0,0 +1,227 @@
+/*
+    RTC event trace decoder
+
+    Turns the TRACE lines printed by the clock's trace console command (see
+    src/trace.h) into a timeline. Paste or pipe a serial log in; anything
+    that is not a TRACE line is ignored, so monitor timestamps and other
+    output can stay.
+
+    Times are UTC unless --utc-offset is given. Events between a reset and
+    the next NTP sync are marked with ~, since the clock then runs from its
+    build time. Events older than the oldest time record have no date if
+    the clock was reset or set just after them.
+
+    Build (from the repository root):
+
+        g++ -O2 -std=gnu++17 -Isrc utility/otw_trace_decode.cpp -o otw_trace_decode
+
+    Examples:
+
+        pio device monitor | tee clock.log      # then type: trace
+        ./otw_trace_decode clock.log
+        ./otw_trace_decode --utc-offset -6 < clock.log
+
+    Options:
+        --utc-offset H      show local times H hours from UTC
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "trace.h"
+#include "stall.h"
+#include "sync_session.h"
+#include "wake_schedule.h"
+
+static const char *stage_names[SYNC_STAGES] = {
+	"associate", "dns", "time", "schedule", "calendar", "telemetry", "update", "disconnect"
+};
+
+static const char *state_names[] = { DOZE_STR, WAKE_STR, DAY_STR, SLEEP_STR, "schedule" };
+
+static const char *day_names[7] = { "monday", "tuesday", "wednesday", "thursday", "friday", "saturday", "sunday" };
+
+// rst_info.reason on the ESP8266
+static const char *reset_names[] = {
+	"power on", "hardware watchdog", "exception", "software watchdog", "restart", "deep sleep wake", "reset pin"
+};
+
+static const char *update_names[] = { "none", "ota window", "pull" };
+
+static const char *error_names[TRACE_ERRORS] = { "config store unreadable", "firmware update failed" };
+
+static const char *stall_names[STALL_REGIONS] = {
+	"loop", "wifi", "dns", "ntp", "schedule", "calendar", "telemetry", "update", "ota", "mqtt"
+};
+
+#define NAME(table, i) (((i) < sizeof(table) / sizeof(table[0])) ? table[i] : "?")
+
+// Every hex word on TRACE lines, in order
+static bool read_words(FILE *f, std::vector<uint32_t> &words) {
+	char line[512];
+	while (fgets(line, sizeof(line), f)) {
+		char *p = strstr(line, "TRACE ");
+		if (!p) {
+			continue;
+		}
+		p += 6;
+		char *end;
+		while (true) {
+			uint32_t w = strtoul(p, &end, 16);
+			if (end == p) {
+				break;
+			}
+			words.push_back(w);
+			p = end;
+		}
+	}
+	return !words.empty();
+}
+
+static void describe(uint32_t r, char *buf, size_t len) {
+	uint8_t arg = TRACE_ARG_OF(r);
+	switch (TRACE_ID_OF(r)) {
+	case TRACE_BOOT:
+		snprintf(buf, len, "boot, reset reason %u (%s)", arg, NAME(reset_names, arg));
+		break;
+	case TRACE_STATE:
+		snprintf(buf, len, "state %s", NAME(state_names, arg));
+		break;
+	case TRACE_FORCED:
+		snprintf(buf, len, (arg > E_SLEEP) ? "console released the state" : "console forced state %s",
+		         NAME(state_names, arg));
+		break;
+	case TRACE_DAY:
+		snprintf(buf, len, "day %s%s", NAME(day_names, arg & 0x7F), (arg & 0x80) ? ", calendar exception" : "");
+		break;
+	case TRACE_SYNC_START:
+		snprintf(buf, len, "sync session");
+		break;
+	case TRACE_SYNC_DONE: {
+		int n = snprintf(buf, len, "sync done");
+		const char *sep = ", failed: ";
+		for (uint8_t s = 0; (s < SYNC_STAGES) && (n < (int)len); s++) {
+			if (arg & (1 << s)) {
+				n += snprintf(buf + n, len - n, "%s%s", sep, stage_names[s]);
+				sep = " ";
+			}
+		}
+		break;
+	}
+	case TRACE_CLOCK:
+		snprintf(buf, len, "clock set from NTP after %u request(s)", arg);
+		break;
+	case TRACE_SCHEDULE:
+		snprintf(buf, len, "new schedule, crc ..%02x", arg);
+		break;
+	case TRACE_UPDATE:
+		snprintf(buf, len, "firmware update: %s", NAME(update_names, arg));
+		break;
+	case TRACE_ERROR:
+		snprintf(buf, len, "error: %s", NAME(error_names, arg));
+		break;
+	case TRACE_STALL:
+		snprintf(buf, len, "loop stalled, mostly in %s", NAME(stall_names, arg));
+		break;
+	default:
+		snprintf(buf, len, "unknown event %u, arg %u", TRACE_ID_OF(r), arg);
+		break;
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *path = NULL;
+	long offset_s = 0;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--utc-offset") && (i + 1 < argc)) {
+			offset_s = (long)(atof(argv[++i]) * 3600);
+		} else if (argv[i][0] != '-') {
+			path = argv[i];
+		} else {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	FILE *f = path ? fopen(path, "r") : stdin;
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+	std::vector<uint32_t> words;
+	bool found = read_words(f, words);
+	if (path) {
+		fclose(f);
+	}
+	if (!found) {
+		fprintf(stderr, "No TRACE lines found\n");
+		return 1;
+	}
+	if (!TRACE_VALID(words[0])) {
+		fprintf(stderr, "Bad trace header %08x\n", words[0]);
+		return 1;
+	}
+	size_t count = TRACE_COUNT_OF(words[0]);
+	if (words.size() - 1 != count) {
+		fprintf(stderr, "Header says %zu records, found %zu; was the dump cut short?\n", count, words.size() - 1);
+		if (words.size() - 1 < count) {
+			count = words.size() - 1;
+		}
+	}
+
+	// The dump is oldest first; full times start at the first TIME record.
+	// Once the ring has wrapped that may be a roll-over of the high half
+	// rather than a boot or clock change, and then the records before it
+	// belong to the previous high half.
+	bool have_high = false;
+	bool synced = true;
+	uint32_t high = 0;
+	uint32_t prev_low = 0;
+	for (size_t i = 1; i < count; i++) {
+		if (TRACE_ID_OF(words[i]) != TRACE_TIME) {
+			continue;
+		}
+		uint8_t next = TRACE_ID_OF(words[i + 1]);
+		if ((i > 1) && (next != TRACE_BOOT) && (next != TRACE_CLOCK) && TRACE_TIME_OF(words[i])) {
+			high = TRACE_TIME_OF(words[i]) - 1;
+			have_high = true;
+		}
+		break;
+	}
+	for (size_t i = 1; i <= count; i++) {
+		uint32_t r = words[i];
+		if (TRACE_ID_OF(r) == TRACE_TIME) {
+			high = TRACE_TIME_OF(r);
+			have_high = true;
+			prev_low = 0;
+			continue;
+		}
+		uint32_t low = TRACE_TIME_OF(r);
+		if (have_high && (low < prev_low)) {
+			high++;
+		}
+		prev_low = low;
+		if (TRACE_ID_OF(r) == TRACE_BOOT) {
+			synced = false;
+		} else if (TRACE_ID_OF(r) == TRACE_CLOCK) {
+			synced = true;
+		}
+
+		char when[32];
+		if (have_high) {
+			time_t t = (time_t)((high << 16) | low) + offset_s;
+			struct tm tm;
+			gmtime_r(&t, &tm);
+			strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+		} else {
+			snprintf(when, sizeof(when), "%-19s", "(before first time)");
+		}
+		char what[128];
+		describe(r, what, sizeof(what));
+		printf("%s %s  %s\n", synced ? " " : "~", when, what);
+	}
+	return 0;
+}
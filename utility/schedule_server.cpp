@@ -0,0 +1,903 @@
+/*
+    Reference schedule server for okay-to-wake clocks
+
+    Serves schedule documents from memory to many clocks at once. Every
+    document is loaded at start-up (and on SIGHUP), minified, compressed, and
+    rendered into complete HTTP responses. Requests are then answered with a
+    single writev() of pre-built buffers, so no response data is copied or
+    formatted per request. Supports ETag / If-None-Match (304),
+    Content-Encoding: gzip and heatshrink (preferred by the clock, which
+    decodes it in a 256 byte window), Cache-Control: max-age (read by the clock's
+    poll_policy), and shedding load with 503 + Retry-After. Binary telemetry
+    POSTed by clocks to /telemetry is decoded and appended to a log file;
+    a body over 64 KB there, or any body on another request, gets a 413.
+
+    Documents are read from a directory laid out like the download path:
+
+        DIR/okay_to_wake.json                served at /download/okay_to_wake.json
+        DIR/okay_to_wake_calendar.json       served at /download/okay_to_wake_calendar.json
+        DIR/<chip id>/okay_to_wake.json      served at /download/<chip id>/okay_to_wake.json
+
+    A per-device path without its own file falls back to the shared document.
+    Every schedule (a document with weekday keys) is also served as a packed
+    struct otw_week at the same path with a .bin extension.
+
+    To flag a firmware update, put a file named firmware_update next to the
+    schedules it applies to. Its first line is sent as the X-OTW-Update
+    header with those schedules (see sync_session.h), e.g.
+
+        window 0123456789abcdef0123456789abcdef
+        http://192.168.1.10:8080/download/firmware.bin 0123456789abcdef0123456789abcdef
+
+    where the optional second field is the image's MD5, so clocks already
+    running it ignore the flag. Files in DIR are served as they are, so the
+    image can be served from here too.
+
+    Likewise the first line of a file named config is sent as X-OTW-Config,
+    which clocks store in flash (see src/config.h), e.g.
+
+        poll_minutes=30 brightness=180 color_sleep=400000
+
+    Reload with SIGHUP after changing any of these files.
+
+    Build (from the repository root):
+
+        gcc -O2 -c src/cJSON.c -o cJSON.o
+        g++ -O2 -std=gnu++17 -pthread -Isrc -Iutility/host \
+            utility/schedule_server.cpp utility/host/host_shim.cpp \
+            src/wake_schedule.cpp src/schedule_store.cpp src/calendar.cpp \
+            src/schedule_stream.cpp cJSON.o -lz -o schedule_server
+
+    Example:
+
+        ./schedule_server --dir schedules --port 8080 --threads 4
+
+    Options:
+        --dir DIR           document directory (.)
+        --port N            listen port (8080)
+        --threads N         event loops, each with its own SO_REUSEPORT socket (1)
+        --max-age S         Cache-Control max-age sent with documents (3600)
+        --shed-above N      answer 503 when a loop has more open connections (0 = off)
+        --retry-after S     Retry-After sent with 503 responses (600)
+        --stats S           print request and latency stats every S seconds (5)
+        --telemetry FILE    append decoded clock telemetry here (telemetry.log)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <zlib.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Arduino.h"
+#include "CRC32.h"
+#include "cJSON.h"
+#include "wake_schedule.h"
+#include "metrics.h"
+#include "stall.h"
+#include "heatshrink_encoder.h"
+
+using steady = std::chrono::steady_clock;
+
+struct options {
+	const char *dir = ".";
+	int port = 8080;
+	int threads = 1;
+	int max_age = 3600;
+	int shed_above = 0;
+	int retry_after = 600;
+	int stats = 5;
+	const char *telemetry = "telemetry.log";
+};
+
+static options opt;
+
+// Files whose first line is sent as a header with the schedules in the same directory
+static const struct {
+	const char *file;
+	const char *header;
+} flag_files[] = {
+	{ "firmware_update", "X-OTW-Update" },
+	{ "config", "X-OTW-Config" },
+};
+
+/*
+ * Documents
+ */
+
+// One encoding of a document, with its complete response headers
+struct representation {
+	std::string body;
+	std::string head_keep_alive;
+	std::string head_close;
+	std::string not_modified_keep_alive;
+	std::string not_modified_close;
+	std::string etag;
+};
+
+struct document {
+	representation identity;
+	representation gzip;
+	representation heatshrink;
+	bool has_gzip = false;
+	bool has_heatshrink = false;
+};
+
+typedef std::unordered_map<std::string, document> catalog;
+
+static std::shared_ptr<const catalog> current_catalog;
+
+static std::string gzip_compress(const std::string &in) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY);
+	std::string out(deflateBound(&zs, in.size()), '\0');
+	zs.next_in = (Bytef *)in.data();
+	zs.avail_in = in.size();
+	zs.next_out = (Bytef *)&out[0];
+	zs.avail_out = out.size();
+	deflate(&zs, Z_FINISH);
+	out.resize(zs.total_out);
+	deflateEnd(&zs);
+	return out;
+}
+
+static void render(representation &r, const char *content_type, const char *encoding, const char *etag_suffix,
+                   const std::string &flags) {
+	char etag[32];
+	snprintf(etag, sizeof(etag), "\"%08x%s\"", CRC32::calculate((const uint8_t *)r.body.data(), r.body.size()), etag_suffix);
+	r.etag = etag;
+
+	char common[1024];
+	snprintf(common, sizeof(common), "ETag: %s\r\nCache-Control: max-age=%d\r\nVary: Accept-Encoding\r\n%s", etag,
+	         opt.max_age, flags.c_str());
+
+	char head[1280];
+	snprintf(head, sizeof(head),
+	         "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s%s%s%s",
+	         content_type, r.body.size(), common,
+	         encoding ? "Content-Encoding: " : "", encoding ? encoding : "", encoding ? "\r\n" : "");
+	r.head_keep_alive = std::string(head) + "Connection: keep-alive\r\n\r\n";
+	r.head_close = std::string(head) + "Connection: close\r\n\r\n";
+
+	std::string nm = std::string("HTTP/1.1 304 Not Modified\r\n") + common;
+	r.not_modified_keep_alive = nm + "Connection: keep-alive\r\n\r\n";
+	r.not_modified_close = nm + "Connection: close\r\n\r\n";
+}
+
+static void add_document(catalog &cat, const std::string &url, const std::string &body, const char *content_type,
+                         const std::string &flags = "") {
+	document &doc = cat[url];
+	doc.identity.body = body;
+	render(doc.identity, content_type, NULL, "", flags);
+
+	std::string gz = gzip_compress(body);
+	if (gz.size() < body.size()) {
+		doc.gzip.body = gz;
+		render(doc.gzip, content_type, "gzip", "-gz", flags);
+		doc.has_gzip = true;
+	}
+
+	std::string hs = hs_encode(body);
+	if (hs.size() < body.size()) {
+		doc.heatshrink.body = hs;
+		render(doc.heatshrink, content_type, HS_CONTENT_ENCODING, "-hs", flags);
+		doc.has_heatshrink = true;
+	}
+}
+
+static void load_file(catalog &cat, const std::string &path, const std::string &url, const std::string &flags) {
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f) {
+		return;
+	}
+	std::string raw;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		raw.append(buf, n);
+	}
+	fclose(f);
+
+	size_t dot = url.rfind('.');
+	if ((dot == std::string::npos) || (url.compare(dot, std::string::npos, ".json") != 0)) {
+		add_document(cat, url, raw, "application/octet-stream");
+		return;
+	}
+
+	cJSON_Minify(&raw[0]);
+	raw.resize(strlen(raw.c_str()));
+	cJSON *json = cJSON_Parse(raw.c_str());
+	bool is_week = cJSON_HasObjectItem(json, "monday");
+	cJSON_Delete(json);
+	add_document(cat, url, raw, "application/json", is_week ? flags : "");
+
+	// Schedules also get a packed binary rendering built by the firmware's parser
+	struct otw_week week;
+	if (is_week && (parse_schedule_json(&week, raw.c_str(), raw.size()) == 0)) {
+		week.crc = calc_week_crc(&week);
+		std::string bin((const char *)&week, sizeof(week));
+		add_document(cat, url.substr(0, dot) + ".bin", bin, "application/octet-stream", flags);
+	}
+}
+
+static bool is_flag_file(const char *name) {
+	for (auto &flag : flag_files) {
+		if (!strcmp(name, flag.file)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Header lines built from the flag files in DIR, sent with its schedules
+static std::string load_flag_headers(const std::string &dir) {
+	std::string headers;
+	for (auto &flag : flag_files) {
+		FILE *f = fopen((dir + "/" + flag.file).c_str(), "r");
+		if (!f) {
+			continue;
+		}
+		char line[256] = "";
+		if (!fgets(line, sizeof(line), f)) {
+			line[0] = '\0';
+		}
+		fclose(f);
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0]) {
+			printf("Sending %s for %s: %s\n", flag.header, dir.c_str(), line);
+			headers += std::string(flag.header) + ": " + line + "\r\n";
+		}
+	}
+	return headers;
+}
+
+static void load_dir(catalog &cat, const std::string &dir, const std::string &url_prefix, int depth) {
+	DIR *d = opendir(dir.c_str());
+	if (!d) {
+		return;
+	}
+	std::string flags = load_flag_headers(dir);
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL) {
+		if ((e->d_name[0] == '.') || is_flag_file(e->d_name)) {
+			continue;
+		}
+		std::string path = dir + "/" + e->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0) {
+			continue;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			if (depth == 0) {
+				load_dir(cat, path, url_prefix + e->d_name + "/", depth + 1);
+			}
+		} else if (S_ISREG(st.st_mode)) {
+			load_file(cat, path, url_prefix + e->d_name, flags);
+		}
+	}
+	closedir(d);
+}
+
+static void load_catalog(void) {
+	auto cat = std::make_shared<catalog>();
+	load_dir(*cat, opt.dir, "/download/", 0);
+	printf("Loaded %zu documents from %s\n", cat->size(), opt.dir);
+	for (auto &it : *cat) {
+		printf("  %-48s %5zu bytes", it.first.c_str(), it.second.identity.body.size());
+		if (it.second.has_gzip) {
+			printf(", gzip %zu", it.second.gzip.body.size());
+		}
+		if (it.second.has_heatshrink) {
+			printf(", heatshrink %zu", it.second.heatshrink.body.size());
+		}
+		printf("\n");
+	}
+	std::atomic_store(&current_catalog, std::shared_ptr<const catalog>(cat));
+}
+
+// /download/<chip id>/name falls back to /download/name
+static const document *find_document(const catalog &cat, const std::string &url) {
+	auto it = cat.find(url);
+	if (it != cat.end()) {
+		return &it->second;
+	}
+	const std::string prefix = "/download/";
+	if (url.compare(0, prefix.size(), prefix) != 0) {
+		return NULL;
+	}
+	size_t slash = url.find('/', prefix.size());
+	if (slash == std::string::npos) {
+		return NULL;
+	}
+	it = cat.find(prefix + url.substr(slash + 1));
+	return (it != cat.end()) ? &it->second : NULL;
+}
+
+/*
+ * Statistics
+ */
+
+// Log-linear latency histogram: exact below 64 us, 16 sub-buckets per octave above
+#define LAT_BUCKETS (64 + 26 * 16)
+
+struct loop_stats {
+	std::atomic<uint64_t> requests{0};
+	std::atomic<uint64_t> not_modified{0};
+	std::atomic<uint64_t> shed{0};
+	std::atomic<uint64_t> bytes_out{0};
+	std::atomic<uint32_t> connections{0};
+	std::atomic<uint32_t> latency[LAT_BUCKETS];
+	loop_stats() { for (auto &b : latency) b = 0; }
+};
+
+static int latency_bucket(uint64_t us) {
+	if (us < 64) {
+		return us;
+	}
+	int msb = 63 - __builtin_clzll(us);
+	int b = 64 + (msb - 6) * 16 + ((us >> (msb - 4)) & 15);
+	return (b < LAT_BUCKETS) ? b : LAT_BUCKETS - 1;
+}
+
+static uint64_t bucket_floor(int b) {
+	if (b < 64) {
+		return b;
+	}
+	int msb = (b - 64) / 16 + 6;
+	return ((uint64_t)1 << msb) | ((uint64_t)((b - 64) % 16) << (msb - 4));
+}
+
+/*
+ * Connections
+ */
+
+// Longest request head accepted, and longest telemetry body
+#define HEADERS_MAX 8192
+#define TELEMETRY_BODY_MAX 65536
+
+struct connection {
+	int fd;
+	std::string in;
+	steady::time_point first_byte;
+	std::shared_ptr<const catalog> cat; // keeps pending iovecs valid across a reload
+	struct iovec out[2];
+	int out_count = 0;
+	bool close_after = false;
+};
+
+static const char RESPONSE_404[] =
+	"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char RESPONSE_400[] =
+	"HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char RESPONSE_413[] =
+	"HTTP/1.1 413 Content Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char RESPONSE_204_KEEP_ALIVE[] =
+	"HTTP/1.1 204 No Content\r\nConnection: keep-alive\r\n\r\n";
+static const char RESPONSE_204_CLOSE[] =
+	"HTTP/1.1 204 No Content\r\nConnection: close\r\n\r\n";
+static char response_503[160];
+
+static bool header_has(const std::string &req, size_t end, const char *name, const char *token) {
+	size_t name_len = strlen(name);
+	size_t pos = 0;
+	while ((pos = req.find("\r\n", pos)) != std::string::npos && pos < end) {
+		pos += 2;
+		if (strncasecmp(req.c_str() + pos, name, name_len) == 0 && req[pos + name_len] == ':') {
+			size_t eol = req.find("\r\n", pos);
+			std::string value = req.substr(pos + name_len + 1, eol - pos - name_len - 1);
+			return token ? (strcasestr(value.c_str(), token) != NULL) : true;
+		}
+	}
+	return false;
+}
+
+static std::string header_get(const std::string &req, size_t end, const char *name) {
+	size_t name_len = strlen(name);
+	size_t pos = 0;
+	while ((pos = req.find("\r\n", pos)) != std::string::npos && pos < end) {
+		pos += 2;
+		if (strncasecmp(req.c_str() + pos, name, name_len) == 0 && req[pos + name_len] == ':') {
+			size_t start = pos + name_len + 1;
+			while (req[start] == ' ') {
+				start++;
+			}
+			return req.substr(start, req.find("\r\n", start) - start);
+		}
+	}
+	return std::string();
+}
+
+// Returns false when the connection should be closed
+static bool flush_output(connection &c, loop_stats &stats) {
+	while (c.out_count) {
+		ssize_t n = writev(c.fd, c.out, c.out_count);
+		if (n < 0) {
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+		stats.bytes_out += n;
+		while (n > 0 && c.out_count) {
+			if ((size_t)n >= c.out[0].iov_len) {
+				n -= c.out[0].iov_len;
+				c.out[0] = c.out[1];
+				c.out_count--;
+			} else {
+				c.out[0].iov_base = (char *)c.out[0].iov_base + n;
+				c.out[0].iov_len -= n;
+				n = 0;
+			}
+		}
+	}
+	uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(steady::now() - c.first_byte).count();
+	stats.latency[latency_bucket(us)]++;
+	return !c.close_after;
+}
+
+static void queue_static(connection &c, const char *msg, size_t len) {
+	c.out[0].iov_base = (void *)msg;
+	c.out[0].iov_len = len;
+	c.out_count = 1;
+}
+
+/*
+ * Telemetry
+ */
+
+static std::mutex telemetry_lock;
+static FILE *telemetry_log;
+
+static const char *stall_names[STALL_REGIONS] = {
+	"loop", "wifi", "dns", "ntp", "schedule", "calendar", "telemetry", "update", "ota", "mqtt"
+};
+
+static void format_record(char *line, size_t len, uint32_t chip_id, const struct metric_record &r) {
+	int n = snprintf(line, len, "%u %06x ", r.time, chip_id);
+	switch (r.type) {
+		case METRIC_BOOT:
+			snprintf(line + n, len - n, "boot reset_reason=%u\n", r.a);
+			break;
+		case METRIC_TRANSITION:
+			snprintf(line + n, len - n, "transition state=%s strip_ma=%u\n", get_event_str(r.a), r.b);
+			break;
+		case METRIC_WIFI:
+			if (r.a) {
+				snprintf(line + n, len - n, "wifi rssi=-%u connect_ms=%u\n", r.a, r.b);
+			} else {
+				snprintf(line + n, len - n, "wifi failed connect_ms=%u\n", r.b);
+			}
+			break;
+		case METRIC_NTP:
+			snprintf(line + n, len - n, "ntp requests=%u correction_s=%d\n", r.a, (int16_t)r.b);
+			break;
+		case METRIC_HEAP:
+			snprintf(line + n, len - n, "heap free=%u fragmentation=%u%%\n", r.b, r.a);
+			break;
+		case METRIC_SESSION:
+			snprintf(line + n, len - n, "session radio_on_ms=%u failed_stages=0x%02x\n",
+			         r.b * METRICS_SESSION_UNIT_MS, r.a);
+			break;
+		case METRIC_ENERGY:
+			snprintf(line + n, len - n, "energy mah_per_day=%u radio_pct=%u\n", r.b, r.a);
+			break;
+		case METRIC_STALL:
+			snprintf(line + n, len - n, "stall region=%s count=%u%s max_ms=%u\n",
+			         (STALL_REGION_OF(r.a) < STALL_REGIONS) ? stall_names[STALL_REGION_OF(r.a)] : "?",
+			         STALL_COUNT_OF(r.a), (STALL_COUNT_OF(r.a) == 15) ? "+" : "", r.b);
+			break;
+		default:
+			snprintf(line + n, len - n, "type%u a=%u b=%u\n", r.type, r.a, r.b);
+			break;
+	}
+}
+
+// Decode one upload (see struct telemetry_header) into the log file
+static bool log_telemetry(const char *body, size_t len) {
+	struct telemetry_header h;
+	if (len < sizeof(h)) {
+		return false;
+	}
+	memcpy(&h, body, sizeof(h));
+	if ((h.magic != TELEMETRY_MAGIC) || (h.version != TELEMETRY_VERSION) ||
+	    (len != sizeof(h) + (h.count * sizeof(struct metric_record)))) {
+		return false;
+	}
+
+	std::string out;
+	char line[160];
+	int n = snprintf(line, sizeof(line), "%ld %06x upload schedule_crc=%08x uptime_s=%u loop_max_ms=%u loop_hist=",
+	                 (long)time(NULL), h.chip_id, h.schedule_crc, h.uptime_s, h.loop_max_ms);
+	for (int i = 0; i < METRICS_LOOP_BUCKETS; i++) {
+		n += snprintf(line + n, sizeof(line) - n, (i ? ",%u" : "%u"), h.loop_hist[i]);
+	}
+	out += line;
+	out += "\n";
+	for (int i = 0; i < h.count; i++) {
+		struct metric_record r;
+		memcpy(&r, body + sizeof(h) + (i * sizeof(r)), sizeof(r));
+		format_record(line, sizeof(line), h.chip_id, r);
+		out += line;
+	}
+
+	std::lock_guard<std::mutex> lock(telemetry_lock);
+	if (telemetry_log) {
+		fputs(out.c_str(), telemetry_log);
+		fflush(telemetry_log);
+	}
+	return true;
+}
+
+// Parse a Content-Length of at most max; false if it is not a decimal number
+// (too_large clear) or is larger (too_large set)
+static bool parse_length(const std::string &value, size_t max, size_t *len, bool *too_large) {
+	*len = 0;
+	*too_large = false;
+	if (value.empty()) {
+		return false;
+	}
+	for (char ch : value) {
+		if ((ch < '0') || (ch > '9')) {
+			return false;
+		}
+		*len = (*len * 10) + (ch - '0');
+		if (*len > max) {
+			*too_large = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Answer with a canned error and drop whatever else the client sent
+static size_t reject(connection &c, const char *msg, size_t len) {
+	queue_static(c, msg, len);
+	c.close_after = true;
+	return c.in.size();
+}
+
+// Parse one complete request from c.in; returns 0 if more bytes are needed
+static size_t handle_request(connection &c, loop_stats &stats) {
+	size_t end = c.in.find("\r\n\r\n");
+	if (end == std::string::npos) {
+		if (c.in.size() > HEADERS_MAX) {
+			return reject(c, RESPONSE_400, sizeof(RESPONSE_400) - 1);
+		}
+		return 0;
+	}
+	size_t sp1 = c.in.find(' ');
+	size_t sp2 = c.in.find(' ', sp1 + 1);
+	bool telemetry = (sp1 != std::string::npos) && (sp2 != std::string::npos) && (sp2 < end) &&
+	                 (c.in.compare(0, sp1, "POST") == 0) &&
+	                 (c.in.compare(sp1 + 1, sp2 - sp1 - 1, "/telemetry") == 0);
+
+	// Only telemetry uploads carry a body, so nothing else may buffer one
+	size_t consumed = end + 4;
+	std::string length = header_get(c.in, end, "Content-Length");
+	if (!length.empty()) {
+		size_t body_len;
+		bool too_large;
+		if (!parse_length(length, telemetry ? TELEMETRY_BODY_MAX : 0, &body_len, &too_large)) {
+			return too_large ? reject(c, RESPONSE_413, sizeof(RESPONSE_413) - 1) :
+			                   reject(c, RESPONSE_400, sizeof(RESPONSE_400) - 1);
+		}
+		consumed += body_len;
+		if (c.in.size() < consumed) {
+			return 0;
+		}
+	}
+
+	stats.requests++;
+	bool http10 = (c.in.find("HTTP/1.0") < end);
+	c.close_after = header_has(c.in, end, "Connection", "close") ||
+	                (http10 && !header_has(c.in, end, "Connection", "keep-alive"));
+
+	if ((opt.shed_above > 0) && (stats.connections > (uint32_t)opt.shed_above)) {
+		stats.shed++;
+		queue_static(c, response_503, strlen(response_503));
+		c.close_after = true;
+		return consumed;
+	}
+
+	if (telemetry) {
+		if (!log_telemetry(c.in.data() + end + 4, consumed - end - 4)) {
+			queue_static(c, RESPONSE_400, sizeof(RESPONSE_400) - 1);
+			c.close_after = true;
+		} else if (c.close_after) {
+			queue_static(c, RESPONSE_204_CLOSE, sizeof(RESPONSE_204_CLOSE) - 1);
+		} else {
+			queue_static(c, RESPONSE_204_KEEP_ALIVE, sizeof(RESPONSE_204_KEEP_ALIVE) - 1);
+		}
+		return consumed;
+	}
+	if ((sp1 == std::string::npos) || (sp2 == std::string::npos) || (sp2 > end) ||
+	    (c.in.compare(0, sp1, "GET") != 0)) {
+		queue_static(c, RESPONSE_404, sizeof(RESPONSE_404) - 1);
+		c.close_after = true;
+		return consumed;
+	}
+	std::string url = c.in.substr(sp1 + 1, sp2 - sp1 - 1);
+
+	c.cat = std::atomic_load(&current_catalog);
+	const document *doc = find_document(*c.cat, url);
+	if (!doc) {
+		queue_static(c, RESPONSE_404, sizeof(RESPONSE_404) - 1);
+		c.close_after = true;
+		return consumed;
+	}
+
+	const representation *r = &doc->identity;
+	if (doc->has_heatshrink && header_has(c.in, end, "Accept-Encoding", HS_CONTENT_ENCODING)) {
+		r = &doc->heatshrink;
+	} else if (doc->has_gzip && header_has(c.in, end, "Accept-Encoding", "gzip")) {
+		r = &doc->gzip;
+	}
+
+	std::string inm = header_get(c.in, end, "If-None-Match");
+	if (!inm.empty() && (inm.find(r->etag) != std::string::npos || inm == "*")) {
+		stats.not_modified++;
+		const std::string &head = c.close_after ? r->not_modified_close : r->not_modified_keep_alive;
+		queue_static(c, head.data(), head.size());
+		return consumed;
+	}
+
+	const std::string &head = c.close_after ? r->head_close : r->head_keep_alive;
+	c.out[0].iov_base = (void *)head.data();
+	c.out[0].iov_len = head.size();
+	c.out[1].iov_base = (void *)r->body.data();
+	c.out[1].iov_len = r->body.size();
+	c.out_count = 2;
+	return consumed;
+}
+
+static int make_listener(void) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opt.port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4096) < 0) {
+		perror("listen");
+		exit(1);
+	}
+	return fd;
+}
+
+static void close_connection(int epfd, std::unordered_map<int, connection> &conns, int fd, loop_stats &stats) {
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+	conns.erase(fd);
+	stats.connections--;
+}
+
+static void event_loop(loop_stats *stats) {
+	int listener = make_listener();
+	int epfd = epoll_create1(0);
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = listener;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev);
+
+	std::unordered_map<int, connection> conns;
+	struct epoll_event events[256];
+	char buf[16384];
+
+	while (true) {
+		int n = epoll_wait(epfd, events, 256, -1);
+		for (int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			if (fd == listener) {
+				int cfd;
+				while ((cfd = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+					int one = 1;
+					setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+					connection &c = conns[cfd];
+					c.fd = cfd;
+					ev.events = EPOLLIN | EPOLLRDHUP;
+					ev.data.fd = cfd;
+					epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev);
+					stats->connections++;
+				}
+				continue;
+			}
+
+			auto it = conns.find(fd);
+			if (it == conns.end()) {
+				continue;
+			}
+			connection &c = it->second;
+
+			if (events[i].events & EPOLLOUT) {
+				if (!flush_output(c, *stats)) {
+					close_connection(epfd, conns, fd, *stats);
+					continue;
+				}
+				if (c.out_count == 0) {
+					ev.events = EPOLLIN | EPOLLRDHUP;
+					ev.data.fd = fd;
+					epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+					// Pick up requests pipelined behind the one just sent
+					events[i].events |= EPOLLIN;
+				}
+			}
+
+			if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+				bool closed = false;
+				ssize_t r;
+				while ((r = read(fd, buf, sizeof(buf))) > 0) {
+					if (c.in.empty()) {
+						c.first_byte = steady::now();
+					}
+					c.in.append(buf, r);
+				}
+				if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+					closed = true;
+				}
+
+				// Answer every complete pipelined request unless output is backed up
+				while (c.out_count == 0 && !c.in.empty()) {
+					size_t used = handle_request(c, *stats);
+					if (used == 0) {
+						break;
+					}
+					c.in.erase(0, used);
+					bool keep = flush_output(c, *stats);
+					if (c.out_count) {
+						ev.events = EPOLLOUT | EPOLLRDHUP;
+						ev.data.fd = fd;
+						epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+						break;
+					}
+					if (!keep) {
+						closed = true;
+						break;
+					}
+					if (!c.in.empty()) {
+						c.first_byte = steady::now();
+					}
+				}
+				if (closed && c.out_count == 0) {
+					close_connection(epfd, conns, fd, *stats);
+				}
+			}
+		}
+	}
+}
+
+static void print_stats(std::vector<std::unique_ptr<loop_stats>> &loops, double seconds) {
+	static uint64_t last_requests = 0;
+	static std::vector<uint32_t> last_hist(LAT_BUCKETS, 0);
+	uint64_t requests = 0, not_modified = 0, shed = 0, bytes = 0;
+	uint32_t conns = 0;
+	std::vector<uint32_t> hist(LAT_BUCKETS, 0);
+	for (auto &l : loops) {
+		requests += l->requests;
+		not_modified += l->not_modified;
+		shed += l->shed;
+		bytes += l->bytes_out;
+		conns += l->connections;
+		for (int b = 0; b < LAT_BUCKETS; b++) {
+			hist[b] += l->latency[b];
+		}
+	}
+
+	// Percentiles over this interval only
+	std::vector<uint32_t> delta(LAT_BUCKETS);
+	uint64_t count = 0;
+	for (int b = 0; b < LAT_BUCKETS; b++) {
+		delta[b] = hist[b] - last_hist[b];
+		count += delta[b];
+	}
+	auto pct = [&](double p) -> uint64_t {
+		uint64_t target = (uint64_t)(p * count), seen = 0;
+		for (int b = 0; b < LAT_BUCKETS; b++) {
+			seen += delta[b];
+			if (seen > target) {
+				return bucket_floor(b);
+			}
+		}
+		return 0;
+	};
+	int max_b = 0;
+	for (int b = 0; b < LAT_BUCKETS; b++) {
+		if (delta[b]) {
+			max_b = b;
+		}
+	}
+
+	printf("%8.0f req/s  p50 %6lu us  p99 %6lu us  p99.9 %6lu us  max %6lu us  conns %u  "
+	       "total %lu (304 %lu, 503 %lu)  %.1f MB out\n",
+	       (requests - last_requests) / seconds, pct(0.5), pct(0.99), pct(0.999),
+	       count ? bucket_floor(max_b) : 0, conns, requests, not_modified, shed, bytes / 1e6);
+	fflush(stdout);
+	last_requests = requests;
+	last_hist = hist;
+}
+
+static volatile sig_atomic_t reload_requested = 0;
+
+static void on_sighup(int) {
+	reload_requested = 1;
+}
+
+static void parse_args(int argc, char **argv) {
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const char *arg = argv[i];
+		const char *val = argv[i + 1];
+		if (!strcmp(arg, "--dir")) opt.dir = val;
+		else if (!strcmp(arg, "--port")) opt.port = atoi(val);
+		else if (!strcmp(arg, "--threads")) opt.threads = atoi(val);
+		else if (!strcmp(arg, "--max-age")) opt.max_age = atoi(val);
+		else if (!strcmp(arg, "--shed-above")) opt.shed_above = atoi(val);
+		else if (!strcmp(arg, "--retry-after")) opt.retry_after = atoi(val);
+		else if (!strcmp(arg, "--stats")) opt.stats = atoi(val);
+		else if (!strcmp(arg, "--telemetry")) opt.telemetry = val;
+		else {
+			fprintf(stderr, "Unknown option %s\n", arg);
+			exit(1);
+		}
+	}
+	if (argc % 2 == 0) {
+		fprintf(stderr, "Missing value for %s\n", argv[argc - 1]);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv) {
+	parse_args(argc, argv);
+	host_serial_echo = false;
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGHUP, on_sighup);
+	snprintf(response_503, sizeof(response_503),
+	         "HTTP/1.1 503 Service Unavailable\r\nRetry-After: %d\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+	         opt.retry_after);
+
+	load_catalog();
+	telemetry_log = fopen(opt.telemetry, "a");
+	if (!telemetry_log) {
+		fprintf(stderr, "Cannot open %s, telemetry will be accepted but not logged\n", opt.telemetry);
+	}
+
+	std::vector<std::unique_ptr<loop_stats>> loops;
+	std::vector<std::thread> threads;
+	for (int i = 0; i < opt.threads; i++) {
+		loops.emplace_back(new loop_stats());
+		threads.emplace_back(event_loop, loops.back().get());
+	}
+	printf("Listening on port %d with %d event loop(s)\n", opt.port, opt.threads);
+
+	steady::time_point last = steady::now();
+	while (true) {
+		sleep(opt.stats);
+		if (reload_requested) {
+			reload_requested = 0;
+			load_catalog();
+		}
+		steady::time_point t = steady::now();
+		print_stats(loops, std::chrono::duration<double>(t - last).count());
+		last = t;
+	}
+}
@@ -0,0 +1,176 @@
+/*
+    WS2812 UART encoder check
+
+    Encodes test frames with the firmware's UART encoder (src/ws2812_uart.cpp),
+    rebuilds the waveform the inverted 6N1 UART puts on the data line, and
+    checks every high and low time against the WS2812B datasheet, then
+    decodes the waveform and compares it with the input. Exits non-zero on
+    any violation, so it can guard changes to the encoding table or baud
+    rate.
+
+    Build (from the repository root):
+
+        g++ -O2 -std=gnu++17 -Isrc utility/ws2812_check.cpp \
+            src/ws2812_uart.cpp -o ws2812_check
+
+    Example:
+
+        ./ws2812_check --pixels 3
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "ws2812_uart.h"
+
+// WS2812B datasheet, ns: nominal and allowed error
+#define T0H_NS 400
+#define T1H_NS 800
+#define T0L_NS 850
+#define T1L_NS 450
+#define TOLERANCE_NS 150
+
+// Bits per UART frame: start, 6 data, stop
+#define UART_FRAME_SLOTS 8
+
+struct options {
+	int pixels = 3;
+};
+
+static options opt;
+
+// Line level per UART bit time: start high, inverted data LSB first, stop low
+static std::vector<bool> line_slots(const std::vector<uint8_t> &uart) {
+	std::vector<bool> slots;
+	for (uint8_t byte : uart) {
+		slots.push_back(true);
+		for (int b = 0; b < 6; b++) {
+			slots.push_back(!((byte >> b) & 1));
+		}
+		slots.push_back(false);
+	}
+	return slots;
+}
+
+static bool within(double ns, int nominal) {
+	return (ns >= nominal - TOLERANCE_NS) && (ns <= nominal + TOLERANCE_NS);
+}
+
+/** @brief Check the waveform for a set of bytes.
+ *
+ * @return number of problems found
+ */
+static int check_frame(const char *name, const std::vector<uint8_t> &data) {
+	std::vector<uint8_t> uart(data.size() * WS2812_UART_EXPAND);
+	size_t n = ws2812_uart_encode(data.data(), data.size(), uart.data());
+	if (n != uart.size()) {
+		printf("%s: encoder wrote %zu bytes, expected %zu\n", name, n, uart.size());
+		return 1;
+	}
+
+	std::vector<bool> slots = line_slots(uart);
+	const double slot_ns = 1e9 / WS2812_UART_BAUD;
+	std::vector<uint8_t> decoded(data.size());
+	size_t bit = 0;
+	int problems = 0;
+	size_t i = 0;
+
+	// Each WS2812 bit is a high pulse followed by a low gap
+	while (i < slots.size()) {
+		if (!slots[i]) {
+			printf("%s: line low where bit %zu should start\n", name, bit);
+			return problems + 1;
+		}
+		size_t high = 0;
+		while ((i < slots.size()) && slots[i]) {
+			high++;
+			i++;
+		}
+		size_t low = 0;
+		while ((i < slots.size()) && !slots[i]) {
+			low++;
+			i++;
+		}
+		double high_ns = high * slot_ns;
+		double low_ns = low * slot_ns;
+		bool one = high_ns > ((T0H_NS + T1H_NS) / 2);
+		bool last = (i == slots.size());
+
+		if (!within(high_ns, one ? T1H_NS : T0H_NS)) {
+			printf("%s: bit %zu high for %.0f ns\n", name, bit, high_ns);
+			problems++;
+		}
+		// The last gap runs into the latch, so only its minimum matters
+		if (last ? (low_ns < (one ? T1L_NS : T0L_NS) - TOLERANCE_NS) : !within(low_ns, one ? T1L_NS : T0L_NS)) {
+			printf("%s: bit %zu low for %.0f ns\n", name, bit, low_ns);
+			problems++;
+		}
+		if ((bit / 8) < decoded.size()) {
+			decoded[bit / 8] |= (one ? 0x80 : 0) >> (bit % 8);
+		}
+		bit++;
+	}
+
+	if (bit != data.size() * 8) {
+		printf("%s: decoded %zu bits, expected %zu\n", name, bit, data.size() * 8);
+		problems++;
+	} else if (decoded != data) {
+		printf("%s: decoded bytes differ from the input\n", name);
+		problems++;
+	}
+	if ((slots.size() % UART_FRAME_SLOTS) || (slots.back() != false)) {
+		printf("%s: line does not return low at the end of the frame\n", name);
+		problems++;
+	}
+
+	double frame_us = slots.size() * slot_ns / 1000;
+	printf("%-12s %4zu bytes -> %4zu UART bytes, %7.1f us + %d us latch: %s\n", name, data.size(),
+	       uart.size(), frame_us, WS2812_RESET_US, problems ? "FAIL" : "ok");
+	return problems;
+}
+
+static void parse_args(int argc, char **argv) {
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--pixels") && (i + 1 < argc)) {
+			opt.pixels = atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			exit(1);
+		}
+	}
+	if (opt.pixels <= 0) {
+		fprintf(stderr, "Invalid options\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv) {
+	parse_args(argc, argv);
+	size_t len = opt.pixels * 3;
+	int problems = 0;
+
+	// Every byte value, so each bit pair is seen in each position
+	std::vector<uint8_t> all(256);
+	for (int i = 0; i < 256; i++) {
+		all[i] = i;
+	}
+	problems += check_frame("all bytes", all);
+
+	problems += check_frame("off", std::vector<uint8_t>(len, 0x00));
+	problems += check_frame("white", std::vector<uint8_t>(len, 0xFF));
+
+	std::vector<uint8_t> random(len);
+	srand(1);
+	for (size_t i = 0; i < len; i++) {
+		random[i] = rand() & 0xFF;
+	}
+	problems += check_frame("random", random);
+
+	if (problems) {
+		printf("%d timing problem(s)\n", problems);
+		return 1;
+	}
+	return 0;
+}